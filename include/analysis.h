@@ -0,0 +1,26 @@
+#ifndef __ANALYSIS_H
+#define __ANALYSIS_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Beat grid of the show track. The onsets come from the spectral flux of
+// the decoded samples, the tempo from their autocorrelation and the beats
+// from a dynamic programming tracker that may drift with the music.
+// The grid is cached in "<sound file>.beats" together with a hash of the
+// sound file, so it is only computed again when the file changes.
+#define ANALYSIS_BEATS_PER_BAR 4
+
+typedef struct
+{
+  double* beats; // ms from the start of the track, ascending
+  uint8_t* downbeats; // 1 where a bar starts
+  size_t beatCount;
+  double bpm; // average tempo
+} BBMXbeatgrid;
+
+// bpmHint: tempo the track is expected to have, 0 = no preference
+int analysis_load(const char* path, double bpmHint, BBMXbeatgrid* grid);
+void analysis_free(BBMXbeatgrid* grid);
+
+#endif // __ANALYSIS_H
@@ -0,0 +1,27 @@
+#ifndef __AUDIO_H
+#define __AUDIO_H
+
+// Playback of the show track. When streaming, a worker thread decodes the
+// file into a small ring of queued OpenAL buffers ahead of the play cursor,
+// otherwise the whole file is decoded into a single buffer up front.
+// Either way the position is counted in samples from the start of the track,
+// so it doesn't jump when the source moves on to the next buffer.
+#define AUDIO_STREAM_BUFFERS 4
+#define AUDIO_STREAM_FRAMES 8192 // per buffer, ~186 ms at 44.1 kHz
+
+int audio_open(const char* path, int stream);
+void audio_close();
+// 0 once the track has played to the end
+int audio_playing();
+// Playback position of the source in ms. That is where the mixer is,
+// the speakers are audio_latency_ms behind.
+double audio_position_ms();
+// Device latency at the last audio_position_ms call, 0 without
+// AL_SOFT_source_latency
+double audio_latency_ms();
+unsigned int audio_sample_rate();
+// Copies the mono mix of the `frames` samples right before the play
+// position into `out` and returns that position in frames. Thread safe.
+unsigned long long audio_tap(float* out, int frames);
+
+#endif // __AUDIO_H
@@ -3,11 +3,14 @@
 
 #include <lua/lua.h>
 #include "bbmxs/bbmxs.h"
+#include "bbmxs/layer.h"
 
 #define LAPI_SUCCESS 0
 #define LAPI_ERR_UNKNOWN -1
 
 int bbmx_lapi_load(lua_State* L, BBMXSinitargs* initargs);
 void bbmx_lapi_loaded();
+// The API of a layer script, only the fixture setters that write into `layer`
+void bbmx_lapi_load_layer(lua_State* L, BBMXSlayer* layer);
 
 #endif // __BBMX_LAPI_H
\ No newline at end of file
@@ -1,8 +0,0 @@
-#ifndef __BBMX_LAPI_INTERFACE_H
-#define __BBMX_LAPI_INTERFACE_H
-
-#include "bbmxs/bbmxs.h"
-
-void bbmxi_do_flash(BBMXStimedflash flash);
-
-#endif // __BBMX_LAPI_INTERFACE_H
\ No newline at end of file
@@ -2,12 +2,26 @@
 #define __BBMXS_H
 
 #include <stdint.h>
+#include <stddef.h>
 #include "models.h"
 
-#define BBMXS_CMD_DMX_WRITE 0x01
+#define BBMXS_CMD_DMX_WRITE 0x01 // [count, (channel, value) * count]
+#define BBMXS_CMD_DMX_RANGE 0x02 // [universe, start hi, start lo, count hi, count lo, value * count], start is 1-512 (v2 only)
+#define BBMXS_CMD_DMX_FRAME 0x03 // [universe, value * 512] (v2 only)
+#define BBMXS_CMD_DMX_DELTA 0x04 // [universe, (start hi, start lo, count, value * count) * n] (v2 only)
+
+#define BBMXS_PROTOCOL_V1 1 // stop-and-wait, controller echoes the command byte
+#define BBMXS_PROTOCOL_V2 2 // pipelined, see proto.h
+
+#define BBMXS_LAYER_HTP 0 // highest value wins
+#define BBMXS_LAYER_LTP 1 // replaces the value below wherever the layer sets a channel
+
+#define BBMXS_UNIVERSE_SIZE 512
+#define BBMXS_DEFAULT_MAX_SPEED 180 // degrees per second, for models without max_speed
+#define BBMXS_PACKET_SIZE 64
 
 typedef uint8_t BBMXSbool;
-typedef uint8_t DMXChannel;
+typedef uint16_t DMXChannel;
 typedef uint8_t BBMXScmd;
 
 typedef struct
@@ -18,7 +32,7 @@ typedef struct
   float w;
 } BBMXScolor;
 
-// Relative to fixture address
+// Relative to fixture address, 1 is the fixture address itself, 0 = not available
 typedef struct
 {
   DMXChannel ch_red;
@@ -27,17 +41,20 @@ typedef struct
   DMXChannel ch_white;
   DMXChannel ch_tilt;
   DMXChannel ch_pan;
-  DMXChannel ch_mtr_spd; // motor speed
+  DMXChannel ch_tilt_fine; // low byte of a 16 bit tilt
+  DMXChannel ch_pan_fine; // low byte of a 16 bit pan
+  DMXChannel ch_mtr_spd; // motor speed, 0 = fastest
   DMXChannel ch_brgt; // brightness
 } BBMXSchannelconfig;
 
 typedef struct
 {
-  uint8_t channelModes[8];
+  uint16_t channelModes[8]; // channel count per mode
   uint8_t channelModesLen;
   BBMXSchannelconfig ch_cfg;
   float max_tilt;
   float max_pan;
+  float max_speed; // degrees per second at full motor speed
 } BBMXSmodelopts;
 
 typedef struct
@@ -59,7 +76,7 @@ typedef struct
   uint8_t brightness;
   float tilt;
   float pan;
-  DMXChannel address;
+  DMXChannel address; // 1-512 within the universe
 } BBMXSfixture;
 
 typedef struct
@@ -73,11 +90,30 @@ typedef struct
   float pan;
 } BBMXSgroup;
 
+// Shadow copy of one DMX universe. Setters only write in here,
+// bbmxs_flush hands the frame to the output threads once per tick
+// when any universe changed, they work out what to send.
+typedef struct
+{
+  uint8_t slots[BBMXS_UNIVERSE_SIZE];
+  uint8_t changed; // since the last bbmxs_flush
+} BBMXSuniverse;
+
+// One controller or network target. Every port gets its own output thread.
+typedef struct
+{
+  char* name; // COM port, "artnet:<host>" or "sacn:<host>"
+  int baud;
+  uint8_t* universes; // ascending, only patched ones once the context is set up
+  uint16_t universeCount; // 0 = every universe no other port takes
+} BBMXSport;
+
 typedef struct
 {
   char* name;
   float t;
-  int used;
+  int ref; // the function in the Lua registry
+  int order; // registration order, keeps cues with the same time in order
 } BBMXStimedfunc;
 
 typedef struct
@@ -89,21 +125,40 @@ typedef struct
   float speed;
 } BBMXStimedflash;
 
+// A script that runs on its own thread and writes into its own layer
+typedef struct
+{
+  char* script;
+  uint8_t mode; // BBMXS_LAYER_*
+} BBMXSlayerscript;
+
 typedef struct
 {
   BBMXSbool debugMode;
   BBMXSmodel* models;
   uint16_t modelCount;
-  char* port;
+  BBMXSport* ports;
+  uint8_t portCount;
+  uint8_t protocol;
+  int keyframeInterval; // ms, 0 = never
   BBMXSfixture* fixtures;
   uint16_t fixtureCount;
+  BBMXSgroup* groups;
+  uint16_t groupCount;
   BBMXStimedfunc* timedFunctions;
   size_t timedFunctionCount;
   BBMXStimedflash* timedFlashes;
   size_t timedFlashCount;
+  BBMXSlayerscript* layers;
+  uint8_t layerCount;
   char* sndFile;
-  float bpm;
-  int bpm_resolution;
+  BBMXSbool sndStream; // decode while playing instead of up front
+  uint8_t audioBands; // 0 = no audio features
+  float audioLatency; // ms until the speakers play what is mixed, < 0 = ask the device
+  float outputLatency; // ms until the fixtures show a frame that is sent
+  float bpm; // fixed tempo, or the expected one for the beat analysis
+  int bpm_resolution; // BBMX_beat calls per beat
+  BBMXSbool beatAnalysis;
 } BBMXSinitargs;
 
 typedef struct
@@ -111,26 +166,64 @@ typedef struct
   BBMXSbool debugMode;
   BBMXSmodel* models;
   uint16_t modelCount;
-  char* port;
+  BBMXSport* ports;
+  uint8_t portCount;
+  uint8_t protocol;
+  int keyframeInterval; // ms, 0 = never
   BBMXSfixture* fixtures;
   uint16_t fixtureCount;
-  BBMXStimedfunc* timedFunctions;
+  BBMXSgroup* groups;
+  uint16_t groupCount;
+  BBMXStimedfunc* timedFunctions; // sorted by time
   size_t timedFunctionCount;
+  size_t timedFunctionNext; // first one that hasn't been called yet
   BBMXStimedflash* timedFlashes;
   size_t timedFlashCount;
+  BBMXSlayerscript* layers; // in merge order
+  uint8_t layerCount;
   char* sndFile;
-  float bpm;
-  int bpm_resolution;
+  BBMXSbool sndStream; // decode while playing instead of up front
+  uint8_t audioBands; // 0 = no audio features
+  float audioLatency; // ms until the speakers play what is mixed, < 0 = ask the device
+  float outputLatency; // ms until the fixtures show a frame that is sent
+  float bpm; // fixed tempo, or the expected one for the beat analysis
+  int bpm_resolution; // BBMX_beat calls per beat
+  BBMXSbool beatAnalysis;
   float beat_time;
+  BBMXSuniverse** universes; // indexed by universe - 1, NULL when no fixture is patched there
+  BBMXSuniverse** output; // what is sent, the universes or with layers the merge of them
+  uint16_t universeCount; // highest patched universe
+  uint8_t* patched; // patched universes in ascending order
+  uint16_t patchedCount;
 } BBMXScontext;
 
 BBMXScontext* bbmxs_init(BBMXSinitargs* initargs);
+// Takes the fixtures, groups and cues of a reloaded script into the running
+// context, ports, sound and patched universes stay. Always takes over the
+// initargs. 0 when the script needs a universe that has no output, the
+// context is unchanged then. -1 when it failed halfway and can't go on.
+int bbmxs_reload(BBMXSinitargs* initargs);
+void bbmxs_free_initargs(BBMXSinitargs* initargs);
 void bbmxs_close();
 int bbmxs_load_models();
 BBMXSmodel* bbmxs_get_model(const char* name);
+uint16_t bbmxs_model_footprint(const BBMXSmodel* model, uint8_t channelMode);
 BBMXSfixture* bbmxs_get_fx(const char* name);
 void bbmxs_fx_update_color(BBMXSfixture* fx);
-int bbmxs_send_command(BBMXScmd cmd, void* data, size_t size);
+void bbmxs_fx_write(BBMXSfixture* fx, DMXChannel channel, uint8_t value);
+void bbmxs_fx_set_tilt(BBMXSfixture* fx, float angle);
+void bbmxs_fx_set_pan(BBMXSfixture* fx, float angle);
+// `angle` out of 0-max as a DMX value, 16 bit when there is a fine channel
+uint16_t bbmxs_angle_to_dmx(float angle, float max, BBMXSbool fine);
+BBMXSgroup* bbmxs_get_group(const char* name);
+// The group setters store the value in the group and write it to all members
+void bbmxs_grp_update_color(BBMXSgroup* grp);
+void bbmxs_grp_set_brightness(BBMXSgroup* grp, uint8_t brightness);
+// Moves all members at `speed`, see motion_move_speed
+void bbmxs_grp_set_tilt(BBMXSgroup* grp, float angle, float speed);
+void bbmxs_grp_set_pan(BBMXSgroup* grp, float angle, float speed);
+void bbmxs_dmx_write(uint8_t universe, uint16_t channel, uint8_t value);
+int bbmxs_flush();
 BBMXScontext* bbmxs_get_cur_ctx();
 
 #endif // __BBMXS_H
\ No newline at end of file
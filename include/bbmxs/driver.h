@@ -0,0 +1,30 @@
+#ifndef __BBMXS_DRIVER_H
+#define __BBMXS_DRIVER_H
+
+#include "bbmxs.h"
+#include "output.h"
+
+// An output driver puts finished frames on the wire.
+// open/close run on the main thread, send/flush on the output thread of
+// the port. Every port has its own driver state, drivers keep no globals.
+// `frame` holds universeCount * BBMXS_UNIVERSE_SIZE slots, one block per
+// universe in the order of port->universes.
+// With `keyframe` set every universe has to be sent in full.
+typedef struct
+{
+  const char* name;
+  void* (*open)(const BBMXSport* port, const char* target, const BBMXScontext* ctx);
+  void (*close)(void* state);
+  int (*send)(void* state, const uint8_t* frame, uint16_t universeCount, int keyframe, BBMXSoutputstats* stats);
+  void (*flush)(void* state);
+} BBMXSdriver;
+
+extern const BBMXSdriver bbmxs_serial_driver;
+extern const BBMXSdriver bbmxs_artnet_driver;
+extern const BBMXSdriver bbmxs_sacn_driver;
+
+// "artnet:<host>" and "sacn:<host>" pick the network drivers,
+// everything else is a serial port. `target` points behind the prefix.
+const BBMXSdriver* driver_for_port(const char* port, const char** target);
+
+#endif // __BBMXS_DRIVER_H
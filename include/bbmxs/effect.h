@@ -0,0 +1,54 @@
+#ifndef __BBMXS_EFFECT_H
+#define __BBMXS_EFFECT_H
+
+#include "bbmxs.h"
+
+// Parametric effects over a list of fixtures, evaluated in C every tick.
+// Every effect runs through cycles, either `rate` per second or one per
+// `beats` beats. The members are shifted against each other by `spread`
+// cycles from the first to the last one, so 1 spreads one whole cycle
+// over the list. Effects set the fixture color (or pan / tilt for fans),
+// envelopes are still layered on top of it. When several effects drive
+// the same fixture the one started last wins.
+
+#define EFFECT_MAX_PALETTE 8
+
+typedef enum
+{
+  EFFECT_CHASE, // one lit member running through the list
+  EFFECT_RAINBOW, // hue wheel, or a blend through the palette
+  EFFECT_SINE, // first palette color dimmed by a sine wave
+  EFFECT_STROBE, // palette colors on for `width` of every cycle
+  EFFECT_FAN // pan or tilt spread around `center`, opening and closing
+} BBMXSeffectkind;
+
+typedef struct
+{
+  BBMXSeffectkind kind;
+  float rate; // cycles per second, when beats is 0
+  float beats; // cycle length in beats, 0 = free running at rate
+  float spread; // phase difference between first and last member, in cycles
+  float offset; // phase offset, in cycles
+  float width; // lit part of a cycle for chase and strobe, 0 = default
+  BBMXScolor palette[EFFECT_MAX_PALETTE];
+  int paletteCount;
+  float center; // fan: angle in the middle
+  float size; // fan: degrees between the outermost members
+  BBMXSbool tilt; // fan: moves tilt instead of pan
+} BBMXSeffectopts;
+
+int effect_init(BBMXScontext* ctx);
+void effect_close();
+void effect_defaults(BBMXSeffectopts* opts, BBMXSeffectkind kind);
+// Returns the handle of the effect, 0 if it couldn't be started
+int effect_start(BBMXSfixture** fixtures, int count, const BBMXSeffectopts* opts);
+// Options of a running effect, changes take effect on the next update.
+// NULL for invalid handles.
+BBMXSeffectopts* effect_opts(int handle);
+void effect_stop(int handle);
+void effect_stop_all();
+// beat: position in beats, fractional, < 0 when there is no tempo
+void effect_update(float delta, double beat);
+int effect_count();
+
+#endif // __BBMXS_EFFECT_H
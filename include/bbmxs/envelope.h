@@ -0,0 +1,23 @@
+#ifndef __BBMXS_ENVELOPE_H
+#define __BBMXS_ENVELOPE_H
+
+#include "bbmxs.h"
+
+// Color envelopes layered on top of the fixture colors. Any number can run
+// at the same time, also several on one fixture; the highest value of each
+// channel wins (HTP). envelope_update evaluates all of them in one pass and
+// writes the result into the universe buffers.
+// The level rises from 0 to 1 over `attack` ms, stays at 1 for `hold` ms
+// and falls back to 0 over `decay` ms, scaling the peak color.
+
+int envelope_init(BBMXScontext* ctx);
+void envelope_close();
+// cycles: how often the envelope runs, 0 = until envelope_stop
+void envelope_start(BBMXSfixture* fx, BBMXScolor peak, float attack, float hold, float decay, int cycles);
+// Jumps to `color` and fades out at `speed` color units per ms
+void envelope_flash(BBMXSfixture* fx, BBMXScolor color, float speed);
+void envelope_stop(BBMXSfixture* fx);
+void envelope_update(float delta);
+int envelope_count();
+
+#endif // __BBMXS_ENVELOPE_H
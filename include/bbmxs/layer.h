@@ -0,0 +1,33 @@
+#ifndef __BBMXS_LAYER_H
+#define __BBMXS_LAYER_H
+
+#include "bbmxs.h"
+
+// The values a layer script sets, kept apart from the universes the main
+// script writes. Only the script's own thread writes into its layer, the
+// finished frames are handed to the tick thread through a triple buffer
+// like the output threads get theirs, so neither side ever waits.
+// bbmxs_flush merges the newest frame of every layer over the universes
+// in the order the layers were created: an HTP layer where it is higher,
+// an LTP layer wherever it set a channel.
+
+typedef struct BBMXSlayer BBMXSlayer;
+
+// Tick thread, before the script thread of the layer starts
+BBMXSlayer* layer_create(BBMXScontext* ctx, uint8_t mode);
+// Once all script threads are stopped, the universes go out on their own again
+void layer_destroy_all();
+// Merges into ctx->output, 1 when a channel changed
+int layer_merge(BBMXScontext* ctx);
+
+// Script thread
+void layer_fx_write(BBMXSlayer* layer, const BBMXSfixture* fx, DMXChannel channel, uint8_t value);
+void layer_fx_tilt(BBMXSlayer* layer, const BBMXSfixture* fx, float angle);
+void layer_fx_pan(BBMXSlayer* layer, const BBMXSfixture* fx, float angle);
+// Leaves the channels of the fixture to the layers below again
+void layer_fx_release(BBMXSlayer* layer, const BBMXSfixture* fx);
+void layer_clear(BBMXSlayer* layer);
+// Hands what was written so far to the tick thread
+void layer_publish(BBMXSlayer* layer);
+
+#endif // __BBMXS_LAYER_H
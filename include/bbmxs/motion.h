@@ -0,0 +1,42 @@
+#ifndef __BBMXS_MOTION_H
+#define __BBMXS_MOTION_H
+
+#include "bbmxs.h"
+
+// Pan / tilt moves planned as trajectories over time. motion_update
+// evaluates every moving axis once per tick and writes the angle (coarse and
+// fine channel) into the universe buffers. While a move runs, the motor speed
+// channel is set to about the speed of the move, so the fixture neither lags
+// behind nor jerks from one tick to the next.
+// Every fixture has one move per axis, a new one replaces the running one
+// and starts from wherever the axis is.
+
+#define MOTION_MAX_POINTS 32
+
+typedef enum
+{
+  MOTION_PAN,
+  MOTION_TILT
+} BBMXSaxis;
+
+typedef enum
+{
+  MOTION_LINEAR,
+  MOTION_EASE, // slow start and stop
+  MOTION_SPLINE // Catmull-Rom through the points of a path
+} BBMXScurve;
+
+int motion_init(BBMXScontext* ctx);
+void motion_close();
+// Moves to `target` degrees in `duration` ms, 0 = right away
+void motion_move(BBMXSfixture* fx, BBMXSaxis axis, float target, float duration, BBMXScurve curve);
+// Moves to `target` at `speed` (0-1) of the model's max_speed, 1 or more = right away
+void motion_move_speed(BBMXSfixture* fx, BBMXSaxis axis, float target, float speed);
+// Runs a spline from the current angle through `points` in `duration` ms,
+// with `loop` it goes back to where it started and runs again
+void motion_path(BBMXSfixture* fx, BBMXSaxis axis, const float* points, int count, float duration, BBMXSbool loop);
+void motion_stop(BBMXSfixture* fx);
+void motion_update(float delta);
+int motion_count();
+
+#endif // __BBMXS_MOTION_H
@@ -0,0 +1,25 @@
+#ifndef __BBMXS_NAMES_H
+#define __BBMXS_NAMES_H
+
+#include <stdint.h>
+
+// Hash index from names to positions in an array, e.g. ctx->fixtures.
+// Open addressing with linear probing, kept at most half full.
+// The names are not copied, they have to live as long as the index.
+typedef struct
+{
+  const char** keys;
+  uint32_t* hashes;
+  int* values;
+  int capacity; // power of two
+  int count;
+} BBMXSnames;
+
+void names_init(BBMXSnames* names);
+void names_free(BBMXSnames* names);
+// Returns 0 when `key` is already in the index
+int names_put(BBMXSnames* names, const char* key, int value);
+// -1 when `key` isn't in the index
+int names_get(const BBMXSnames* names, const char* key);
+
+#endif // __BBMXS_NAMES_H
@@ -0,0 +1,21 @@
+#ifndef __BBMXS_OUTPUT_H
+#define __BBMXS_OUTPUT_H
+
+#include "bbmxs.h"
+
+typedef struct
+{
+  unsigned long frames;
+  unsigned long keyframes;
+  unsigned long long bytesSent;
+  unsigned long long bytesSaved; // compared to sending full frames
+  unsigned long bytesSavedPerSec; // over the last full second
+} BBMXSoutputstats;
+
+int output_start(BBMXScontext* ctx);
+void output_stop();
+void output_submit(const BBMXScontext* ctx);
+int output_ok();
+BBMXSoutputstats output_stats();
+
+#endif // __BBMXS_OUTPUT_H
@@ -0,0 +1,45 @@
+#ifndef __BBMXS_PROTO_H
+#define __BBMXS_PROTO_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+// v2 wire format (both directions):
+// COBS([seq, cmd, payload..., crc16 hi, crc16 lo]) followed by a 0x00
+// delimiter. The CRC (CCITT, init 0xFFFF) covers seq, cmd and the payload.
+// The controller answers with ACK packets carrying the last sequence
+// number it received in order (cumulative ack) and drops everything else.
+#define PROTO_DELIMITER 0x00
+#define PROTO_HEADER_SIZE 2
+#define PROTO_TRAILER_SIZE 2
+#define PROTO_MAX_PAYLOAD 1024
+#define PROTO_MAX_RAW (PROTO_HEADER_SIZE + PROTO_MAX_PAYLOAD + PROTO_TRAILER_SIZE)
+// COBS adds one byte per 254 plus one, then the delimiter
+#define PROTO_MAX_PACKET (PROTO_MAX_RAW + PROTO_MAX_RAW / 254 + 2)
+
+#define PROTO_CMD_SYNC 0x7F // (re)starts the sequence at the packets seq
+#define PROTO_CMD_ACK 0x80
+
+typedef struct
+{
+  uint8_t seq;
+  uint8_t cmd;
+  uint16_t len;
+  uint8_t payload[PROTO_MAX_PAYLOAD];
+} BBMXSpacket;
+
+typedef struct
+{
+  uint8_t buf[PROTO_MAX_PACKET];
+  size_t len;
+  int overflow;
+} BBMXSprotoparser;
+
+uint16_t proto_crc16(const uint8_t* data, size_t len);
+size_t proto_cobs_encode(const uint8_t* data, size_t len, uint8_t* out);
+size_t proto_cobs_decode(const uint8_t* data, size_t len, uint8_t* out);
+size_t proto_encode(uint8_t seq, uint8_t cmd, const void* data, size_t size, uint8_t* out);
+void proto_parser_reset(BBMXSprotoparser* p);
+int proto_parse_byte(BBMXSprotoparser* p, uint8_t byte, BBMXSpacket* out);
+
+#endif // __BBMXS_PROTO_H
@@ -2,10 +2,19 @@
 #define __BBMXS_SERIAL_H
 
 #include <ctype.h>
+#include <stddef.h>
+#include <stdint.h>
 
-int serial_open(const char* port);
-void serial_close();
-int serial_write(char* buf, size_t len);
-int serial_read(char* buf, size_t len);
+#define SERIAL_DEFAULT_BAUD 115200
+
+// One open COM port. Every output port has its own, so several
+// controllers can be driven from different threads at the same time.
+typedef struct BBMXSserial BBMXSserial;
+
+BBMXSserial* serial_open(const char* port, int baud);
+void serial_close(BBMXSserial* serial);
+int serial_write(BBMXSserial* serial, const uint8_t* buf, size_t len);
+// Returns as soon as any data is available or after timeoutMs (0 = don't wait)
+int serial_read(BBMXSserial* serial, uint8_t* buf, size_t len, int timeoutMs);
 
 #endif // __BBMXS_SERIAL_H
\ No newline at end of file
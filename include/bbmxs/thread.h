@@ -0,0 +1,29 @@
+#ifndef __BBMXS_THREAD_H
+#define __BBMXS_THREAD_H
+
+typedef void* BBMXSthread;
+typedef void* BBMXSevent;
+typedef void* BBMXSmutex;
+typedef int (*BBMXSthreadfunc)(void* arg);
+
+BBMXSthread thread_create(BBMXSthreadfunc func, void* arg);
+void thread_join(BBMXSthread thread);
+
+// Auto-reset event, wakes up one waiter
+BBMXSevent thread_event_create();
+void thread_event_destroy(BBMXSevent ev);
+void thread_event_signal(BBMXSevent ev);
+int thread_event_wait(BBMXSevent ev, int timeoutMs);
+
+BBMXSmutex thread_mutex_create();
+void thread_mutex_destroy(BBMXSmutex mutex);
+void thread_mutex_lock(BBMXSmutex mutex);
+void thread_mutex_unlock(BBMXSmutex mutex);
+
+long thread_atomic_xchg(volatile long* ptr, long value);
+long thread_atomic_load(volatile long* ptr);
+void thread_atomic_store(volatile long* ptr, long value);
+
+unsigned long thread_ticks_ms();
+
+#endif // __BBMXS_THREAD_H
@@ -0,0 +1,36 @@
+#ifndef __BBMXS_TRANSPORT_H
+#define __BBMXS_TRANSPORT_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include "serial.h"
+
+// Pipelined sender for the v2 protocol (see proto.h). Keeps up to
+// `window` packets in flight and goes back to the oldest unacked packet
+// when no ack arrived within `timeoutMs`.
+// A transport is only used by the output thread of its port.
+#define TRANSPORT_DEFAULT_WINDOW 8
+#define TRANSPORT_DEFAULT_TIMEOUT 100 // ms
+#define TRANSPORT_MAX_RETRIES 10
+
+// Called for every packet the controller acknowledged, oldest first
+typedef void (*BBMXStransportack)(void* user, uint8_t cmd, const uint8_t* payload, size_t size);
+
+typedef struct BBMXStransport BBMXStransport;
+
+typedef struct
+{
+  unsigned long packetsSent;
+  unsigned long packetsAcked;
+  unsigned long retransmits;
+  unsigned long crcErrors;
+  unsigned long failures;
+} BBMXStransportstats;
+
+BBMXStransport* transport_open(BBMXSserial* serial, int window, int timeoutMs, BBMXStransportack onAck, void* user);
+void transport_close(BBMXStransport* transport);
+int transport_send(BBMXStransport* transport, uint8_t cmd, const void* data, size_t size);
+int transport_drain(BBMXStransport* transport);
+BBMXStransportstats transport_stats(BBMXStransport* transport);
+
+#endif // __BBMXS_TRANSPORT_H
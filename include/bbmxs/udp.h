@@ -0,0 +1,29 @@
+#ifndef __BBMXS_UDP_H
+#define __BBMXS_UDP_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+typedef struct BBMXSudp BBMXSudp;
+
+typedef struct
+{
+  uint8_t data[16]; // sockaddr_in
+} BBMXSudpaddr;
+
+typedef struct
+{
+  const uint8_t* data;
+  size_t len;
+  const BBMXSudpaddr* addr;
+} BBMXSudppacket;
+
+BBMXSudp* udp_open();
+void udp_close(BBMXSudp* udp);
+// Needs a socket to be open, on Win32 udp_open starts Winsock
+int udp_resolve(const char* host, uint16_t port, BBMXSudpaddr* out);
+void udp_addr_ipv4(uint32_t ip, uint16_t port, BBMXSudpaddr* out);
+// Sends all packets with as few syscalls as possible, returns how many went out
+int udp_send_batch(BBMXSudp* udp, const BBMXSudppacket* packets, int count);
+
+#endif // __BBMXS_UDP_H
@@ -1,8 +1,13 @@
 #ifndef __BBMX_CONFIG_H
 #define __BBMX_CONFIG_H
 
+// The platform is normally picked by CMake (-DBBMX_PLATFORM=WIN32|LINUX)
+#if !defined(BBMX_WIN32) && !defined(BBMX_LINUX) && !defined(BBMX_MACOS)
+#ifdef _WIN32
 #define BBMX_WIN32
-//#define BBMX_LINUX
-//#define BBMX_MACOS
+#else
+#define BBMX_LINUX
+#endif
+#endif
 
-#endif // __BBMX_CONFIG_H
\ No newline at end of file
+#endif // __BBMX_CONFIG_H
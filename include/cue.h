@@ -0,0 +1,36 @@
+#ifndef __CUE_H
+#define __CUE_H
+
+#include <lua/lua.h>
+
+// Cues are Lua functions running as coroutines. When a cue waits it is
+// parked in a min-heap by the time (or beat) it's due, cue_update only looks
+// at the top of the heaps and resumes what is due. A sleeping cue costs
+// nothing per tick, no matter how many there are.
+// Times are ms on the `time` clock, beats count like in BBMX_beat.
+
+typedef enum
+{
+  CUE_TIME,
+  CUE_BEAT
+} BBMXcueclock;
+
+// Starts the function below `nargs` arguments on top of L and runs it until
+// it waits or ends. Returns the handle, 0 with the error on top of L.
+lua_Integer cue_start(lua_State* L, int nargs);
+// Handles of cues that are over are ignored
+void cue_stop(lua_State* L, lua_Integer handle);
+// Parks the running cue until `at` on `clock`, call as `return cue_wait(...)`
+int cue_wait(lua_State* L, BBMXcueclock clock, double at);
+// Whether L is the cue that is running right now
+int cue_running(lua_State* L);
+double cue_now();
+// -1 without beats
+double cue_beat();
+// Resumes the due cues, 0 when one of them fails
+int cue_update(lua_State* L, double now, double beat);
+int cue_count();
+// Stops all cues of L, e.g. before it is closed
+void cue_close(lua_State* L);
+
+#endif // __CUE_H
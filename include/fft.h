@@ -0,0 +1,19 @@
+#ifndef __FFT_H
+#define __FFT_H
+
+// Radix-2 complex FFT with precomputed twiddles and Hann window,
+// the size has to be a power of two
+typedef struct
+{
+  int size;
+  float* cosTable;
+  float* sinTable;
+  float* window;
+} BBMXfft;
+
+int fft_init(BBMXfft* fft, int size);
+void fft_close(BBMXfft* fft);
+// Windows `samples` into re and transforms re / im in place
+void fft_run(const BBMXfft* fft, const float* samples, float* re, float* im);
+
+#endif // __FFT_H
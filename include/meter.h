@@ -0,0 +1,28 @@
+#ifndef __METER_H
+#define __METER_H
+
+// Audio features of what is playing right now. A worker thread takes the
+// latest samples from the audio tap about every METER_INTERVAL ms and
+// publishes the results through a triple buffer, so reading them in the
+// tick loop never waits and never sees a half written result.
+#define METER_MIN_BANDS 8
+#define METER_MAX_BANDS 32
+#define METER_FFT_SIZE 2048
+#define METER_INTERVAL 10 // ms
+#define METER_PEAK_RELEASE 250.0f // ms for the peak envelope to fall to ~37%
+
+typedef struct
+{
+  float rms; // 0-1, linear
+  float peak; // 0-1, jumps up to every peak and falls back slowly
+  float bands[METER_MAX_BANDS]; // 0-1, -60 dB to 0 dB, log spaced from 40 Hz to 16 kHz
+  int bandCount;
+  double position; // ms of the track these were taken at
+} BBMXmeter;
+
+int meter_start(int bands);
+void meter_stop();
+// Newest results, valid until the next call
+const BBMXmeter* meter_get();
+
+#endif // __METER_H
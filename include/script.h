@@ -0,0 +1,16 @@
+#ifndef __SCRIPT_H
+#define __SCRIPT_H
+
+#include <lua/lua.h>
+
+// Scripts are compiled once, the bytecode is kept next to them as `<path>c`
+// (show.lua -> show.luac). It is loaded instead of the script as long as the
+// script has the same modification time and size or, failing that, the same
+// content hash. Otherwise the script is compiled again and the cache rewritten.
+
+// Pushes the compiled script like luaL_loadfile, returns the LUA_* status
+int script_load(lua_State* L, const char* path);
+// Compiles the script into the cache without running it
+int script_compile(const char* path);
+
+#endif // __SCRIPT_H
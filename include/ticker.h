@@ -0,0 +1,34 @@
+#ifndef __TICKER_H
+#define __TICKER_H
+
+// Fixed rate scheduler for the main loop. Deadlines are absolute on a
+// monotonic clock, so sleeping late never shifts the following ticks and
+// periods don't have to be whole milliseconds (e.g. 1000 / 144).
+// After an overrun the missed ticks run back to back until the loop is in
+// phase again. More than TICKER_MAX_CATCHUP missed ticks are dropped instead.
+#define TICKER_MAX_CATCHUP 4
+
+typedef struct
+{
+  double period; // ms
+  double next; // deadline of the next tick, ms
+  double last; // time of the previous tick, ms
+  void* timer; // platform timer, if any
+  unsigned long ticks;
+  unsigned long late; // ticks that started after their deadline had passed
+  unsigned long dropped;
+  double maxJitter; // ms the worst on-time tick started after its deadline
+} BBMXticker;
+
+int ticker_init(BBMXticker* ticker, double ups);
+void ticker_close(BBMXticker* ticker);
+// Sleeps until the next deadline and returns the ms since the previous tick
+double ticker_wait(BBMXticker* ticker);
+
+// Platform part (ticker_win32.c / ticker_posix.c)
+double ticker_now_ms();
+void* ticker_timer_create();
+void ticker_timer_destroy(void* timer);
+void ticker_sleep_until(void* timer, double deadline);
+
+#endif // __TICKER_H
@@ -0,0 +1,15 @@
+#ifndef __WATCH_H
+#define __WATCH_H
+
+// Change notifications for one file (inotify / Win32 change notifications).
+// The directory is watched rather than the file itself, since most editors
+// save by writing a new file and renaming it over the old one.
+typedef struct BBMXwatch BBMXwatch;
+
+// NULL when the platform can't watch the file
+BBMXwatch* watch_start(const char* path);
+void watch_stop(BBMXwatch* watch);
+// Never blocks, 1 when the file was written since the last call
+int watch_changed(BBMXwatch* watch);
+
+#endif // __WATCH_H
@@ -0,0 +1,16 @@
+#ifndef __WORKER_H
+#define __WORKER_H
+
+#include "bbmxs/bbmxs.h"
+
+// Runs the layer scripts of the context, each in its own lua_State on its
+// own thread with its own ticker. A script calls BBMX_start once and then
+// BBMX_loop every update, and hands its layer over after every call.
+// `time` in a layer script goes on from `time` (ms) of the main script.
+int worker_start(BBMXScontext* ctx, double time);
+// Stops all of them and their layers, the main script is on its own again
+void worker_stop();
+// 0 once a layer script failed
+int worker_ok();
+
+#endif // __WORKER_H
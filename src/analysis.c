@@ -0,0 +1,467 @@
+#include <stb/stb_vorbis.h>
+#undef L
+#include "analysis.h"
+#include "fft.h"
+#include "bbmxs/thread.h"
+#include "globals.h"
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define ANALYSIS_VERSION 1 // bump when the results change, invalidates all caches
+#define FFT_SIZE 1024
+#define HOP 512
+#define LOW_BAND_HZ 150.0 // kick drum range, the bars are found in there
+#define MIN_BPM 60.0
+#define MAX_BPM 200.0
+#define DEFAULT_BPM 120.0
+#define TIGHTNESS 100.0 // how strongly the tracker sticks to the tempo
+#define MEAN_WINDOW 16 // frames on each side of the adaptive threshold
+
+typedef struct
+{
+  float* flux; // spectral flux per frame
+  float* low; // flux of the low band only
+  size_t count;
+  size_t capacity;
+  unsigned int sampleRate;
+} Onsets;
+
+static int hash_file(const char* path, unsigned long long* hash)
+{
+  FILE* f = fopen(path, "rb");
+  if (!f) return 0;
+
+  // FNV-1a, 64 bit
+  unsigned long long h = 0xcbf29ce484222325ULL;
+  unsigned char* buf = malloc(65536);
+  size_t n;
+  while ((n = fread(buf, 1, 65536, f)) > 0)
+  {
+    for (size_t i = 0; i < n; i++)
+    {
+      h ^= buf[i];
+      h *= 0x100000001b3ULL;
+    }
+  }
+
+  free(buf);
+  fclose(f);
+  *hash = h;
+  return 1;
+}
+
+static char* cache_path(const char* path)
+{
+  size_t len = strlen(path);
+  char* cache = malloc(len + 7);
+  memcpy(cache, path, len);
+  memcpy(cache + len, ".beats", 7);
+  return cache;
+}
+
+static int read_cache(const char* cache, unsigned long long hash, double bpmHint, BBMXbeatgrid* grid)
+{
+  FILE* f = fopen(cache, "r");
+  if (!f) return 0;
+
+  int version;
+  unsigned long long cachedHash;
+  double cachedHint;
+  unsigned long count;
+  if (fscanf(f, "bbmx-beats %d hash %llx hint %lf bpm %lf count %lu", &version, &cachedHash, &cachedHint, &grid->bpm, &count) != 5
+    || version != ANALYSIS_VERSION || cachedHash != hash || fabs(cachedHint - bpmHint) > 0.001)
+  {
+    fclose(f);
+    return 0;
+  }
+
+  grid->beats = malloc(sizeof(double) * (count > 0 ? count : 1));
+  grid->downbeats = malloc(count > 0 ? count : 1);
+  grid->beatCount = count;
+  for (unsigned long i = 0; i < count; i++)
+  {
+    int downbeat;
+    if (fscanf(f, "%lf %d", &grid->beats[i], &downbeat) != 2)
+    {
+      fclose(f);
+      analysis_free(grid);
+      return 0;
+    }
+    grid->downbeats[i] = downbeat != 0;
+  }
+
+  fclose(f);
+  return 1;
+}
+
+static void write_cache(const char* cache, unsigned long long hash, double bpmHint, const BBMXbeatgrid* grid)
+{
+  FILE* f = fopen(cache, "w");
+  if (!f)
+  {
+    printf("bbmx Warning: Failed to write beat cache: \"%s\"\n", cache);
+    return;
+  }
+
+  fprintf(f, "bbmx-beats %d\nhash %016llx\nhint %.3f\nbpm %.3f\ncount %lu\n",
+    ANALYSIS_VERSION, hash, bpmHint, grid->bpm, (unsigned long)grid->beatCount);
+  for (size_t i = 0; i < grid->beatCount; i++)
+  {
+    fprintf(f, "%.3f %d\n", grid->beats[i], grid->downbeats[i]);
+  }
+
+  fclose(f);
+}
+
+static void onsets_push(Onsets* o, float flux, float low)
+{
+  if (o->count == o->capacity)
+  {
+    o->capacity = o->capacity > 0 ? o->capacity * 2 : 4096;
+    o->flux = realloc(o->flux, sizeof(float) * o->capacity);
+    o->low = realloc(o->low, sizeof(float) * o->capacity);
+  }
+  o->flux[o->count] = flux;
+  o->low[o->count] = low;
+  o->count++;
+}
+
+// Decodes the file block by block (nothing but one window is kept around)
+// and sums up how much the log magnitude of every bin rose since the
+// previous window. Frame k is the window ending at sample (k + 1) * HOP.
+static int compute_onsets(const char* path, Onsets* o)
+{
+  FILE* f = fopen(path, "rb");
+  if (!f)
+  {
+    printf("bbmx Error: Failed to open file: \"%s\"\n", path);
+    return 0;
+  }
+
+  int err = VORBIS__no_error;
+  stb_vorbis* v = stb_vorbis_open_file(f, 1, &err, NULL);
+  if (v == NULL || err != VORBIS__no_error)
+  {
+    printf("bbmx Error: Failed to open vorbis file: \"%s\", Error Code: \"%d\"\n", path, err);
+    if (v == NULL) fclose(f);
+    return 0;
+  }
+
+  stb_vorbis_info info = stb_vorbis_get_info(v);
+  int channels = info.channels;
+  o->sampleRate = info.sample_rate;
+
+  BBMXfft fft;
+  fft_init(&fft, FFT_SIZE);
+
+  float frame[FFT_SIZE];
+  float re[FFT_SIZE];
+  float im[FFT_SIZE];
+  float prev[FFT_SIZE / 2 + 1];
+  memset(frame, 0, sizeof(frame));
+  memset(prev, 0, sizeof(prev));
+
+  int lowBins = (int)(LOW_BAND_HZ * FFT_SIZE / o->sampleRate);
+  if (lowBins < 1) lowBins = 1;
+
+  float* block = malloc(sizeof(float) * HOP * channels);
+  int n;
+  while ((n = stb_vorbis_get_samples_float_interleaved(v, channels, block, HOP * channels)) > 0)
+  {
+    memmove(frame, frame + HOP, sizeof(float) * (FFT_SIZE - HOP));
+    for (int i = 0; i < HOP; i++)
+    {
+      float s = 0;
+      if (i < n)
+      {
+        for (int c = 0; c < channels; c++) s += block[i * channels + c];
+        s /= channels;
+      }
+      frame[FFT_SIZE - HOP + i] = s;
+    }
+
+    fft_run(&fft, frame, re, im);
+
+    float flux = 0;
+    float low = 0;
+    for (int k = 1; k <= FFT_SIZE / 2; k++)
+    {
+      float m = logf(1.0f + 1000.0f * sqrtf(re[k] * re[k] + im[k] * im[k]));
+      float rise = m - prev[k];
+      prev[k] = m;
+      if (rise <= 0) continue;
+
+      flux += rise;
+      if (k <= lowBins) low += rise;
+    }
+
+    // Until the window is full, filling it up is all that rises
+    if (o->count < FFT_SIZE / HOP)
+    {
+      flux = 0;
+      low = 0;
+    }
+    onsets_push(o, flux, low);
+  }
+
+  free(block);
+  fft_close(&fft);
+  stb_vorbis_close(v);
+  return o->count > 0;
+}
+
+// Only keeps what sticks out of the local average and scales the result
+// to unit deviation, so TIGHTNESS means the same for quiet and loud tracks
+static void normalize(Onsets* o)
+{
+  float* out = malloc(sizeof(float) * o->count);
+  double sum = 0;
+  for (size_t t = 0; t < o->count; t++)
+  {
+    size_t from = t > MEAN_WINDOW ? t - MEAN_WINDOW : 0;
+    size_t to = t + MEAN_WINDOW < o->count ? t + MEAN_WINDOW : o->count - 1;
+    double mean = 0;
+    for (size_t i = from; i <= to; i++) mean += o->flux[i];
+    mean /= (double)(to - from + 1);
+
+    out[t] = o->flux[t] > mean ? (float)(o->flux[t] - mean) : 0.0f;
+    sum += (double)out[t] * out[t];
+  }
+
+  double dev = sqrt(sum / o->count);
+  for (size_t t = 0; t < o->count; t++)
+  {
+    o->flux[t] = dev > 0 ? (float)(out[t] / dev) : 0.0f;
+  }
+  free(out);
+}
+
+// Beat period in frames: the autocorrelation lag with the best score,
+// weighted towards the hinted tempo (or 120 BPM) on a log scale
+static double estimate_period(const Onsets* o, double frameRate, double bpmHint)
+{
+  int minLag = (int)ceil(frameRate * 60.0 / MAX_BPM);
+  int maxLag = (int)floor(frameRate * 60.0 / MIN_BPM);
+  double center = frameRate * 60.0 / (bpmHint > 0 ? bpmHint : DEFAULT_BPM);
+  double spread = bpmHint > 0 ? 0.2 : 1.0; // octaves
+
+  int lags = maxLag - minLag + 1;
+  if (lags < 3 || (size_t)maxLag >= o->count) return center;
+
+  double* score = malloc(sizeof(double) * lags);
+  int best = 0;
+  for (int l = 0; l < lags; l++)
+  {
+    int lag = minLag + l;
+    double ac = 0;
+    for (size_t t = lag; t < o->count; t++) ac += (double)o->flux[t] * o->flux[t - lag];
+    ac /= (double)(o->count - lag);
+
+    double octaves = log2(lag / center) / spread;
+    score[l] = ac * exp(-0.5 * octaves * octaves);
+    if (score[l] > score[best]) best = l;
+  }
+
+  double period = minLag + best;
+  if (best > 0 && best < lags - 1)
+  {
+    double a = score[best - 1];
+    double b = score[best];
+    double c = score[best + 1];
+    double d = a - 2 * b + c;
+    if (d < 0) period += 0.5 * (a - c) / d;
+  }
+
+  free(score);
+  return period;
+}
+
+// Dynamic programming beat tracker: every frame gets the best score of a
+// chain of beats ending there, a beat is worth its onset strength minus a
+// penalty for spacing it unlike the period. The best chain near the end of
+// the track is followed back to the start.
+static size_t track_beats(const Onsets* o, double period, size_t** beatsOut)
+{
+  double* score = malloc(sizeof(double) * o->count);
+  long* back = malloc(sizeof(long) * o->count);
+  long lo = (long)round(period / 2);
+  long hi = (long)round(period * 2);
+  if (lo < 1) lo = 1;
+
+  for (long t = 0; t < (long)o->count; t++)
+  {
+    double best = 0;
+    long bestPrev = -1;
+    for (long prev = t - hi; prev <= t - lo; prev++)
+    {
+      if (prev < 0) continue;
+
+      double spacing = log((t - prev) / period);
+      double s = score[prev] - TIGHTNESS * spacing * spacing;
+      if (bestPrev < 0 || s > best)
+      {
+        best = s;
+        bestPrev = prev;
+      }
+    }
+
+    // A chain that only costs is worse than starting a new one here
+    if (bestPrev >= 0 && best > 0)
+    {
+      score[t] = o->flux[t] + best;
+      back[t] = bestPrev;
+    }
+    else
+    {
+      score[t] = o->flux[t];
+      back[t] = -1;
+    }
+  }
+
+  long end = (long)o->count - 1;
+  long from = end - (long)round(period);
+  if (from < 0) from = 0;
+  for (long t = from; t < (long)o->count; t++)
+  {
+    if (score[t] > score[end]) end = t;
+  }
+
+  size_t count = 0;
+  double strength = 0;
+  for (long t = end; t >= 0; t = back[t])
+  {
+    strength += o->flux[t];
+    count++;
+  }
+
+  size_t* beats = malloc(sizeof(size_t) * (count > 0 ? count : 1));
+  size_t i = count;
+  for (long t = end; t >= 0; t = back[t]) beats[--i] = t;
+
+  // The chain runs on through silence at the start and the end of the
+  // track, drop the beats there that have next to no onset
+  size_t first = 0;
+  double weak = count > 0 ? 0.5 * strength / count : 0;
+  while (first < count && o->flux[beats[first]] < weak) first++;
+  while (count > first && o->flux[beats[count - 1]] < weak) count--;
+  count -= first;
+  memmove(beats, beats + first, sizeof(size_t) * count);
+
+  free(score);
+  free(back);
+  *beatsOut = beats;
+  return count;
+}
+
+static int analyze(const char* path, double bpmHint, BBMXbeatgrid* grid)
+{
+  Onsets o;
+  memset(&o, 0, sizeof(o));
+  if (!compute_onsets(path, &o))
+  {
+    free(o.flux);
+    free(o.low);
+    return 0;
+  }
+
+  double frameRate = (double)o.sampleRate / HOP;
+  normalize(&o);
+  double period = estimate_period(&o, frameRate, bpmHint);
+
+  size_t* frames;
+  size_t count = track_beats(&o, period, &frames);
+
+  grid->beats = malloc(sizeof(double) * (count > 0 ? count : 1));
+  grid->downbeats = calloc(count > 0 ? count : 1, 1);
+  grid->beatCount = count;
+
+  // Sub frame position from a parabola through the onset peak, the time
+  // of a frame is the center of its window
+  for (size_t i = 0; i < count; i++)
+  {
+    size_t t = frames[i];
+    double offset = 0;
+    if (t > 0 && t + 1 < o.count)
+    {
+      double a = o.flux[t - 1];
+      double b = o.flux[t];
+      double c = o.flux[t + 1];
+      double d = a - 2 * b + c;
+      if (d < 0) offset = 0.5 * (a - c) / d;
+      if (offset > 0.5) offset = 0.5;
+      if (offset < -0.5) offset = -0.5;
+    }
+
+    double sample = (t + 1 + offset) * HOP - FFT_SIZE / 2;
+    grid->beats[i] = sample > 0 ? sample * 1000.0 / o.sampleRate : 0;
+  }
+
+  // Bars start where the kick drum is the strongest
+  double barScore[ANALYSIS_BEATS_PER_BAR] = { 0 };
+  for (size_t i = 0; i < count; i++)
+  {
+    barScore[i % ANALYSIS_BEATS_PER_BAR] += o.low[frames[i]];
+  }
+  int phase = 0;
+  for (int p = 1; p < ANALYSIS_BEATS_PER_BAR; p++)
+  {
+    if (barScore[p] > barScore[phase]) phase = p;
+  }
+  for (size_t i = phase; i < count; i += ANALYSIS_BEATS_PER_BAR)
+  {
+    grid->downbeats[i] = 1;
+  }
+
+  grid->bpm = count > 1 ? 60000.0 * (count - 1) / (grid->beats[count - 1] - grid->beats[0]) : 0;
+
+  free(frames);
+  free(o.flux);
+  free(o.low);
+  return 1;
+}
+
+int analysis_load(const char* path, double bpmHint, BBMXbeatgrid* grid)
+{
+  memset(grid, 0, sizeof(BBMXbeatgrid));
+
+  unsigned long long hash;
+  if (!hash_file(path, &hash))
+  {
+    printf("bbmx Error: Failed to open file: \"%s\"\n", path);
+    return 0;
+  }
+
+  char* cache = cache_path(path);
+  if (read_cache(cache, hash, bpmHint, grid))
+  {
+    if (gDebugMode) printf("[DEBUG]: Beats: %lu from \"%s\" | %.2f BPM\n", (unsigned long)grid->beatCount, cache, grid->bpm);
+    free(cache);
+    return 1;
+  }
+
+  if (gDebugMode) printf("[DEBUG]: Beats: Analyzing \"%s\"\n", path);
+  unsigned long start = thread_ticks_ms();
+  if (!analyze(path, bpmHint, grid))
+  {
+    free(cache);
+    analysis_free(grid);
+    return 0;
+  }
+  if (gDebugMode)
+  {
+    printf("[DEBUG]: Beats: %lu | %.2f BPM | %lu ms\n", (unsigned long)grid->beatCount, grid->bpm, thread_ticks_ms() - start);
+  }
+
+  write_cache(cache, hash, bpmHint, grid);
+  free(cache);
+  return 1;
+}
+
+void analysis_free(BBMXbeatgrid* grid)
+{
+  free(grid->beats);
+  free(grid->downbeats);
+  memset(grid, 0, sizeof(BBMXbeatgrid));
+}
@@ -0,0 +1,418 @@
+#include <stb/stb_vorbis.h>
+#undef L
+#include "audio.h"
+#include "bbmxs/thread.h"
+#include "globals.h"
+#include <AL/al.h>
+#include <AL/alc.h>
+#include <AL/alext.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+static ALCdevice* __device = NULL;
+static ALCcontext* __context = NULL;
+static ALuint __source;
+static ALuint __buffers[AUDIO_STREAM_BUFFERS];
+static int __buffer_count = 0;
+static ALenum __format;
+static int __channels;
+static unsigned int __sample_rate;
+static LPALGETSOURCEDVSOFT __get_source_dv = NULL; // AL_SOFT_source_latency
+static double __latency = 0; // ms, as of the last position query
+
+// Buffers queued on the source, oldest first, and how many frames each holds
+static ALuint __queue[AUDIO_STREAM_BUFFERS];
+static int __queue_frames[AUDIO_STREAM_BUFFERS];
+static int __queue_head = 0;
+static int __queue_len = 0;
+// Frames of all buffers that have been played and unqueued again
+static unsigned long long __played = 0;
+static int __eof = 0;
+static unsigned long __underruns = 0;
+
+// Mono mix of the most recently decoded frames, by absolute frame number,
+// so other threads can look at what is being played right now
+static float* __tap = NULL;
+static size_t __tap_size = 0;
+static unsigned long long __decoded = 0;
+
+static stb_vorbis* __vorbis = NULL;
+static short* __pcm = NULL;
+static BBMXSthread __worker = NULL;
+static BBMXSevent __wake = NULL;
+static BBMXSmutex __lock = NULL;
+static volatile long __running = 0;
+
+static void queue_push(ALuint buffer, int frames)
+{
+  int i = (__queue_head + __queue_len) % AUDIO_STREAM_BUFFERS;
+  __queue[i] = buffer;
+  __queue_frames[i] = frames;
+  __queue_len++;
+}
+
+static ALuint queue_pop()
+{
+  ALuint buffer = __queue[__queue_head];
+  __played += __queue_frames[__queue_head];
+  __queue_head = (__queue_head + 1) % AUDIO_STREAM_BUFFERS;
+  __queue_len--;
+  return buffer;
+}
+
+static void tap_write(const short* pcm, int frames)
+{
+  for (int i = 0; i < frames; i++)
+  {
+    int sum = 0;
+    for (int c = 0; c < __channels; c++) sum += pcm[i * __channels + c];
+    __tap[(__decoded + i) % __tap_size] = sum / (32768.0f * __channels);
+  }
+  __decoded += frames;
+}
+
+// Frames played since the start of the track, with the lock held
+static unsigned long long position_frames()
+{
+  ALint state;
+  ALint offset = 0;
+  alGetSourcei(__source, AL_SOURCE_STATE, &state);
+  alGetSourcei(__source, AL_SAMPLE_OFFSET, &offset);
+
+  // A stopped source reports 0, but everything still queued has been played
+  if (state == AL_STOPPED)
+  {
+    unsigned long long frames = __played;
+    for (int i = 0; i < __queue_len; i++)
+    {
+      frames += __queue_frames[(__queue_head + i) % AUDIO_STREAM_BUFFERS];
+    }
+    return frames;
+  }
+
+  return __played + offset;
+}
+
+// Decodes the next part of the file for every buffer that is or will be
+// free, then swaps the played buffers for the new ones. Decoding runs
+// without holding the lock. Unqueuing, queuing and restarting the source
+// happen in one go under it, so the position never sees a half done swap and
+// a source that ran dry is never restarted with buffers it already played.
+static void refill()
+{
+  thread_mutex_lock(__lock);
+  ALint processed = 0;
+  alGetSourcei(__source, AL_BUFFERS_PROCESSED, &processed);
+  thread_mutex_unlock(__lock);
+
+  int chunks = __buffer_count - __queue_len + processed;
+  int chunkFrames[AUDIO_STREAM_BUFFERS];
+  int decoded = 0;
+  while (decoded < chunks && !__eof)
+  {
+    short* pcm = &__pcm[(size_t)decoded * AUDIO_STREAM_FRAMES * __channels];
+    int frames = stb_vorbis_get_samples_short_interleaved(__vorbis, __channels, pcm, AUDIO_STREAM_FRAMES * __channels);
+    if (frames <= 0) break;
+    chunkFrames[decoded++] = frames;
+  }
+
+  thread_mutex_lock(__lock);
+  alGetSourcei(__source, AL_BUFFERS_PROCESSED, &processed);
+  while (processed-- > 0 && __queue_len > 0)
+  {
+    ALuint buffer = queue_pop();
+    alSourceUnqueueBuffers(__source, 1, &buffer);
+  }
+
+  int next = 0;
+  for (int b = 0; b < __buffer_count && next < decoded; b++)
+  {
+    int queued = 0;
+    for (int i = 0; i < __queue_len; i++)
+    {
+      if (__queue[(__queue_head + i) % AUDIO_STREAM_BUFFERS] == __buffers[b]) queued = 1;
+    }
+    if (queued) continue;
+
+    short* pcm = &__pcm[(size_t)next * AUDIO_STREAM_FRAMES * __channels];
+    alBufferData(__buffers[b], __format, pcm, chunkFrames[next] * __channels * sizeof(short), __sample_rate);
+    alSourceQueueBuffers(__source, 1, &__buffers[b]);
+    queue_push(__buffers[b], chunkFrames[next]);
+    tap_write(pcm, chunkFrames[next]);
+    next++;
+  }
+  if (decoded < chunks) __eof = 1;
+
+  // The source stops by itself when it runs dry, start it again
+  ALint state;
+  alGetSourcei(__source, AL_SOURCE_STATE, &state);
+  if (state != AL_PLAYING && __queue_len > 0)
+  {
+    if (state != AL_INITIAL)
+    {
+      __underruns++;
+      if (gDebugMode) printf("[DEBUG]: Audio: Buffer underrun\n");
+    }
+    alSourcePlay(__source);
+  }
+  thread_mutex_unlock(__lock);
+}
+
+static int stream_thread(void* arg)
+{
+  (void)arg;
+
+  // Wake up often enough to refill a buffer long before the source gets to it
+  int interval = (int)(AUDIO_STREAM_FRAMES * 1000ULL / __sample_rate / 4);
+  if (interval < 1) interval = 1;
+
+  while (thread_atomic_load(&__running))
+  {
+    refill();
+    thread_event_wait(__wake, interval);
+  }
+
+  return 0;
+}
+
+static int open_vorbis(const char* path)
+{
+  FILE* f = fopen(path, "rb");
+  if (!f)
+  {
+    printf("bbmx Error: Failed to open file: \"%s\"\n", path);
+    return 0;
+  }
+
+  int err = VORBIS__no_error;
+  __vorbis = stb_vorbis_open_file(f, 1, &err, NULL);
+  if (__vorbis == NULL || err != VORBIS__no_error)
+  {
+    printf("bbmx Error: Failed to open vorbis file: \"%s\", Error Code: \"%d\"\n", path, err);
+    if (__vorbis == NULL) fclose(f);
+    return 0;
+  }
+
+  stb_vorbis_info i = stb_vorbis_get_info(__vorbis);
+  __channels = i.channels;
+  __sample_rate = i.sample_rate;
+
+  if (__channels == 1)
+  {
+    __format = AL_FORMAT_MONO16;
+  }
+  else if (__channels == 2)
+  {
+    __format = AL_FORMAT_STEREO16;
+  }
+  else
+  {
+    printf("bbmx Error: Unsupported number of channels: %d\n", __channels);
+    return 0;
+  }
+
+  return 1;
+}
+
+static int load_whole(const char* path)
+{
+  size_t frames = stb_vorbis_stream_length_in_samples(__vorbis);
+  size_t size = frames * __channels * sizeof(short);
+  short* data = malloc(size);
+  if (data == NULL)
+  {
+    printf("bbmx Error: Not enough memory to decode \"%s\"\n", path);
+    return 0;
+  }
+
+  frames = stb_vorbis_get_samples_short_interleaved(__vorbis, __channels, data, frames * __channels);
+
+  alGenBuffers(1, __buffers);
+  __buffer_count = 1;
+  alBufferData(__buffers[0], __format, data, frames * __channels * sizeof(short), __sample_rate);
+  __tap_size = frames > 0 ? frames : 1;
+  __tap = malloc(sizeof(float) * __tap_size);
+  tap_write(data, frames);
+  free(data);
+
+  alSourceQueueBuffers(__source, 1, __buffers);
+  queue_push(__buffers[0], frames);
+  __eof = 1;
+
+  alSourcePlay(__source);
+  return 1;
+}
+
+static int start_stream()
+{
+  // Room to decode a chunk for every buffer of the ring
+  __pcm = malloc((size_t)AUDIO_STREAM_BUFFERS * AUDIO_STREAM_FRAMES * __channels * sizeof(short));
+  alGenBuffers(AUDIO_STREAM_BUFFERS, __buffers);
+  __buffer_count = AUDIO_STREAM_BUFFERS;
+  // Everything queued plus one buffer that has already been played
+  __tap_size = (size_t)(AUDIO_STREAM_BUFFERS + 1) * AUDIO_STREAM_FRAMES;
+  __tap = malloc(sizeof(float) * __tap_size);
+
+  // Fill the whole ring before playback starts
+  refill();
+
+  __running = 1;
+  __wake = thread_event_create();
+  __worker = __wake != NULL ? thread_create(stream_thread, NULL) : NULL;
+  if (__worker == NULL)
+  {
+    printf("bbmx Error: Failed to start audio stream thread\n");
+    __running = 0;
+    return 0;
+  }
+
+  return 1;
+}
+
+int audio_open(const char* path, int stream)
+{
+  __device = alcOpenDevice(NULL);
+  if (__device == NULL)
+  {
+    printf("bbmx Error: Failed to open audio device\n");
+    return 0;
+  }
+  __context = alcCreateContext(__device, NULL);
+  alcMakeContextCurrent(__context);
+
+  __get_source_dv = NULL;
+  __latency = 0;
+  if (alIsExtensionPresent("AL_SOFT_source_latency"))
+  {
+    __get_source_dv = (LPALGETSOURCEDVSOFT)alGetProcAddress("alGetSourcedvSOFT");
+  }
+  if (gDebugMode && __get_source_dv == NULL) printf("[DEBUG]: Audio: AL_SOFT_source_latency not supported, device latency unknown\n");
+
+  alGenSources(1, &__source);
+  alSourcef(__source, AL_GAIN, 0.05f);
+
+  __lock = thread_mutex_create();
+  __queue_head = 0;
+  __queue_len = 0;
+  __played = 0;
+  __decoded = 0;
+  __eof = 0;
+  __underruns = 0;
+
+  if (!open_vorbis(path)) return 0;
+
+  if (!stream)
+  {
+    int ok = load_whole(path);
+    stb_vorbis_close(__vorbis);
+    __vorbis = NULL;
+    return ok;
+  }
+
+  return start_stream();
+}
+
+void audio_close()
+{
+  if (__device == NULL) return;
+
+  if (__worker != NULL)
+  {
+    thread_atomic_store(&__running, 0);
+    thread_event_signal(__wake);
+    thread_join(__worker);
+    __worker = NULL;
+  }
+  thread_event_destroy(__wake);
+  __wake = NULL;
+
+  if (gDebugMode && __underruns > 0) printf("[DEBUG]: Audio: %lu buffer underruns\n", __underruns);
+  if (gDebugMode && __get_source_dv != NULL) printf("[DEBUG]: Audio: %.1f ms device latency\n", __latency);
+
+  alSourceStop(__source);
+  alSourcei(__source, AL_BUFFER, 0);
+  alDeleteSources(1, &__source);
+  alDeleteBuffers(__buffer_count, __buffers);
+  __buffer_count = 0;
+
+  if (__vorbis != NULL) stb_vorbis_close(__vorbis);
+  __vorbis = NULL;
+  free(__pcm);
+  __pcm = NULL;
+  free(__tap);
+  __tap = NULL;
+  __tap_size = 0;
+
+  thread_mutex_destroy(__lock);
+  __lock = NULL;
+
+  alcMakeContextCurrent(NULL);
+  alcDestroyContext(__context);
+  alcCloseDevice(__device);
+  __context = NULL;
+  __device = NULL;
+}
+
+int audio_playing()
+{
+  thread_mutex_lock(__lock);
+  ALint state;
+  alGetSourcei(__source, AL_SOURCE_STATE, &state);
+  // Queuing the last buffer and restarting the source happen under the lock,
+  // so a stopped source after the end of the file really is done
+  int playing = state == AL_PLAYING || !__eof;
+  thread_mutex_unlock(__lock);
+
+  return playing;
+}
+
+double audio_position_ms()
+{
+  thread_mutex_lock(__lock);
+  double ms = position_frames() * 1000.0 / __sample_rate;
+
+  if (__get_source_dv != NULL)
+  {
+    ALint state;
+    alGetSourcei(__source, AL_SOURCE_STATE, &state);
+    if (state == AL_PLAYING)
+    {
+      // The offset and the latency are taken at the same moment, and the
+      // offset is finer than AL_SAMPLE_OFFSET. Both are relative to the
+      // first queued buffer like the sample offset.
+      ALdouble values[2];
+      __get_source_dv(__source, AL_SEC_OFFSET_LATENCY_SOFT, values);
+      ms = __played * 1000.0 / __sample_rate + values[0] * 1000.0;
+      __latency = values[1] * 1000.0;
+    }
+  }
+  thread_mutex_unlock(__lock);
+
+  return ms;
+}
+
+double audio_latency_ms()
+{
+  return __latency;
+}
+
+unsigned long long audio_tap(float* out, int frames)
+{
+  thread_mutex_lock(__lock);
+  unsigned long long end = position_frames();
+  unsigned long long oldest = __decoded > __tap_size ? __decoded - __tap_size : 0;
+  for (int i = 0; i < frames; i++)
+  {
+    // Zeros for whatever is before the start or no longer in the tap
+    long long f = (long long)end - frames + i;
+    out[i] = f >= (long long)oldest && f < (long long)__decoded ? __tap[f % __tap_size] : 0.0f;
+  }
+  thread_mutex_unlock(__lock);
+
+  return end;
+}
+
+unsigned int audio_sample_rate()
+{
+  return __sample_rate;
+}
@@ -1,5 +1,3 @@
-#include <stb/stb_vorbis.h>
-#undef L
 #include "bbmx.h"
 #include <argparse/argparse.h>
 #include <stdio.h>
@@ -14,38 +12,38 @@
 #include "globals.h"
 #include <time.h>
 #include <signal.h>
-#include <AL/al.h>
-#include <AL/alc.h>
-#include "bbmx_lapi_interface.h"
+#include "ticker.h"
+#include "audio.h"
+#include "analysis.h"
+#include "meter.h"
+#include "script.h"
+#include "watch.h"
+#include "cue.h"
+#include "worker.h"
+#include "bbmxs/envelope.h"
+#include "bbmxs/effect.h"
+#include "bbmxs/motion.h"
 #include <math.h>
 
-typedef struct
-{
-    char* buf;
-    size_t sz;
-    char* filename;
-} PreprocessResult;
-
 static int bbmx_run(const char* path);
 static int run_script(const char* path);
 static void print_lua_error(lua_State* L);
 static int do_pcall(lua_State* L, int nargs, int nresults);
 static void INThandler(int sig);
-static int load_audio(const char* path);
-static void terminate_openal();
 static void update_flashes(float delta, BBMXScontext* ctx, float timePos);
 static int update_timed_functions(lua_State* L, BBMXScontext* ctx);
-static PreprocessResult preprocess_script(const char* path);
-
-static ALCdevice* alc_device = NULL;
-static ALCcontext* alc_context = NULL;
-static ALuint al_buffer;
-static ALuint al_source;
-static ALint al_sample_rate;
-static BBMXStimedflash* curFlash = NULL;
-static BBMXSfixture* curFlashFx = NULL;
-static int curFlashTemp = 0;
+static int update_beats(lua_State* L, BBMXScontext* ctx, float timePos);
+static double beat_position(BBMXScontext* ctx, float timePos);
+static void create_audio_table(lua_State* L, int bands);
+static void update_audio_table(lua_State* L);
+static int reload_script(const char* path, lua_State** L, BBMXScontext* ctx, float timePos);
+
 static float elapsed = 0.0f;
+static BBMXbeatgrid beatGrid;
+static size_t nextBeat = 0; // counts subdivisions when bpm_resolution > 1
+static int audioTable = LUA_NOREF;
+static int audioBandsTable = LUA_NOREF;
+static int watchScript = 0;
 
 static const char *const usages[] = {
     "bbmx [options] [[--] args]",
@@ -58,11 +56,14 @@ int bbmx_init(int argc, const char* argv[])
     signal(SIGINT, INThandler);
 
     const char* runPath = NULL;
+    const char* compilePath = NULL;
 
     struct argparse_option options[] = {
         OPT_HELP(),
         OPT_GROUP("Test"),
         OPT_STRING('r', "run", &runPath, "runs a scene script", NULL, 0, 0),
+        OPT_STRING('c', "compile", &compilePath, "compiles a scene script into its bytecode cache without running it", NULL, 0, 0),
+        OPT_BOOLEAN('w', "watch", &watchScript, "reloads the script while it runs whenever it is saved", NULL, 0, 0),
         OPT_BOOLEAN('d', "debug", &gDebugMode, "prints debug messages for additional information", NULL, 0, 0),
         OPT_INTEGER('n', "mnum", &gMaxModels, "max. number of models (default: 8)", NULL, 0, 0),
         OPT_INTEGER('m', "fxnum", &gMaxFixtures, "max. number of fixtures (default: 32)", NULL, 0, 0),
@@ -75,6 +76,12 @@ int bbmx_init(int argc, const char* argv[])
     argparse_describe(&argparse, "\nbbmx is a dmx fixture controller program.\nYou can script scenes via lua and run them with bbmx -r <your lua file>.", "\n");
     argc = argparse_parse(&argparse, argc, argv);
 
+    if (compilePath != NULL)
+    {
+        if (!script_compile(compilePath)) return -1;
+        if (runPath == NULL) return 0;
+    }
+
     if (runPath == NULL)
     {
         printf("No file provided! Use: bbmx -r <file> to run a script.\n");
@@ -106,52 +113,90 @@ int bbmx_run(const char* path)
     return run_script(path);
 }
 
-int run_script(const char* path)
+static void init_args(BBMXSinitargs* initargs)
+{
+    initargs->models = malloc(sizeof(BBMXSmodel) * gMaxModels);
+    initargs->fixtures = malloc(sizeof(BBMXSfixture) * gMaxFixtures);
+    initargs->fixtureCount = 0;
+    initargs->groups = NULL;
+    initargs->groupCount = 0;
+    initargs->ports = NULL;
+    initargs->portCount = 0;
+    initargs->protocol = BBMXS_PROTOCOL_V2;
+    initargs->keyframeInterval = 1000;
+    initargs->modelCount = 0;
+    initargs->timedFunctionCount = 0;
+    initargs->timedFlashCount = 0;
+    initargs->sndFile = NULL;
+    initargs->sndStream = 1;
+    initargs->timedFlashes = NULL;
+    initargs->timedFunctions = NULL;
+    initargs->layers = NULL;
+    initargs->layerCount = 0;
+    initargs->bpm = 0;
+    initargs->bpm_resolution = 1;
+    initargs->beatAnalysis = 1;
+    initargs->audioBands = 0;
+    initargs->audioLatency = -1;
+    initargs->outputLatency = 0;
+}
+
+// Loads the script into a new state and runs BBMX_setup,
+// NULL when that fails (the state is closed and the initargs freed then)
+static lua_State* setup_script(const char* path, BBMXSinitargs* initargs)
 {
     lua_State* L = luaL_newstate();
     luaL_openlibs(L);
 
-    PreprocessResult preprocess_result = preprocess_script(path);
-
-    if (luaL_loadbuffer(L, preprocess_result.buf, preprocess_result.sz, preprocess_result.filename) != LUA_OK)
+    if (script_load(L, path) != LUA_OK)
     {
-        printf("bbmx Error: Failed to load script: \"%s\"", path);
+        printf("bbmx Error: Failed to load script: \"%s\"\n", path);
+        print_lua_error(L);
         lua_close(L);
-        return -1;
+        return NULL;
     }
 
-    lua_pcall(L, 0, 0, 0);
+    if (!do_pcall(L, 0, 0))
+    {
+        lua_close(L);
+        return NULL;
+    }
 
-    BBMXSinitargs initargs;
-    initargs.models = malloc(sizeof(BBMXSmodel) * gMaxModels);
-    initargs.fixtures = malloc(sizeof(BBMXSfixture) * gMaxFixtures);
-    initargs.fixtureCount = 0;
-    initargs.modelCount = 0;
-    initargs.timedFunctionCount = 0;
-    initargs.timedFlashCount = 0;
-    initargs.sndFile = NULL;
-    initargs.timedFlashes = NULL;
-    initargs.timedFunctions = NULL;
-    initargs.bpm = 0;
+    init_args(initargs);
 
     int result;
-    if ((result = bbmx_lapi_load(L, &initargs)) != 0)
+    if ((result = bbmx_lapi_load(L, initargs)) != 0)
     {
-        printf("bbmx (lapi) Error: Failed to load lua api. (Code: %s)\n", result);
+        printf("bbmx (lapi) Error: Failed to load lua api. (Code: %d)\n", result);
+        bbmxs_free_initargs(initargs);
         lua_close(L);
-        return -1;
+        return NULL;
     }
 
     lua_getglobal(L, "BBMX_setup");
     if (!lua_isfunction(L, -1))
     {
         printf("bbmx Error: Expected 'BBMX_setup'; got 'nil'\n");
+        bbmxs_free_initargs(initargs);
         lua_close(L);
-        return -1;
+        return NULL;
     }
     if (!do_pcall(L, 0, 0))
     {
+        bbmxs_free_initargs(initargs);
         lua_close(L);
+        return NULL;
+    }
+
+    return L;
+}
+
+int run_script(const char* path)
+{
+    BBMXSinitargs initargs;
+    lua_State* L = setup_script(path, &initargs);
+    if (L == NULL)
+    {
         return -1;
     }
 
@@ -165,6 +210,9 @@ int run_script(const char* path)
 
     bbmx_lapi_loaded();
 
+    // From here on every error goes through the teardown at `fail`
+    int result = -1;
+
     if (gDebugMode) printf("[DEBUG] Init Complete\n");
 
     int hasSound = ctx->sndFile != NULL;
@@ -172,135 +220,271 @@ int run_script(const char* path)
     {
         if (gDebugMode) printf("[DEBUG] Has Sound\n");
 
-        alc_device = alcOpenDevice(NULL);
-        alc_context = alcCreateContext(alc_device, NULL);
-        alcMakeContextCurrent(alc_context);
+        lua_getglobal(L, "BBMX_beat");
+        int beatFunc = lua_isfunction(L, -1);
+        lua_pop(L, 1);
+        if (beatFunc && ctx->beatAnalysis && !analysis_load(ctx->sndFile, ctx->bpm, &beatGrid))
+        {
+            printf("bbmx Warning: Failed to analyze the beats of \"%s\"\n", ctx->sndFile);
+        }
 
-        alGenBuffers(1, &al_buffer);
-        alGenSources(1, &al_source);
+        if (!audio_open(ctx->sndFile, ctx->sndStream))
+        {
+            goto fail;
+        }
 
-        alSourcef(al_source, AL_GAIN, 0.05f);
-        if (!load_audio(ctx->sndFile))
+        if (ctx->audioBands > 0)
         {
-            bbmxs_close();
-            lua_close(L);
-            terminate_openal();
+            if (meter_start(ctx->audioBands))
+            {
+                create_audio_table(L, ctx->audioBands);
+            }
+            else
+            {
+                printf("bbmx Warning: Failed to start the audio meter\n");
+            }
         }
-        
-        alSourcei(al_source, AL_BUFFER, al_buffer);
-        alSourcePlay(al_source);
     }
 
     lua_getglobal(L, "BBMX_start");
     if (!lua_isfunction(L, -1))
     {
         printf("bbmx Error: Expected 'BBMX_start'; got 'nil'\n");
-        bbmxs_close();
-        lua_close(L);
-        return -1;
+        goto fail;
     }
     if (!do_pcall(L, 0, 0))
     {
-        bbmxs_close();
-        lua_close(L);
-        return -1;
+        goto fail;
     }
+    bbmxs_flush();
 
-    int lastBeat = 0;
+    if (!worker_start(ctx, elapsed))
+    {
+        goto fail;
+    }
 
     lua_getglobal(L, "BBMX_loop");
     int loopFunc = lua_isfunction(L, -1);
-    if (loopFunc || ctx->timedFunctionCount > 0 || hasSound)
+    if (loopFunc || ctx->timedFunctionCount > 0 || hasSound || envelope_count() > 0 || motion_count() > 0 || effect_count() > 0 || cue_count() > 0 || ctx->layerCount > 0)
     {
         lua_pop(L, -1);
-        time_t last = 0;
+
+        BBMXticker ticker;
+        if (!ticker_init(&ticker, gUPS))
+        {
+            printf("bbmx Error: Invalid updates per second: %d\n", gUPS);
+            goto fail;
+        }
+
+        // A failed update sets it back to -1 and ends the loop
+        result = 0;
+        BBMXwatch* watch = watchScript ? watch_start(path) : NULL;
+        float timePos = 0;
         while (!gShouldExit)
         {
-            time_t now = (clock() / (double)CLOCKS_PER_SEC) * 1000;
-            if (now >= last + (1000 / gUPS))
+            double delta = ticker_wait(&ticker);
+            if (gShouldExit) break;
+
+            if (!worker_ok())
+            {
+                result = -1;
+                break;
+            }
+
+            // Between two ticks, so the new script takes over with a whole frame
+            if (watch_changed(watch))
             {
-                double delta = now - last;
-                last = now;
+                int reloaded = reload_script(path, &L, ctx, timePos);
+                if (reloaded < 0)
+                {
+                    result = -1;
+                    break;
+                }
+                if (reloaded)
+                {
+                    lua_getglobal(L, "BBMX_loop");
+                    loopFunc = lua_isfunction(L, -1);
+                    lua_pop(L, 1);
+                }
+            }
+
+            elapsed += delta;
 
-                elapsed += delta;
+            lua_pushnumber(L, elapsed);
+            lua_setglobal(L, "time");
 
-                lua_pushnumber(L, elapsed);
-                lua_setglobal(L, "time");
+            if (audioTable != LUA_NOREF)
+            {
+                update_audio_table(L);
+            }
 
-                if (loopFunc)
+            if (loopFunc)
+            {
+                lua_getglobal(L, "BBMX_loop");
+                lua_pushnumber(L, delta);
+                if (!do_pcall(L, 1, 0))
                 {
-                    lua_getglobal(L, "BBMX_loop");
-                    lua_pushnumber(L, delta);
-                    if (!do_pcall(L, 1, 0))
-                    {
-                        bbmxs_close();
-                        lua_close(L);
-                        return -1;
-                    }
+                    result = -1;
+                    break;
                 }
+            }
 
-                float timePos = elapsed;
-                if (hasSound)
+            timePos = elapsed;
+            if (hasSound)
+            {
+                if (!audio_playing())
                 {
-                    int state;
-                    alGetSourcei(al_source, AL_SOURCE_STATE, &state);
-                    if (state != AL_PLAYING)
-                    {
-                        gShouldExit = 1;
-                    }
-
-                    int offset;
-                    alGetSourcei(al_source, AL_SAMPLE_OFFSET, &offset);
-                    float pos = (float)offset / (float)al_sample_rate;
-                    timePos = pos * 1000.0f;
-
-                    if (ctx->bpm > 0)
-                    {
-                        int curBeat = floorf(timePos / (ctx->beat_time));
-                        if (lastBeat != curBeat)
-                        {
-                            lastBeat = curBeat;
-                            lua_getglobal(L, "BBMX_beat");
-                            if (lua_isfunction(L, -1))
-                            {
-                                lua_pushinteger(L, curBeat);
-                                if (!do_pcall(L, 1, 0))
-                                {
-                                    terminate_openal();
-                                    bbmxs_close();
-                                    lua_close(L);
-                                    return -1;
-                                }
-                            }
-                        }
-                    }
+                    gShouldExit = 1;
                 }
 
-                update_flashes(delta, ctx, timePos);
-                if (!update_timed_functions(L, ctx))
+                // Light sent now shows up outputLatency ms later, by then the
+                // speakers play what the mixer was at audioLatency ms before
+                double latency = ctx->audioLatency >= 0 ? ctx->audioLatency : audio_latency_ms();
+                timePos = audio_position_ms() - latency + ctx->outputLatency;
+
+                if (!update_beats(L, ctx, timePos))
                 {
-                    printf("bbmx Error: Something went wrong while updating timed functions!\n");
-                    return -1;
+                    result = -1;
+                    break;
                 }
             }
+
+            // Effects set the fixture colors the envelopes are layered on,
+            // a fan effect overrides a move on the same fixture
+            double beat = beat_position(ctx, timePos);
+            motion_update(delta);
+            effect_update(delta, beat);
+            update_flashes(delta, ctx, timePos);
+            if (!update_timed_functions(L, ctx))
+            {
+                printf("bbmx Error: Something went wrong while updating timed functions!\n");
+                result = -1;
+                break;
+            }
+            if (!cue_update(L, elapsed, beat))
+            {
+                result = -1;
+                break;
+            }
+
+            if (!bbmxs_flush())
+            {
+                printf("bbmx Warning: Failed to send frame to the controller!\n");
+            }
         }
+
+        watch_stop(watch);
+
+        if (gDebugMode)
+        {
+            printf("[DEBUG]: Ticker: %lu ticks | %lu late | %lu dropped | %.3f ms max jitter\n",
+                ticker.ticks, ticker.late, ticker.dropped, ticker.maxJitter);
+        }
+        ticker_close(&ticker);
+
+        if (result < 0) goto fail;
+    }
+    else
+    {
+        result = 0;
     }
 
+    // BBMX_exit has the last word, without the layers over it
+    worker_stop();
+
     lua_getglobal(L, "BBMX_exit");
     if (lua_isfunction(L, -1))
     {
         do_pcall(L, 0, 0);
     }
-
-
-    terminate_openal();
+    bbmxs_flush();
+
+fail:
+    // Everything that was started is stopped, the rest doesn't mind
+    worker_stop();
+    cue_close(L);
+    meter_stop();
+    audio_close();
+    analysis_free(&beatGrid);
     bbmxs_close();
     lua_close(L);
 
-    free(preprocess_result.buf);
-    free(preprocess_result.filename);
-    
-    return 0;
+    return result;
+}
+
+// Sets the changed script up in a new state and swaps it in. Ports, sound,
+// beats and the time carry on, the new BBMX_start picks up from there.
+// 0 when it failed and the old script keeps running, -1 when bbmx can't go on.
+static int reload_script(const char* path, lua_State** L, BBMXScontext* ctx, float timePos)
+{
+    printf("Reloading \"%s\"\n", path);
+
+    // The layer scripts read the patch, and are reloaded along with it
+    worker_stop();
+
+    BBMXSinitargs initargs;
+    lua_State* next = setup_script(path, &initargs);
+    if (next == NULL)
+    {
+        bbmx_lapi_loaded();
+        printf("bbmx Warning: Reload failed, the previous script keeps running\n");
+        return worker_start(ctx, elapsed) ? 0 : -1;
+    }
+
+    lua_getglobal(next, "BBMX_start");
+    int startFunc = lua_isfunction(next, -1);
+    lua_pop(next, 1);
+    if (!startFunc)
+    {
+        printf("bbmx Error: Expected 'BBMX_start'; got 'nil'\n");
+        bbmx_lapi_loaded();
+        bbmxs_free_initargs(&initargs);
+        lua_close(next);
+        printf("bbmx Warning: Reload failed, the previous script keeps running\n");
+        return worker_start(ctx, elapsed) ? 0 : -1;
+    }
+
+    int result = bbmxs_reload(&initargs);
+    bbmx_lapi_loaded();
+    if (result == 0)
+    {
+        lua_close(next);
+        printf("bbmx Warning: Reload failed, the previous script keeps running\n");
+        return worker_start(ctx, elapsed) ? 0 : -1;
+    }
+
+    // The context refers to the new state from here on
+    cue_close(*L);
+    lua_close(*L);
+    *L = next;
+    if (result < 0) return -1;
+
+    // Cues that are already over don't go off again
+    while (ctx->timedFunctionNext < ctx->timedFunctionCount && ctx->timedFunctions[ctx->timedFunctionNext].t <= elapsed)
+    {
+        ctx->timedFunctionNext++;
+    }
+    for (int i = 0; i < ctx->timedFlashCount; i++)
+    {
+        if (ctx->timedFlashes[i].t <= timePos) ctx->timedFlashes[i].used = 1;
+    }
+
+    if (audioTable != LUA_NOREF)
+    {
+        create_audio_table(next, ctx->audioBands);
+    }
+    lua_pushnumber(next, elapsed);
+    lua_setglobal(next, "time");
+
+    lua_getglobal(next, "BBMX_start");
+    if (!do_pcall(next, 0, 0))
+    {
+        printf("bbmx Warning: 'BBMX_start' of the reloaded script failed\n");
+    }
+    if (!worker_start(ctx, elapsed)) return -1;
+
+    if (gDebugMode) printf("[DEBUG]: Reloaded \"%s\"\n", path);
+    return 1;
 }
 
 static void update_flashes(float delta, BBMXScontext* ctx, float timePos)
@@ -313,69 +497,141 @@ static void update_flashes(float delta, BBMXScontext* ctx, float timePos)
         if (timePos >= flash->t)
         {
             flash->used = 1;
-            BBMXSfixture* fx = bbmxs_get_fx(flash->name);
-            curFlash = flash;
-            curFlashFx = fx;
-            fx->color = flash->color;
+            envelope_flash(bbmxs_get_fx(flash->name), flash->color, flash->speed);
         }
     }
 
-    if (curFlash != NULL)
+    envelope_update(delta);
+}
+
+// The global `audio` table is created once and only its values change,
+// so reading it every tick doesn't produce any garbage
+static void create_audio_table(lua_State* L, int bands)
+{
+    lua_createtable(L, 0, 3);
+    lua_pushnumber(L, 0);
+    lua_setfield(L, -2, "rms");
+    lua_pushnumber(L, 0);
+    lua_setfield(L, -2, "peak");
+
+    lua_createtable(L, bands, 0);
+    for (int i = 1; i <= bands; i++)
     {
+        lua_pushnumber(L, 0);
+        lua_rawseti(L, -2, i);
+    }
+    lua_pushvalue(L, -1);
+    audioBandsTable = luaL_ref(L, LUA_REGISTRYINDEX);
+    lua_setfield(L, -2, "bands");
 
-        if (curFlashFx->color.r - curFlash->speed > 0)
-        {
-            curFlashFx->color.r -= curFlash->speed * delta;
-        }
-        if (curFlashFx->color.g - curFlash->speed > 0)
-        {
-            curFlashFx->color.g -= curFlash->speed * delta;
-        }
-        if (curFlashFx->color.b - curFlash->speed > 0)
-        {
-            curFlashFx->color.b -= curFlash->speed * delta;
-        }
-        if (curFlashFx->color.w - curFlash->speed > 0)
-        {
-            curFlashFx->color.w -= curFlash->speed * delta;
-        }
+    lua_pushvalue(L, -1);
+    lua_setglobal(L, "audio");
+    audioTable = luaL_ref(L, LUA_REGISTRYINDEX);
+}
 
-        if (curFlashFx->color.r < 1 && curFlashFx->color.g < 1 && curFlashFx->color.b < 1 && curFlashFx->color.w < 1)
-        {
-            if (curFlashTemp)
-            {
-                curFlashTemp = 0;
-                free(curFlash);
-            }
-            curFlash = NULL;
-            curFlashFx = NULL;
-        }
-        else
-        {
-            bbmxs_fx_update_color(curFlashFx);
-        }
+static void update_audio_table(lua_State* L)
+{
+    const BBMXmeter* meter = meter_get();
+
+    lua_rawgeti(L, LUA_REGISTRYINDEX, audioTable);
+    lua_pushnumber(L, meter->rms);
+    lua_setfield(L, -2, "rms");
+    lua_pushnumber(L, meter->peak);
+    lua_setfield(L, -2, "peak");
+    lua_pop(L, 1);
+
+    lua_rawgeti(L, LUA_REGISTRYINDEX, audioBandsTable);
+    for (int i = 0; i < meter->bandCount; i++)
+    {
+        lua_pushnumber(L, meter->bands[i]);
+        lua_rawseti(L, -2, i + 1);
+    }
+    lua_pop(L, 1);
+}
+
+static double beat_time(BBMXScontext* ctx, size_t beat, int res)
+{
+    if (beatGrid.beatCount == 0) return (double)beat * ctx->beat_time / res;
+
+    size_t b = beat / res;
+    double t = beatGrid.beats[b];
+    double next = b + 1 < beatGrid.beatCount ? beatGrid.beats[b + 1] : t + 60000.0 / beatGrid.bpm;
+    return t + (next - t) * (beat % res) / res;
+}
+
+// Beats since the start with fraction, for beat synced effects.
+// -1 when there is neither a beat grid nor a bpm.
+static double beat_position(BBMXScontext* ctx, float timePos)
+{
+    if (beatGrid.beatCount == 0) return ctx->bpm > 0 ? timePos / ctx->beat_time : -1;
+    if (timePos <= beatGrid.beats[0]) return 0;
+
+    // Last beat at or before timePos
+    size_t lo = 0;
+    size_t hi = beatGrid.beatCount;
+    while (hi - lo > 1)
+    {
+        size_t mid = (lo + hi) / 2;
+        if (beatGrid.beats[mid] <= timePos) lo = mid;
+        else hi = mid;
+    }
+
+    double t = beatGrid.beats[lo];
+    double next = lo + 1 < beatGrid.beatCount ? beatGrid.beats[lo + 1] : t + 60000.0 / beatGrid.bpm;
+    return lo + (timePos - t) / (next - t);
+}
+
+// Calls BBMX_beat once for the latest beat that has passed since the last
+// tick, with how many ms ago it actually was. The beats come from the
+// analyzed grid or, without one, every 60000 / bpm ms.
+static int update_beats(lua_State* L, BBMXScontext* ctx, float timePos)
+{
+    int res = ctx->bpm_resolution > 0 ? ctx->bpm_resolution : 1;
+    int hasGrid = beatGrid.beatCount > 0;
+    if (!hasGrid && ctx->bpm <= 0) return 1;
+
+    size_t total = hasGrid ? beatGrid.beatCount * res : (size_t)-1;
+    size_t fired = total;
+    double firedAt = 0;
+    while (nextBeat < total)
+    {
+        double t = beat_time(ctx, nextBeat, res);
+        if (t > timePos) break;
+
+        fired = nextBeat++;
+        firedAt = t;
+    }
+    if (fired == total) return 1;
+
+    lua_getglobal(L, "BBMX_beat");
+    if (!lua_isfunction(L, -1))
+    {
+        lua_pop(L, 1);
+        return 1;
     }
+
+    size_t beat = fired / res;
+    int downbeat = fired % res == 0 && (hasGrid ? beatGrid.downbeats[beat] : beat % ANALYSIS_BEATS_PER_BAR == 0);
+    lua_pushinteger(L, fired);
+    lua_pushboolean(L, downbeat);
+    lua_pushnumber(L, timePos - firedAt);
+    return do_pcall(L, 3, 0);
 }
 
 static int update_timed_functions(lua_State* L, BBMXScontext* ctx)
 {
-    int noMoreFuncToExecute = 1;
-    for (int i = 0; i < ctx->timedFunctionCount; i++)
+    // timedFunctions is sorted, so only the due ones are looked at
+    int noMoreFuncToExecute = ctx->timedFunctionNext >= ctx->timedFunctionCount;
+    while (ctx->timedFunctionNext < ctx->timedFunctionCount)
     {
-        BBMXStimedfunc* timedFunc = &ctx->timedFunctions[i];
-        if (timedFunc->used) continue;
-        noMoreFuncToExecute = 0;
+        BBMXStimedfunc* timedFunc = &ctx->timedFunctions[ctx->timedFunctionNext];
+        if (elapsed < timedFunc->t) break;
 
-        if (elapsed >= timedFunc->t)
+        ctx->timedFunctionNext++;
+        lua_rawgeti(L, LUA_REGISTRYINDEX, timedFunc->ref);
+        if (!do_pcall(L, 0, 0))
         {
-            timedFunc->used = 1;
-            lua_getglobal(L, timedFunc->name);
-            if (!do_pcall(L, 0, 0))
-            {
-                bbmxs_close();
-                lua_close(L);
-                return 0;
-            }
+            return 0;
         }
     }
 
@@ -385,10 +641,7 @@ static int update_timed_functions(lua_State* L, BBMXScontext* ctx)
         justReset = 1;
         gDoTimerReset = 0;
         elapsed = 0.0f;
-        for (int i = 0; i < ctx->timedFunctionCount; i++)
-        {
-            ctx->timedFunctions[i].used = 0;
-        }
+        ctx->timedFunctionNext = 0;
     }
 
     if (noMoreFuncToExecute && !justReset && ctx->timedFunctionCount > 0 && gExitAfterNoMoreTimedFuncs)
@@ -420,111 +673,3 @@ static void INThandler(int sig)
     signal(sig, SIG_IGN);
     gShouldExit = 1;
 }
-
-static int load_audio(const char* path)
-{
-    FILE* f;
-    fopen_s(&f, path, "rb");
-    if (!f)
-    {
-        printf("bbmx Error: Failed to open file: \"%s\"\n", path);
-        return 0;
-    }
-
-    int err = VORBIS__no_error;
-    stb_vorbis* v = stb_vorbis_open_file(f, 1, &err, NULL);
-    if (err != VORBIS__no_error)
-    {
-        printf("bbmx Error: Failed to open vorbis file: \"%s\", Error Code: \"%d\"\n", path, err);
-        return 0;
-    }
-
-    stb_vorbis_info i = stb_vorbis_get_info(v);
-    int channels = i.channels;
-    unsigned int sampleRate = i.sample_rate;
-    al_sample_rate = sampleRate;
-
-    size_t size = stb_vorbis_stream_length_in_samples(v) * channels * sizeof(short);
-    short* data = malloc(size);
-
-    stb_vorbis_get_samples_short_interleaved(v, channels, data, size);
-
-    ALenum format = AL_INVALID_ENUM;
-    if (channels == 1)
-    {
-        format = AL_FORMAT_MONO16;
-    }
-    else if (channels == 2)
-    {
-        format = AL_FORMAT_STEREO16;
-    }
-    else
-    {
-        printf("bbmx Error: Unsupported number of channels: %d\n", channels);
-        stb_vorbis_close(v);
-        fclose(f);
-        return 0;
-    }
-
-    alBufferData(al_buffer, format, data, size, sampleRate);
-    free(data);
-
-    stb_vorbis_close(v);
-    fclose(f);
-
-    return 1;
-}
-
-static void terminate_openal()
-{
-    if (alc_device == NULL) return;
-
-    alSourceStop(al_source);
-
-    alDeleteBuffers(1, &al_buffer);
-    alDeleteSources(1, &al_source);
-
-    alcDestroyContext(alc_context);
-    alcCloseDevice(alc_device);
-}
-
-void bbmxi_do_flash(BBMXStimedflash flash)
-{
-    BBMXStimedflash* f = malloc(sizeof(BBMXStimedflash));
-    f->color = flash.color;
-    f->name = flash.name;
-    f->speed = flash.speed;
-
-    curFlash = f;
-    curFlashFx = bbmxs_get_fx(flash.name);
-    curFlashTemp = 1;
-}
-
-static PreprocessResult preprocess_script(const char* path)
-{
-    PreprocessResult result;
-
-    char* pfile;
-    pfile = path + strlen(path);
-    for (; pfile > path; pfile--)
-    {
-        if ((*pfile == '\\') || (*pfile == '/'))
-        {
-            pfile++;
-            break;
-        }
-    }
-    result.filename = pfile;
-    
-    char* buf = utils_read_file_to_string(path);
-    char* buf1;
-
-    buf1 = utils_str_replace(buf, "require(\"bbmx\")", "");
-    free(buf);
-    buf = buf1;
-
-    result.buf = buf;
-    result.sz = strlen(buf);
-
-    return result;
-}
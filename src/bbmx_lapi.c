@@ -5,7 +5,15 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
-#include "bbmx_lapi_interface.h"
+#include <math.h>
+#include "bbmxs/envelope.h"
+#include "bbmxs/effect.h"
+#include "bbmxs/motion.h"
+#include "bbmxs/names.h"
+#include "bbmxs/serial.h"
+#include "meter.h"
+#include "cue.h"
+#include "bbmxs/layer.h"
 
 // SETUP start
 
@@ -14,15 +22,84 @@ static BBMXSmodel* __cur_model = NULL;
 static uint8_t __cur_universe = 1;
 static uint8_t __cur_channel_mode = 0;
 static int __cur_fx_idx = 0;
-static int __addr_multiplier = 0;
+static uint16_t __next_address = 1;
 static int __loaded = 0;
+// Fixture and group names to indices while patching, bbmxs keeps its own once loaded
+static BBMXSnames __fixture_names;
+static BBMXSnames __group_names;
 
 static BBMXSfixture* get_fixture_by_name(const char* name)
+{
+  if (__loaded) return bbmxs_get_fx(name);
+
+  int i = names_get(&__fixture_names, name);
+  return i >= 0 ? &__initargs->fixtures[i] : NULL;
+}
+
+// A fixture is either its name or the handle bbmx_fixture returned,
+// which is its index in ctx->fixtures plus one.
+// NULL for unknown names and handles out of range.
+static BBMXSfixture* to_fixture(lua_State* L, int idx)
+{
+  if (lua_type(L, idx) == LUA_TNUMBER)
+  {
+    lua_Integer handle = lua_tointeger(L, idx);
+    BBMXSfixture* fixtures = __loaded ? bbmxs_get_cur_ctx()->fixtures : __initargs->fixtures;
+    uint16_t count = __loaded ? bbmxs_get_cur_ctx()->fixtureCount : __initargs->fixtureCount;
+    if (handle < 1 || handle > count) return NULL;
+    return &fixtures[handle - 1];
+  }
+
+  const char* name = lua_tostring(L, idx);
+  return name != NULL ? get_fixture_by_name(name) : NULL;
+}
+
+static BBMXSfixture* check_fixture(lua_State* L, int idx)
+{
+  BBMXSfixture* fx = to_fixture(L, idx);
+  if (fx != NULL) return fx;
+
+  if (lua_type(L, idx) == LUA_TNUMBER) luaL_error(L, "Invalid fixture handle: %d", (int)lua_tointeger(L, idx));
+  luaL_error(L, "Can't find fixture named: %s", luaL_checkstring(L, idx));
+  return NULL;
+}
+
+static BBMXSgroup* get_group_by_name(const char* name)
+{
+  if (__loaded) return bbmxs_get_group(name);
+
+  int i = names_get(&__group_names, name);
+  return i >= 0 ? &__initargs->groups[i] : NULL;
+}
+
+// Groups have their own handles, the same way as fixtures
+static BBMXSgroup* check_group(lua_State* L, int idx)
+{
+  if (lua_type(L, idx) == LUA_TNUMBER)
+  {
+    lua_Integer handle = lua_tointeger(L, idx);
+    BBMXSgroup* groups = __loaded ? bbmxs_get_cur_ctx()->groups : __initargs->groups;
+    uint16_t count = __loaded ? bbmxs_get_cur_ctx()->groupCount : __initargs->groupCount;
+    if (handle < 1 || handle > count) luaL_error(L, "Invalid group handle: %d", (int)handle);
+    return &groups[handle - 1];
+  }
+
+  const char* name = luaL_checkstring(L, idx);
+  BBMXSgroup* grp = get_group_by_name(name);
+  if (grp == NULL) luaL_error(L, "Can't find group named: %s", name);
+  return grp;
+}
+
+// Returns the first fixture in `universe` whose channels overlap [address, address + footprint)
+static BBMXSfixture* find_overlap(uint8_t universe, uint16_t address, uint16_t footprint)
 {
   for (int i = 0; i < __initargs->fixtureCount; i++)
   {
     BBMXSfixture* fx = &__initargs->fixtures[i];
-    if (strcmp(fx->name, name) == 0)
+    if (fx->universe != universe) continue;
+
+    uint16_t fxFootprint = bbmxs_model_footprint(fx->model, fx->channel_mode);
+    if (address < fx->address + fxFootprint && fx->address < address + footprint)
     {
       return fx;
     }
@@ -30,6 +107,19 @@ static BBMXSfixture* get_fixture_by_name(const char* name)
   return NULL;
 }
 
+// Finds the first free address at or after `start`, 0 if the universe is full
+static uint16_t find_free_address(uint8_t universe, uint16_t start, uint16_t footprint)
+{
+  uint16_t address = start;
+  while (address + footprint - 1 <= BBMXS_UNIVERSE_SIZE)
+  {
+    BBMXSfixture* fx = find_overlap(universe, address, footprint);
+    if (fx == NULL) return address;
+    address = fx->address + bbmxs_model_footprint(fx->model, fx->channel_mode);
+  }
+  return 0;
+}
+
 static int l_bbmx_using(lua_State* L)
 {
   if (__loaded) luaL_error(L, "'bbmx_using' can only be called on setup");
@@ -39,6 +129,7 @@ static int l_bbmx_using(lua_State* L)
   __cur_model = bbmxs_get_model(name);
   __cur_channel_mode = 0;
   __cur_universe = 1;
+  __next_address = 1;
 
   if (gDebugMode) printf("[DEBUG]: Using Model: %s\n", name);
   return 0;
@@ -53,8 +144,9 @@ static int l_bbmx_opt(lua_State* L)
   if (strcmp(option, "universe") == 0)
   {
     int uv = luaL_checkinteger(L, 2);
-    if (uv < 1) luaL_error(L, "Invalid universe: %d", uv);
+    if (uv < 1 || uv > 0xFF) luaL_error(L, "Invalid universe: %d", uv);
     __cur_universe = uv;
+    __next_address = 1;
     if (gDebugMode) printf("[DEBUG]: Option: %s | Value: %d\n", option, uv);
   }
   else if (strcmp(option, "channel-mode") == 0)
@@ -64,6 +156,53 @@ static int l_bbmx_opt(lua_State* L)
     __cur_channel_mode = ch;
     if (gDebugMode) printf("[DEBUG]: Option: %s | Value: %d\n", option, ch);
   }
+  else if (strcmp(option, "protocol") == 0)
+  {
+    int p = luaL_checkinteger(L, 2);
+    if (p != BBMXS_PROTOCOL_V1 && p != BBMXS_PROTOCOL_V2) luaL_error(L, "Invalid protocol: %d", p);
+    __initargs->protocol = p;
+    if (gDebugMode) printf("[DEBUG]: Option: %s | Value: %d\n", option, p);
+  }
+  else if (strcmp(option, "keyframe-interval") == 0)
+  {
+    int ms = luaL_checkinteger(L, 2);
+    if (ms < 0) luaL_error(L, "Invalid keyframe-interval: %d", ms);
+    __initargs->keyframeInterval = ms;
+    if (gDebugMode) printf("[DEBUG]: Option: %s | Value: %d\n", option, ms);
+  }
+  else if (strcmp(option, "beat-analysis") == 0)
+  {
+    luaL_checktype(L, 2, LUA_TBOOLEAN);
+    __initargs->beatAnalysis = lua_toboolean(L, 2);
+    if (gDebugMode) printf("[DEBUG]: Option: %s | Value: %d\n", option, __initargs->beatAnalysis);
+  }
+  else if (strcmp(option, "audio-bands") == 0)
+  {
+    int bands = luaL_checkinteger(L, 2);
+    if (bands != 0 && (bands < METER_MIN_BANDS || bands > METER_MAX_BANDS)) luaL_error(L, "Invalid audio-bands: %d", bands);
+    __initargs->audioBands = bands;
+    if (gDebugMode) printf("[DEBUG]: Option: %s | Value: %d\n", option, bands);
+  }
+  else if (strcmp(option, "audio-latency") == 0)
+  {
+    float ms = luaL_checknumber(L, 2);
+    if (ms < 0) luaL_error(L, "Invalid audio-latency: %f", ms);
+    __initargs->audioLatency = ms;
+    if (gDebugMode) printf("[DEBUG]: Option: %s | Value: %f\n", option, ms);
+  }
+  else if (strcmp(option, "output-latency") == 0)
+  {
+    float ms = luaL_checknumber(L, 2);
+    if (ms < 0) luaL_error(L, "Invalid output-latency: %f", ms);
+    __initargs->outputLatency = ms;
+    if (gDebugMode) printf("[DEBUG]: Option: %s | Value: %f\n", option, ms);
+  }
+  else if (strcmp(option, "audio-stream") == 0)
+  {
+    luaL_checktype(L, 2, LUA_TBOOLEAN);
+    __initargs->sndStream = lua_toboolean(L, 2);
+    if (gDebugMode) printf("[DEBUG]: Option: %s | Value: %d\n", option, __initargs->sndStream);
+  }
 
   return 0;
 }
@@ -74,13 +213,81 @@ static int l_bbmx_port(lua_State* L)
 
   size_t portLen;
   const char* port = luaL_checklstring(L, 1, &portLen);
-  char* portCopy = malloc(portLen + 1);
-  memcpy(portCopy, port, portLen);
-  portCopy[portLen] = 0;
+  if (__initargs->portCount == 0xFF) luaL_error(L, "Too many ports");
 
-  __initargs->port = portCopy;
+  BBMXSport p;
+  p.baud = SERIAL_DEFAULT_BAUD;
+  p.universes = NULL;
+  p.universeCount = 0;
+
+  if (lua_isinteger(L, 2))
+  {
+    int baud = lua_tointeger(L, 2);
+    if (baud <= 0) luaL_error(L, "Invalid baud rate: %d", baud);
+    p.baud = baud;
+  }
 
-  if (gDebugMode) printf("[DEBUG]: Using COM Port: \"%s\"\n", port);
+  // A single universe or a table of universes this port outputs
+  if (lua_isinteger(L, 3))
+  {
+    int uv = lua_tointeger(L, 3);
+    if (uv < 1 || uv > 0xFF) luaL_error(L, "Invalid universe: %d", uv);
+    p.universes = malloc(1);
+    p.universes[0] = uv;
+    p.universeCount = 1;
+  }
+  else if (lua_istable(L, 3))
+  {
+    int len = lua_rawlen(L, 3);
+    p.universes = malloc(len > 0 ? len : 1);
+    for (int i = 1; i <= len; i++)
+    {
+      lua_rawgeti(L, 3, i);
+      int uv = lua_tointeger(L, -1);
+      lua_pop(L, 1);
+      if (uv < 1 || uv > 0xFF)
+      {
+        free(p.universes);
+        luaL_error(L, "Invalid universe: %d", uv);
+      }
+      p.universes[p.universeCount++] = uv;
+    }
+  }
+
+  p.name = malloc(portLen + 1);
+  memcpy(p.name, port, portLen);
+  p.name[portLen] = 0;
+
+  __initargs->ports = realloc(__initargs->ports, sizeof(BBMXSport) * (__initargs->portCount + 1));
+  __initargs->ports[__initargs->portCount] = p;
+  __initargs->portCount++;
+
+  if (gDebugMode) printf("[DEBUG]: Using Port: \"%s\" | Baud: %d | Universes: %d\n", port, p.baud, p.universeCount);
+
+  return 0;
+}
+
+static const char* const __layer_modes[] = { "htp", "ltp", NULL };
+
+static int l_bbmx_layer(lua_State* L)
+{
+  if (__loaded) luaL_error(L, "'bbmx_layer' can only be called on setup");
+
+  size_t scriptLen;
+  const char* script = luaL_checklstring(L, 1, &scriptLen);
+  if (__initargs->layerCount == 0xFF) luaL_error(L, "Too many layers");
+
+  BBMXSlayerscript layer;
+  layer.mode = luaL_checkoption(L, 2, "htp", __layer_modes) == 0 ? BBMXS_LAYER_HTP : BBMXS_LAYER_LTP;
+  layer.script = malloc(scriptLen + 1);
+  memcpy(layer.script, script, scriptLen);
+  layer.script[scriptLen] = 0;
+
+  __initargs->layers = realloc(__initargs->layers, sizeof(BBMXSlayerscript) * (__initargs->layerCount + 1));
+  __initargs->layers[__initargs->layerCount] = layer;
+  __initargs->layerCount++;
+
+  if (gDebugMode) printf("[DEBUG]: Layer: \"%s\" | %s\n", script, __layer_modes[layer.mode]);
 
   return 0;
 }
@@ -91,21 +298,45 @@ static int l_bbmx_fixture(lua_State* L)
   
   size_t nameLen;
   const char* name = luaL_checklstring(L, 1, &nameLen);
-  char* fxName = malloc(nameLen + 1);
-  memcpy(fxName, name, nameLen);
-  fxName[nameLen] = 0;
+  if (get_fixture_by_name(name) != NULL) luaL_error(L, "Fixture \"%s\" already exists", name);
+  if (__initargs->fixtureCount >= gMaxFixtures) luaL_error(L, "Too many fixtures");
 
-  uint8_t address;
+  uint16_t footprint = bbmxs_model_footprint(__cur_model, __cur_channel_mode);
+  if (footprint > BBMXS_UNIVERSE_SIZE) luaL_error(L, "Fixture \"%s\" needs %d channels", name, footprint);
 
-  if (lua_isinteger(L, -1))
+  uint16_t address;
+
+  if (lua_isinteger(L, 2))
   {
-    address = luaL_checkinteger(L, 2);
+    int addr = lua_tointeger(L, 2);
+    if (addr < 1 || addr + footprint - 1 > BBMXS_UNIVERSE_SIZE) luaL_error(L, "Invalid address for \"%s\": %d", name, addr);
+    address = addr;
+
+    // Patching on top of another fixture is allowed to mirror it
+    BBMXSfixture* other = find_overlap(__cur_universe, address, footprint);
+    if (other != NULL)
+    {
+      printf("bbmx Warning: Fixture \"%s\" overlaps \"%s\" in universe %d\n", name, other->name, __cur_universe);
+    }
   }
   else
   {
-    address = __cur_channel_mode * __addr_multiplier;
+    // Patch behind the previous fixture, continue in the next universe when this one is full
+    address = find_free_address(__cur_universe, __next_address, footprint);
+    while (address == 0)
+    {
+      if (__cur_universe == 0xFF) luaL_error(L, "No free address left for \"%s\"", name);
+      __cur_universe++;
+      address = find_free_address(__cur_universe, 1, footprint);
+    }
+    __next_address = address + footprint;
   }
 
+  // Only copied once nothing can fail anymore, luaL_error doesn't return
+  char* fxName = malloc(nameLen + 1);
+  memcpy(fxName, name, nameLen);
+  fxName[nameLen] = 0;
+
   BBMXScolor c;
   c.r = 0;
   c.g = 0;
@@ -123,12 +354,14 @@ static int l_bbmx_fixture(lua_State* L)
   fx.universe = __cur_universe;
 
   __initargs->fixtures[__initargs->fixtureCount] = fx;
+  names_put(&__fixture_names, fxName, __initargs->fixtureCount);
   __initargs->fixtureCount++;
-  __addr_multiplier++;
 
-  if (gDebugMode) printf("[DEBUG]: Created Fixture: \"%s\" | Model: \"%d\" | Address: \"%d\"\n", fx.name, 0, address);
+  if (gDebugMode) printf("[DEBUG]: Created Fixture: \"%s\" | Universe: %d | Address: %d-%d\n", fx.name, fx.universe, address, address + footprint - 1);
 
-  return 0;
+  // The handle
+  lua_pushinteger(L, __initargs->fixtureCount);
+  return 1;
 }
 
 static int l_bbmx_group(lua_State* L)
@@ -137,32 +370,40 @@ static int l_bbmx_group(lua_State* L)
 
   size_t nameLen;
   const char* name = luaL_checklstring(L, 1, &nameLen);
-  char* groupName = malloc(nameLen + 1);
-  memcpy(groupName, name, nameLen);
-  groupName[nameLen] = 0;
+  luaL_checktype(L, 2, LUA_TTABLE);
+  if (get_group_by_name(name) != NULL) luaL_error(L, "Group \"%s\" already exists", name);
 
   BBMXSgroup group;
   group.fixtures = malloc(sizeof(BBMXSfixture*) * gMaxFixtures);
-  group.name = groupName;
   group.fixtureCount = 0;
+  group.color.r = 0;
+  group.color.g = 0;
+  group.color.b = 0;
+  group.color.w = 0;
+  group.brightness = 0;
+  group.tilt = 0.0f;
+  group.pan = 0.0f;
 
   lua_pushnil(L);
   int idx = 1;
-  while (lua_next(L, -2) != 0) {
+  while (lua_next(L, 2) != 0) {
     if (!lua_isstring(L, -1))
     {
-      free(group.name);
       free(group.fixtures);
-      luaL_error(L, "At index: '%d': Expected 'string'; got '%s'", idx, lua_typename(L, lua_type(L, -1)));
+      luaL_error(L, "At index: '%d': Expected 'string' or 'integer'; got '%s'", idx, lua_typename(L, lua_type(L, -1)));
     }
 
-    const char* fxName = lua_tostring(L, -1);
-    BBMXSfixture* fx = get_fixture_by_name(fxName);
+    BBMXSfixture* fx = to_fixture(L, -1);
     if (fx == NULL)
     {
-      free(group.name);
       free(group.fixtures);
-      luaL_error(L, "At index: '%d': Can't find fixture named: '%s'", idx, fxName);
+      luaL_error(L, "At index: '%d': Can't find fixture: '%s'", idx, lua_tostring(L, -1));
+    }
+
+    if (group.fixtureCount == gMaxFixtures)
+    {
+      free(group.fixtures);
+      luaL_error(L, "Too many fixtures in group \"%s\"", name);
     }
 
     group.fixtures[group.fixtureCount] = fx;
@@ -172,6 +413,15 @@ static int l_bbmx_group(lua_State* L)
     idx++;
   }
 
+  group.name = malloc(nameLen + 1);
+  memcpy(group.name, name, nameLen);
+  group.name[nameLen] = 0;
+
+  __initargs->groups = realloc(__initargs->groups, sizeof(BBMXSgroup) * (__initargs->groupCount + 1));
+  __initargs->groups[__initargs->groupCount] = group;
+  names_put(&__group_names, group.name, __initargs->groupCount);
+  __initargs->groupCount++;
+
   if (gDebugMode)
   {
     printf("[DEBUG]: Created Group: \"%s\":\n", name);
@@ -181,7 +431,9 @@ static int l_bbmx_group(lua_State* L)
     }
   }
 
-  return 0;
+  // The handle
+  lua_pushinteger(L, __initargs->groupCount);
+  return 1;
 }
 
 // SETUP end
@@ -192,14 +444,37 @@ static int l_bbmx_exit(lua_State* L)
   return 0;
 }
 
+// Packed colors are 0xRRGGBBWW
+static BBMXScolor unpack_color(uint32_t rgbw)
+{
+  BBMXScolor c;
+  c.r = (uint8_t)(rgbw >> 24);
+  c.g = (uint8_t)(rgbw >> 16);
+  c.b = (uint8_t)(rgbw >> 8);
+  c.w = (uint8_t)rgbw;
+  return c;
+}
+
+static void set_packed_color(BBMXSfixture* fx, uint32_t rgbw)
+{
+  fx->color = unpack_color(rgbw);
+  bbmxs_fx_update_color(fx);
+}
+
+static BBMXSfixture* check_fixture_at(lua_State* L, int table, int i)
+{
+  lua_rawgeti(L, table, i);
+  BBMXSfixture* fx = to_fixture(L, -1);
+  if (fx == NULL) luaL_error(L, "At index: '%d': Can't find fixture: '%s'", i, luaL_tolstring(L, -1, NULL));
+  lua_pop(L, 1);
+  return fx;
+}
+
 static int l_bbmx_fx_r(lua_State* L)
 {
-  const char* name = luaL_checkstring(L, 1);
+  BBMXSfixture* fx = check_fixture(L, 1);
   uint8_t c = luaL_checkinteger(L, 2);
 
-  BBMXSfixture* fx = bbmxs_get_fx(name);
-  if (fx == NULL) luaL_error(L, "Can't find fixture named: %s", name);
-
   fx->color.r = c;
 
   bbmxs_fx_update_color(fx);
@@ -209,12 +484,9 @@ static int l_bbmx_fx_r(lua_State* L)
 
 static int l_bbmx_fx_g(lua_State* L)
 {
-  const char* name = luaL_checkstring(L, 1);
+  BBMXSfixture* fx = check_fixture(L, 1);
   uint8_t c = luaL_checkinteger(L, 2);
 
-  BBMXSfixture* fx = bbmxs_get_fx(name);
-  if (fx == NULL) luaL_error(L, "Can't find fixture named: %s", name);
-
   fx->color.g = c;
 
   bbmxs_fx_update_color(fx);
@@ -224,12 +496,9 @@ static int l_bbmx_fx_g(lua_State* L)
 
 static int l_bbmx_fx_b(lua_State* L)
 {
-  const char* name = luaL_checkstring(L, 1);
+  BBMXSfixture* fx = check_fixture(L, 1);
   uint8_t c = luaL_checkinteger(L, 2);
 
-  BBMXSfixture* fx = bbmxs_get_fx(name);
-  if (fx == NULL) luaL_error(L, "Can't find fixture named: %s", name);
-
   fx->color.b = c;
 
   bbmxs_fx_update_color(fx);
@@ -239,12 +508,9 @@ static int l_bbmx_fx_b(lua_State* L)
 
 static int l_bbmx_fx_w(lua_State* L)
 {
-  const char* name = luaL_checkstring(L, 1);
+  BBMXSfixture* fx = check_fixture(L, 1);
   uint8_t c = luaL_checkinteger(L, 2);
 
-  BBMXSfixture* fx = bbmxs_get_fx(name);
-  if (fx == NULL) luaL_error(L, "Can't find fixture named: %s", name);
-
   fx->color.w = c;
 
   bbmxs_fx_update_color(fx);
@@ -254,14 +520,11 @@ static int l_bbmx_fx_w(lua_State* L)
 
 static int l_bbmx_fx_rgb(lua_State* L)
 {
-  const char* name = luaL_checkstring(L, 1);
+  BBMXSfixture* fx = check_fixture(L, 1);
   uint8_t r = luaL_checkinteger(L, 2);
   uint8_t g = luaL_checkinteger(L, 3);
   uint8_t b = luaL_checkinteger(L, 4);
 
-  BBMXSfixture* fx = bbmxs_get_fx(name);
-  if (fx == NULL) luaL_error(L, "Can't find fixture named: %s", name);
-
   fx->color.r = r;
   fx->color.g = g;
   fx->color.b = b;
@@ -273,15 +536,12 @@ static int l_bbmx_fx_rgb(lua_State* L)
 
 static int l_bbmx_fx_rgbw(lua_State* L)
 {
-  const char* name = luaL_checkstring(L, 1);
+  BBMXSfixture* fx = check_fixture(L, 1);
   uint8_t r = luaL_checkinteger(L, 2);
   uint8_t g = luaL_checkinteger(L, 3);
   uint8_t b = luaL_checkinteger(L, 4);
   uint8_t w = luaL_checkinteger(L, 5);
 
-  BBMXSfixture* fx = bbmxs_get_fx(name);
-  if (fx == NULL) luaL_error(L, "Can't find fixture named: %s", name);
-
   fx->color.r = r;
   fx->color.g = g;
   fx->color.b = b;
@@ -294,82 +554,179 @@ static int l_bbmx_fx_rgbw(lua_State* L)
 
 static int l_bbmx_fx_brgt(lua_State* L)
 {
-  const char* name = luaL_checkstring(L, 1);
+  BBMXSfixture* fx = check_fixture(L, 1);
   uint8_t b = luaL_checkinteger(L, 2);
 
-  BBMXSfixture* fx = bbmxs_get_fx(name);
-  if (fx == NULL) luaL_error(L, "Can't find fixture named: %s", name);
-
   fx->brightness = b;
 
-  uint8_t buf[3];
-  buf[0] = 1;
-  buf[1] = fx->model->opts.ch_cfg.ch_brgt;
-  buf[2] = fx->brightness;
-
-  if (!bbmxs_send_command(BBMXS_CMD_DMX_WRITE, buf, sizeof(buf)))
-  {
-    luaL_error(L, "Failed to send brightness data");
-  }
+  bbmxs_fx_write(fx, fx->model->opts.ch_cfg.ch_brgt, fx->brightness);
 
   return 0;
 }
 
 static int l_bbmx_fx_tilt(lua_State* L)
 {
-  const char* name = luaL_checkstring(L, 1);
+  BBMXSfixture* fx = check_fixture(L, 1);
+  float angle = luaL_checknumber(L, 2);
+  float speed = luaL_checknumber(L, 3);
+
+  motion_move_speed(fx, MOTION_TILT, angle, speed);
+
+  return 0;
+}
+
+static int l_bbmx_fx_pan(lua_State* L)
+{
+  BBMXSfixture* fx = check_fixture(L, 1);
   float angle = luaL_checknumber(L, 2);
   float speed = luaL_checknumber(L, 3);
 
-  BBMXSfixture* fx = bbmxs_get_fx(name);
-  if (fx == NULL) luaL_error(L, "Can't find fixture named: %s", name);
+  motion_move_speed(fx, MOTION_PAN, angle, speed);
+
+  return 0;
+}
 
-  fx->tilt = angle;
+static const char* const __curves[] = { "linear", "ease", NULL };
+
+// pan and tilt can be nil to leave that axis alone
+static void move_fixture(lua_State* L, BBMXSfixture* fx, float duration, BBMXScurve curve)
+{
+  if (!lua_isnil(L, 2)) motion_move(fx, MOTION_PAN, luaL_checknumber(L, 2), duration, curve);
+  if (!lua_isnil(L, 3)) motion_move(fx, MOTION_TILT, luaL_checknumber(L, 3), duration, curve);
+}
+
+static int l_bbmx_fx_move(lua_State* L)
+{
+  BBMXSfixture* fx = check_fixture(L, 1);
+  luaL_checkany(L, 2);
+  luaL_checkany(L, 3);
+  float duration = luaL_checknumber(L, 4);
+  BBMXScurve curve = luaL_checkoption(L, 5, "linear", __curves);
 
-  uint8_t buf[8];
-  buf[0] = 1;
-  buf[1] = fx->model->opts.ch_cfg.ch_tilt;
-  buf[2] = (angle / fx->model->opts.max_tilt) * 255;
+  move_fixture(L, fx, duration, curve);
 
-  if (!bbmxs_send_command(BBMXS_CMD_DMX_WRITE, buf, sizeof(buf)))
+  return 0;
+}
+
+static int l_bbmx_fx_path(lua_State* L)
+{
+  BBMXSfixture* fx = check_fixture(L, 1);
+  luaL_checktype(L, 2, LUA_TTABLE);
+  float duration = luaL_checknumber(L, 3);
+  int loop = lua_toboolean(L, 4);
+
+  int count = lua_rawlen(L, 2);
+  if (count < 1 || count > MOTION_MAX_POINTS) luaL_error(L, "Expected 1-%d points; got %d", MOTION_MAX_POINTS, count);
+
+  float pan[MOTION_MAX_POINTS];
+  float tilt[MOTION_MAX_POINTS];
+  for (int i = 0; i < count; i++)
   {
-    luaL_error(L, "Failed to send tilt data");
+    lua_rawgeti(L, 2, i + 1);
+    if (!lua_istable(L, -1)) luaL_error(L, "At index: '%d': Expected '{ pan, tilt }'; got '%s'", i + 1, lua_typename(L, lua_type(L, -1)));
+    lua_rawgeti(L, -1, 1);
+    lua_rawgeti(L, -2, 2);
+    pan[i] = lua_tonumber(L, -2);
+    tilt[i] = lua_tonumber(L, -1);
+    lua_pop(L, 3);
   }
 
+  motion_path(fx, MOTION_PAN, pan, count, duration, loop);
+  motion_path(fx, MOTION_TILT, tilt, count, duration, loop);
+
   return 0;
 }
 
-static int l_bbmx_fx_pan(lua_State* L)
+// The channels only go to the frame buffer, which is sent once per tick,
+// so a batch always ends up in the same frame
+static int l_bbmx_fx_rgbw_batch(lua_State* L)
 {
-  const char* name = luaL_checkstring(L, 1);
-  float angle = luaL_checknumber(L, 2);
-  float speed = luaL_checknumber(L, 3);
+  luaL_checktype(L, 1, LUA_TTABLE);
+  int count = lua_rawlen(L, 1);
 
-  BBMXSfixture* fx = bbmxs_get_fx(name);
-  if (fx == NULL) luaL_error(L, "Can't find fixture named: %s", name);
-
-  fx->pan = angle;
+  if (lua_type(L, 2) == LUA_TSTRING)
+  {
+    // 4 bytes r, g, b, w per fixture, e.g. from string.pack
+    size_t len;
+    const uint8_t* bytes = (const uint8_t*)lua_tolstring(L, 2, &len);
+    if (len < (size_t)count * 4) luaL_error(L, "Expected %d bytes of colors; got %d", count * 4, (int)len);
 
-  uint8_t buf[8];
-  buf[0] = 1;
-  buf[1] = fx->model->opts.ch_cfg.ch_pan;
-  buf[2] = (angle / fx->model->opts.max_pan) * 255;
+    for (int i = 1; i <= count; i++)
+    {
+      BBMXSfixture* fx = check_fixture_at(L, 1, i);
+      const uint8_t* c = &bytes[(i - 1) * 4];
+      set_packed_color(fx, (uint32_t)c[0] << 24 | (uint32_t)c[1] << 16 | (uint32_t)c[2] << 8 | c[3]);
+    }
+  }
+  else if (lua_istable(L, 2))
+  {
+    if ((int)lua_rawlen(L, 2) < count) luaL_error(L, "Expected %d colors; got %d", count, (int)lua_rawlen(L, 2));
 
-  if (!bbmxs_send_command(BBMXS_CMD_DMX_WRITE, buf, sizeof(buf)))
+    for (int i = 1; i <= count; i++)
+    {
+      BBMXSfixture* fx = check_fixture_at(L, 1, i);
+      lua_rawgeti(L, 2, i);
+      set_packed_color(fx, (uint32_t)lua_tointeger(L, -1));
+      lua_pop(L, 1);
+    }
+  }
+  else
   {
-    luaL_error(L, "Failed to send pan data");
+    // The same color for all of them
+    uint32_t rgbw = (uint32_t)luaL_checkinteger(L, 2);
+    for (int i = 1; i <= count; i++)
+    {
+      set_packed_color(check_fixture_at(L, 1, i), rgbw);
+    }
   }
 
   return 0;
 }
 
-static int l_bbmx_fx_reset(lua_State* L)
+// Reads the number field `attr` of the table on top of the stack
+static int get_attr(lua_State* L, const char* attr, lua_Number* value)
 {
-  const char* name = luaL_checkstring(L, 1);
+  int found = lua_getfield(L, -1, attr) != LUA_TNIL;
+  if (found) *value = lua_tonumber(L, -1);
+  lua_pop(L, 1);
+  return found;
+}
 
-  BBMXSfixture* fx = bbmxs_get_fx(name);
-  if (fx == NULL) luaL_error(L, "Can't find fixture named: %s", name);
+static int l_bbmx_fx_batch(lua_State* L)
+{
+  luaL_checktype(L, 1, LUA_TTABLE);
 
+  lua_pushnil(L);
+  while (lua_next(L, 1) != 0)
+  {
+    BBMXSfixture* fx = to_fixture(L, -2);
+    if (fx == NULL) luaL_error(L, "Can't find fixture: '%s'", luaL_tolstring(L, -2, NULL));
+    if (!lua_istable(L, -1)) luaL_error(L, "Fixture '%s': Expected 'table'; got '%s'", fx->name, lua_typename(L, lua_type(L, -1)));
+
+    lua_Number v;
+    int color = 0;
+    if (get_attr(L, "r", &v)) { fx->color.r = v; color = 1; }
+    if (get_attr(L, "g", &v)) { fx->color.g = v; color = 1; }
+    if (get_attr(L, "b", &v)) { fx->color.b = v; color = 1; }
+    if (get_attr(L, "w", &v)) { fx->color.w = v; color = 1; }
+    if (color) bbmxs_fx_update_color(fx);
+
+    if (get_attr(L, "brgt", &v))
+    {
+      fx->brightness = v;
+      bbmxs_fx_write(fx, fx->model->opts.ch_cfg.ch_brgt, fx->brightness);
+    }
+    if (get_attr(L, "tilt", &v)) motion_move(fx, MOTION_TILT, v, 0, MOTION_LINEAR);
+    if (get_attr(L, "pan", &v)) motion_move(fx, MOTION_PAN, v, 0, MOTION_LINEAR);
+
+    lua_pop(L, 1);
+  }
+
+  return 0;
+}
+
+static void reset_fixture(BBMXSfixture* fx)
+{
   fx->color.r = 0;
   fx->color.g = 0;
   fx->color.b = 0;
@@ -377,38 +734,51 @@ static int l_bbmx_fx_reset(lua_State* L)
 
   fx->tilt = 0;
   fx->pan = 0;
+  motion_stop(fx);
 
   bbmxs_fx_update_color(fx);
 
-  uint8_t buf[8];
-  buf[0] = 1;
-  buf[2] = 0;
   if (fx->model->supports_tilt)
   {
-    buf[1] = fx->model->opts.ch_cfg.ch_tilt;
-    if (!bbmxs_send_command(BBMXS_CMD_DMX_WRITE, buf, sizeof(buf)))
-    {
-      luaL_error(L, "Failed to send tilt data");
-    }
+    bbmxs_fx_set_tilt(fx, 0);
   }
 
   if (fx->model->supports_pan)
   {
-    buf[1] = fx->model->opts.ch_cfg.ch_pan;
-    if (!bbmxs_send_command(BBMXS_CMD_DMX_WRITE, buf, sizeof(buf)))
-    {
-      luaL_error(L, "Failed to send pan data");
-    }
+    bbmxs_fx_set_pan(fx, 0);
   }
+}
+
+static int l_bbmx_fx_reset(lua_State* L)
+{
+  BBMXSfixture* fx = check_fixture(L, 1);
+
+  reset_fixture(fx);
 
   return 0;
 }
 
 static int l_bbmx_timed(lua_State* L)
 {
-  const char* name = luaL_checkstring(L, 1);
+  if (__loaded) luaL_error(L, "'bbmx_timed' can only be called on setup");
+
+  const char* name;
+  if (lua_isfunction(L, 1))
+  {
+    name = "<function>";
+    lua_pushvalue(L, 1);
+  }
+  else
+  {
+    name = luaL_checkstring(L, 1);
+    lua_getglobal(L, name);
+    if (!lua_isfunction(L, -1)) luaL_error(L, "'%s' is not a function", name);
+  }
   float t = luaL_checknumber(L, 2);
 
+  // Resolved once here, calling it later is just a registry lookup
+  int ref = luaL_ref(L, LUA_REGISTRYINDEX);
+
   char* nameCopy = malloc(strlen(name) + 1);
   memcpy(nameCopy, name, strlen(name));
   nameCopy[strlen(name)] = 0;
@@ -416,7 +786,8 @@ static int l_bbmx_timed(lua_State* L)
   BBMXStimedfunc timedFunc;
   timedFunc.name = nameCopy;
   timedFunc.t = t;
-  timedFunc.used = 0;
+  timedFunc.ref = ref;
+  timedFunc.order = __initargs->timedFunctionCount;
 
   if (__initargs->timedFunctionCount == 0)
   {
@@ -442,6 +813,7 @@ static int l_bbmx_reset_timer(lua_State* L)
 
 static int l_bbmx_snd_flash(lua_State* L)
 {
+  if (__loaded) luaL_error(L, "'bbmx_snd_flash' can only be called on setup");
   const char* name = luaL_checkstring(L, 1);
   float t = luaL_checknumber(L, 2);
 
@@ -477,6 +849,7 @@ static int l_bbmx_snd_flash(lua_State* L)
 
 static int l_bbmx_snd(lua_State* L)
 {
+  if (__loaded) luaL_error(L, "'bbmx_snd' can only be called on setup");
   const char* path = luaL_checkstring(L, 1);
   char* pathCopy = malloc(strlen(path) + 1);
   memcpy(pathCopy, path, strlen(path));
@@ -484,39 +857,386 @@ static int l_bbmx_snd(lua_State* L)
 
   __initargs->sndFile = pathCopy;
 
-  if (lua_isnumber(L, -1))
+  if (lua_isnumber(L, 2))
   {
-    __initargs->bpm = lua_tonumber(L, -1);
-    __initargs->bpm_resolution = 1;
+    __initargs->bpm = lua_tonumber(L, 2);
   }
 
-  if (lua_isnumber(L, -1))
+  if (lua_isinteger(L, 3))
   {
-    __initargs->bpm_resolution = lua_tonumber(L, -1);
+    int res = lua_tointeger(L, 3);
+    if (res < 1) luaL_error(L, "Invalid beat resolution: %d", res);
+    __initargs->bpm_resolution = res;
   }
 
   return 0;
 }
 
+static BBMXScolor check_color(lua_State* L, int idx)
+{
+  BBMXScolor c;
+  c.r = luaL_checkinteger(L, idx);
+  c.g = luaL_checkinteger(L, idx + 1);
+  c.b = luaL_checkinteger(L, idx + 2);
+  c.w = luaL_checkinteger(L, idx + 3);
+  return c;
+}
+
 static int l_bbmx_fx_flash(lua_State* L)
 {
-  const char* name = luaL_checkstring(L, 1);
+  BBMXSfixture* fx = check_fixture(L, 1);
+  float speed = luaL_checknumber(L, 2);
+  BBMXScolor color = check_color(L, 3);
 
-  BBMXStimedflash timedFlash;
-  timedFlash.speed = luaL_checknumber(L, 2);
-  timedFlash.color.r = luaL_checkinteger(L, 3);
-  timedFlash.color.g = luaL_checkinteger(L, 4);
-  timedFlash.color.b = luaL_checkinteger(L, 5);
-  timedFlash.color.w = luaL_checkinteger(L, 6);
-  timedFlash.name = name;
+  envelope_flash(fx, color, speed);
+
+  return 0;
+}
+
+static int l_bbmx_fx_envelope(lua_State* L)
+{
+  BBMXSfixture* fx = check_fixture(L, 1);
+  float attack = luaL_checknumber(L, 2);
+  float hold = luaL_checknumber(L, 3);
+  float decay = luaL_checknumber(L, 4);
+  BBMXScolor color = check_color(L, 5);
+  int cycles = luaL_optinteger(L, 9, 1);
+  if (cycles < 0) luaL_error(L, "Invalid cycles: %d", cycles);
+
+  envelope_start(fx, color, attack, hold, decay, cycles);
+
+  return 0;
+}
+
+static int l_bbmx_fx_pulse(lua_State* L)
+{
+  BBMXSfixture* fx = check_fixture(L, 1);
+  float period = luaL_checknumber(L, 2);
+  BBMXScolor color = check_color(L, 3);
+  int cycles = luaL_optinteger(L, 7, 0);
+  if (cycles < 0) luaL_error(L, "Invalid cycles: %d", cycles);
+
+  envelope_start(fx, color, period / 2, 0, period / 2, cycles);
+
+  return 0;
+}
+
+static int l_bbmx_fx_stop(lua_State* L)
+{
+  BBMXSfixture* fx = check_fixture(L, 1);
+
+  envelope_stop(fx);
+
+  return 0;
+}
+
+static int l_bbmx_grp_rgb(lua_State* L)
+{
+  BBMXSgroup* grp = check_group(L, 1);
+  grp->color.r = luaL_checkinteger(L, 2);
+  grp->color.g = luaL_checkinteger(L, 3);
+  grp->color.b = luaL_checkinteger(L, 4);
+
+  bbmxs_grp_update_color(grp);
+
+  return 0;
+}
+
+static int l_bbmx_grp_rgbw(lua_State* L)
+{
+  BBMXSgroup* grp = check_group(L, 1);
+  grp->color = check_color(L, 2);
+
+  bbmxs_grp_update_color(grp);
+
+  return 0;
+}
+
+static int l_bbmx_grp_brgt(lua_State* L)
+{
+  BBMXSgroup* grp = check_group(L, 1);
+  uint8_t b = luaL_checkinteger(L, 2);
+
+  bbmxs_grp_set_brightness(grp, b);
+
+  return 0;
+}
+
+static int l_bbmx_grp_tilt(lua_State* L)
+{
+  BBMXSgroup* grp = check_group(L, 1);
+  float angle = luaL_checknumber(L, 2);
+  float speed = luaL_checknumber(L, 3);
+
+  bbmxs_grp_set_tilt(grp, angle, speed);
+
+  return 0;
+}
+
+static int l_bbmx_grp_pan(lua_State* L)
+{
+  BBMXSgroup* grp = check_group(L, 1);
+  float angle = luaL_checknumber(L, 2);
+  float speed = luaL_checknumber(L, 3);
+
+  bbmxs_grp_set_pan(grp, angle, speed);
+
+  return 0;
+}
+
+static int l_bbmx_grp_move(lua_State* L)
+{
+  BBMXSgroup* grp = check_group(L, 1);
+  luaL_checkany(L, 2);
+  luaL_checkany(L, 3);
+  float duration = luaL_checknumber(L, 4);
+  BBMXScurve curve = luaL_checkoption(L, 5, "linear", __curves);
+
+  if (!lua_isnil(L, 2)) grp->pan = luaL_checknumber(L, 2);
+  if (!lua_isnil(L, 3)) grp->tilt = luaL_checknumber(L, 3);
+  for (int i = 0; i < grp->fixtureCount; i++)
+  {
+    move_fixture(L, grp->fixtures[i], duration, curve);
+  }
+
+  return 0;
+}
+
+static int l_bbmx_grp_reset(lua_State* L)
+{
+  BBMXSgroup* grp = check_group(L, 1);
+
+  memset(&grp->color, 0, sizeof(BBMXScolor));
+  grp->tilt = 0;
+  grp->pan = 0;
+
+  for (int i = 0; i < grp->fixtureCount; i++)
+  {
+    reset_fixture(grp->fixtures[i]);
+  }
+
+  return 0;
+}
+
+static int l_bbmx_grp_flash(lua_State* L)
+{
+  BBMXSgroup* grp = check_group(L, 1);
+  float speed = luaL_checknumber(L, 2);
+  BBMXScolor color = check_color(L, 3);
+
+  for (int i = 0; i < grp->fixtureCount; i++)
+  {
+    envelope_flash(grp->fixtures[i], color, speed);
+  }
+
+  return 0;
+}
+
+static int l_bbmx_grp_envelope(lua_State* L)
+{
+  BBMXSgroup* grp = check_group(L, 1);
+  float attack = luaL_checknumber(L, 2);
+  float hold = luaL_checknumber(L, 3);
+  float decay = luaL_checknumber(L, 4);
+  BBMXScolor color = check_color(L, 5);
+  int cycles = luaL_optinteger(L, 9, 1);
+  if (cycles < 0) luaL_error(L, "Invalid cycles: %d", cycles);
+
+  for (int i = 0; i < grp->fixtureCount; i++)
+  {
+    envelope_start(grp->fixtures[i], color, attack, hold, decay, cycles);
+  }
+
+  return 0;
+}
+
+static int l_bbmx_grp_pulse(lua_State* L)
+{
+  BBMXSgroup* grp = check_group(L, 1);
+  float period = luaL_checknumber(L, 2);
+  BBMXScolor color = check_color(L, 3);
+  int cycles = luaL_optinteger(L, 7, 0);
+  if (cycles < 0) luaL_error(L, "Invalid cycles: %d", cycles);
+
+  for (int i = 0; i < grp->fixtureCount; i++)
+  {
+    envelope_start(grp->fixtures[i], color, period / 2, 0, period / 2, cycles);
+  }
+
+  return 0;
+}
+
+static int l_bbmx_grp_stop(lua_State* L)
+{
+  BBMXSgroup* grp = check_group(L, 1);
+
+  for (int i = 0; i < grp->fixtureCount; i++)
+  {
+    envelope_stop(grp->fixtures[i]);
+  }
+
+  return 0;
+}
+
+static const char* const __effect_kinds[] = { "chase", "rainbow", "sine", "strobe", "fan", NULL };
+
+// Reads the fields that are set in the options table at `idx` into `opts`
+static void check_effect_opts(lua_State* L, int idx, BBMXSeffectopts* opts)
+{
+  luaL_checktype(L, idx, LUA_TTABLE);
+  lua_pushvalue(L, idx);
+
+  lua_Number v;
+  if (get_attr(L, "rate", &v)) opts->rate = v;
+  if (get_attr(L, "beats", &v)) opts->beats = v;
+  if (get_attr(L, "spread", &v)) opts->spread = v;
+  if (get_attr(L, "offset", &v)) opts->offset = v;
+  if (get_attr(L, "width", &v)) opts->width = v;
+  if (get_attr(L, "center", &v)) opts->center = v;
+  if (get_attr(L, "size", &v)) opts->size = v;
+  if (opts->rate < 0) luaL_error(L, "Invalid rate: %f", opts->rate);
+  if (opts->beats < 0) luaL_error(L, "Invalid beats: %f", opts->beats);
+  if (opts->width < 0 || opts->width > 1) luaL_error(L, "Invalid width: %f", opts->width);
+
+  if (lua_getfield(L, -1, "axis") != LUA_TNIL)
+  {
+    const char* axis = lua_tostring(L, -1);
+    if (axis == NULL || (strcmp(axis, "pan") != 0 && strcmp(axis, "tilt") != 0)) luaL_error(L, "Invalid axis: %s", luaL_tolstring(L, -1, NULL));
+    opts->tilt = strcmp(axis, "tilt") == 0;
+  }
+  lua_pop(L, 1);
+
+  // A packed 0xRRGGBBWW color or an array of them
+  int type = lua_getfield(L, -1, "palette");
+  if (type == LUA_TNUMBER)
+  {
+    opts->palette[0] = unpack_color(lua_tointeger(L, -1));
+    opts->paletteCount = 1;
+  }
+  else if (type == LUA_TTABLE)
+  {
+    int count = lua_rawlen(L, -1);
+    if (count < 1 || count > EFFECT_MAX_PALETTE) luaL_error(L, "Expected 1-%d palette colors; got %d", EFFECT_MAX_PALETTE, count);
+    for (int i = 0; i < count; i++)
+    {
+      lua_rawgeti(L, -1, i + 1);
+      opts->palette[i] = unpack_color(lua_tointeger(L, -1));
+      lua_pop(L, 1);
+    }
+    opts->paletteCount = count;
+  }
+  else if (type != LUA_TNIL)
+  {
+    luaL_error(L, "palette: Expected 'integer' or 'table'; got '%s'", lua_typename(L, type));
+  }
+  lua_pop(L, 2);
+}
+
+static int l_bbmx_effect(lua_State* L)
+{
+  if (!__loaded) luaL_error(L, "'bbmx_effect' can't be called on setup");
+
+  BBMXSeffectopts opts;
+  effect_defaults(&opts, luaL_checkoption(L, 1, NULL, __effect_kinds));
+  if (!lua_isnoneornil(L, 3)) check_effect_opts(L, 3, &opts);
+
+  int handle;
+  if (lua_istable(L, 2))
+  {
+    // A list of fixtures
+    int count = lua_rawlen(L, 2);
+    BBMXSfixture** fixtures = malloc(sizeof(BBMXSfixture*) * (count > 0 ? count : 1));
+    for (int i = 1; i <= count; i++)
+    {
+      lua_rawgeti(L, 2, i);
+      fixtures[i - 1] = to_fixture(L, -1);
+      lua_pop(L, 1);
+      if (fixtures[i - 1] == NULL)
+      {
+        free(fixtures);
+        luaL_error(L, "At index: '%d': Can't find fixture", i);
+      }
+    }
+    handle = effect_start(fixtures, count, &opts);
+    free(fixtures);
+  }
+  else
+  {
+    BBMXSgroup* grp = check_group(L, 2);
+    handle = effect_start(grp->fixtures, grp->fixtureCount, &opts);
+  }
+
+  if (handle == 0) luaL_error(L, "Failed to start the effect");
+
+  lua_pushinteger(L, handle);
+  return 1;
+}
+
+static int l_bbmx_effect_set(lua_State* L)
+{
+  int handle = luaL_checkinteger(L, 1);
+  BBMXSeffectopts* opts = effect_opts(handle);
+  if (opts == NULL) luaL_error(L, "Invalid effect handle: %d", handle);
+
+  // Checked on a copy, so a bad option doesn't leave the effect half changed
+  BBMXSeffectopts changed = *opts;
+  check_effect_opts(L, 2, &changed);
+  *opts = changed;
+
+  return 0;
+}
+
+static int l_bbmx_effect_stop(lua_State* L)
+{
+  if (lua_isnoneornil(L, 1))
+  {
+    effect_stop_all();
+    return 0;
+  }
+
+  effect_stop(luaL_checkinteger(L, 1));
+
+  return 0;
+}
+
+static int l_bbmx_cue(lua_State* L)
+{
+  if (!__loaded) luaL_error(L, "'bbmx_cue' can't be called on setup");
+  luaL_checktype(L, 1, LUA_TFUNCTION);
 
-  printf("asdhasid: %d\n", luaL_checknumber(L, 2));
+  lua_Integer handle = cue_start(L, lua_gettop(L) - 1);
+  if (handle == 0) return lua_error(L);
 
-  bbmxi_do_flash(timedFlash);
+  lua_pushinteger(L, handle);
+  return 1;
+}
 
+static int l_bbmx_cue_stop(lua_State* L)
+{
+  cue_stop(L, luaL_checkinteger(L, 1));
   return 0;
 }
 
+static int l_wait(lua_State* L)
+{
+  double ms = luaL_checknumber(L, 1);
+  return cue_wait(L, CUE_TIME, cue_now() + ms);
+}
+
+static int l_wait_until(lua_State* L)
+{
+  return cue_wait(L, CUE_TIME, luaL_checknumber(L, 1));
+}
+
+static int l_wait_beat(lua_State* L)
+{
+  double beats = luaL_optnumber(L, 1, 1);
+  luaL_argcheck(L, beats > 0, 1, "Expected more than 0 beats");
+  if (cue_beat() < 0) luaL_error(L, "'wait_beat' needs beats, set a bpm or BBMX_beat with bbmx_snd");
+
+  return cue_wait(L, CUE_BEAT, floor(cue_beat()) + beats);
+}
+
 static int l_lerp(lua_State* L)
 {
   double a = luaL_checknumber(L, 1);
@@ -528,6 +1248,99 @@ static int l_lerp(lua_State* L)
   return 1;
 }
 
+// LAYER start
+// Layer scripts get their own fixture setters. They only write into the
+// layer that is their upvalue and just read the patch, so the script
+// threads share nothing with each other or with the main script.
+
+static BBMXSlayer* layer_of(lua_State* L)
+{
+  return lua_touserdata(L, lua_upvalueindex(1));
+}
+
+static int l_layer_fx_rgb(lua_State* L)
+{
+  BBMXSfixture* fx = check_fixture(L, 1);
+  const BBMXSchannelconfig* ch = &fx->model->opts.ch_cfg;
+  BBMXSlayer* layer = layer_of(L);
+
+  layer_fx_write(layer, fx, ch->ch_red, luaL_checkinteger(L, 2));
+  layer_fx_write(layer, fx, ch->ch_green, luaL_checkinteger(L, 3));
+  layer_fx_write(layer, fx, ch->ch_blue, luaL_checkinteger(L, 4));
+
+  return 0;
+}
+
+static int l_layer_fx_rgbw(lua_State* L)
+{
+  BBMXSfixture* fx = check_fixture(L, 1);
+  const BBMXSchannelconfig* ch = &fx->model->opts.ch_cfg;
+  BBMXSlayer* layer = layer_of(L);
+
+  layer_fx_write(layer, fx, ch->ch_red, luaL_checkinteger(L, 2));
+  layer_fx_write(layer, fx, ch->ch_green, luaL_checkinteger(L, 3));
+  layer_fx_write(layer, fx, ch->ch_blue, luaL_checkinteger(L, 4));
+  layer_fx_write(layer, fx, ch->ch_white, luaL_checkinteger(L, 5));
+
+  return 0;
+}
+
+static int l_layer_fx_brgt(lua_State* L)
+{
+  BBMXSfixture* fx = check_fixture(L, 1);
+  layer_fx_write(layer_of(L), fx, fx->model->opts.ch_cfg.ch_brgt, luaL_checkinteger(L, 2));
+  return 0;
+}
+
+static int l_layer_fx_tilt(lua_State* L)
+{
+  BBMXSfixture* fx = check_fixture(L, 1);
+  layer_fx_tilt(layer_of(L), fx, luaL_checknumber(L, 2));
+  return 0;
+}
+
+static int l_layer_fx_pan(lua_State* L)
+{
+  BBMXSfixture* fx = check_fixture(L, 1);
+  layer_fx_pan(layer_of(L), fx, luaL_checknumber(L, 2));
+  return 0;
+}
+
+static int l_layer_fx_release(lua_State* L)
+{
+  layer_fx_release(layer_of(L), check_fixture(L, 1));
+  return 0;
+}
+
+static int l_layer_clear(lua_State* L)
+{
+  layer_clear(layer_of(L));
+  return 0;
+}
+
+static void set_layer_function(lua_State* L, BBMXSlayer* layer, const char* name, lua_CFunction func)
+{
+  lua_pushlightuserdata(L, layer);
+  lua_pushcclosure(L, func, 1);
+  lua_setglobal(L, name);
+}
+
+void bbmx_lapi_load_layer(lua_State* L, BBMXSlayer* layer)
+{
+  set_layer_function(L, layer, "bbmx_fx_rgb", l_layer_fx_rgb);
+  set_layer_function(L, layer, "bbmx_fx_rgbw", l_layer_fx_rgbw);
+  set_layer_function(L, layer, "bbmx_fx_brgt", l_layer_fx_brgt);
+  set_layer_function(L, layer, "bbmx_fx_tilt", l_layer_fx_tilt);
+  set_layer_function(L, layer, "bbmx_fx_pan", l_layer_fx_pan);
+  set_layer_function(L, layer, "bbmx_fx_release", l_layer_fx_release);
+  set_layer_function(L, layer, "bbmx_layer_clear", l_layer_clear);
+
+  lua_pushcfunction(L, l_lerp);
+  lua_setglobal(L, "lerp");
+}
+
+// LAYER end
+
 int bbmx_lapi_load(lua_State* L, BBMXSinitargs* initargs)
 {
   if (__initargs != NULL)
@@ -535,7 +1348,16 @@ int bbmx_lapi_load(lua_State* L, BBMXSinitargs* initargs)
     printf("Fatal Error (lapi): bbmx_lapi_load was called twice! (somehow?)\n");
     return -1;
   }
+  // A reloaded script sets up again from scratch
   __initargs = initargs;
+  __cur_model = NULL;
+  __cur_universe = 1;
+  __cur_channel_mode = 0;
+  __cur_fx_idx = 0;
+  __next_address = 1;
+  __loaded = 0;
+  names_init(&__fixture_names);
+  names_init(&__group_names);
 
   lua_pushcfunction(L, l_bbmx_using);
   lua_setglobal(L, "bbmx_using");
@@ -543,6 +1365,9 @@ int bbmx_lapi_load(lua_State* L, BBMXSinitargs* initargs)
   lua_pushcfunction(L, l_bbmx_opt);
   lua_setglobal(L, "bbmx_opt");
 
+  lua_pushcfunction(L, l_bbmx_layer);
+  lua_setglobal(L, "bbmx_layer");
+
   lua_pushcfunction(L, l_bbmx_port);
   lua_setglobal(L, "bbmx_port");
 
@@ -585,6 +1410,18 @@ int bbmx_lapi_load(lua_State* L, BBMXSinitargs* initargs)
   lua_pushcfunction(L, l_bbmx_fx_reset);
   lua_setglobal(L, "bbmx_fx_reset");
 
+  lua_pushcfunction(L, l_bbmx_fx_move);
+  lua_setglobal(L, "bbmx_fx_move");
+
+  lua_pushcfunction(L, l_bbmx_fx_path);
+  lua_setglobal(L, "bbmx_fx_path");
+
+  lua_pushcfunction(L, l_bbmx_fx_rgbw_batch);
+  lua_setglobal(L, "bbmx_fx_rgbw_batch");
+
+  lua_pushcfunction(L, l_bbmx_fx_batch);
+  lua_setglobal(L, "bbmx_fx_batch");
+
   lua_pushcfunction(L, l_bbmx_timed);
   lua_setglobal(L, "bbmx_timed");
 
@@ -599,7 +1436,73 @@ int bbmx_lapi_load(lua_State* L, BBMXSinitargs* initargs)
 
   lua_pushcfunction(L, l_bbmx_fx_flash);
   lua_setglobal(L, "bbmx_fx_flash");
+
+  lua_pushcfunction(L, l_bbmx_fx_envelope);
+  lua_setglobal(L, "bbmx_fx_envelope");
+
+  lua_pushcfunction(L, l_bbmx_fx_pulse);
+  lua_setglobal(L, "bbmx_fx_pulse");
+
+  lua_pushcfunction(L, l_bbmx_fx_stop);
+  lua_setglobal(L, "bbmx_fx_stop");
   
+  lua_pushcfunction(L, l_bbmx_grp_rgb);
+  lua_setglobal(L, "bbmx_grp_rgb");
+
+  lua_pushcfunction(L, l_bbmx_grp_rgbw);
+  lua_setglobal(L, "bbmx_grp_rgbw");
+
+  lua_pushcfunction(L, l_bbmx_grp_brgt);
+  lua_setglobal(L, "bbmx_grp_brgt");
+
+  lua_pushcfunction(L, l_bbmx_grp_tilt);
+  lua_setglobal(L, "bbmx_grp_tilt");
+
+  lua_pushcfunction(L, l_bbmx_grp_pan);
+  lua_setglobal(L, "bbmx_grp_pan");
+
+  lua_pushcfunction(L, l_bbmx_grp_move);
+  lua_setglobal(L, "bbmx_grp_move");
+
+  lua_pushcfunction(L, l_bbmx_grp_reset);
+  lua_setglobal(L, "bbmx_grp_reset");
+
+  lua_pushcfunction(L, l_bbmx_grp_flash);
+  lua_setglobal(L, "bbmx_grp_flash");
+
+  lua_pushcfunction(L, l_bbmx_grp_envelope);
+  lua_setglobal(L, "bbmx_grp_envelope");
+
+  lua_pushcfunction(L, l_bbmx_grp_pulse);
+  lua_setglobal(L, "bbmx_grp_pulse");
+
+  lua_pushcfunction(L, l_bbmx_grp_stop);
+  lua_setglobal(L, "bbmx_grp_stop");
+
+  lua_pushcfunction(L, l_bbmx_effect);
+  lua_setglobal(L, "bbmx_effect");
+
+  lua_pushcfunction(L, l_bbmx_effect_set);
+  lua_setglobal(L, "bbmx_effect_set");
+
+  lua_pushcfunction(L, l_bbmx_effect_stop);
+  lua_setglobal(L, "bbmx_effect_stop");
+
+  lua_pushcfunction(L, l_bbmx_cue);
+  lua_setglobal(L, "bbmx_cue");
+
+  lua_pushcfunction(L, l_bbmx_cue_stop);
+  lua_setglobal(L, "bbmx_cue_stop");
+
+  lua_pushcfunction(L, l_wait);
+  lua_setglobal(L, "wait");
+
+  lua_pushcfunction(L, l_wait_until);
+  lua_setglobal(L, "wait_until");
+
+  lua_pushcfunction(L, l_wait_beat);
+  lua_setglobal(L, "wait_beat");
+
   lua_pushcfunction(L, l_lerp);
   lua_setglobal(L, "lerp");
   
@@ -609,4 +1512,7 @@ int bbmx_lapi_load(lua_State* L, BBMXSinitargs* initargs)
 void bbmx_lapi_loaded()
 {
   __loaded = 1;
+  __initargs = NULL; // bbmxs owns them now, or they were freed with a failed reload
+  names_free(&__fixture_names);
+  names_free(&__group_names);
 }
@@ -1,94 +1,478 @@
 #include "bbmxs/bbmxs.h"
+#include "config.h"
 #include "globals.h"
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#ifdef BBMX_WIN32
 #define WIN32_LEAN_AND_MEAN
 #include <Windows.h>
+#else
+#include <dirent.h>
+#include <errno.h>
+#endif
 #include "utils.h"
 #include <json.h>
-#include "bbmxs/serial.h"
+#include "bbmxs/output.h"
+#include "bbmxs/envelope.h"
+#include "bbmxs/effect.h"
+#include "bbmxs/motion.h"
+#include "bbmxs/names.h"
+#include "bbmxs/layer.h"
 
 static BBMXSmodel* __models;
 static int __models_len;
+static BBMXSnames __model_names;
 static BBMXScontext __cur_ctx;
+static BBMXSnames __fx_names;
+static BBMXSnames __group_names;
+
+static int compare_timed_functions(const void* a, const void* b)
+{
+  const BBMXStimedfunc* fa = a;
+  const BBMXStimedfunc* fb = b;
+  if (fa->t != fb->t) return fa->t < fb->t ? -1 : 1;
+  return fa->order - fb->order;
+}
+
+static void index_names()
+{
+  names_init(&__fx_names);
+  for (int i = 0; i < __cur_ctx.fixtureCount; i++)
+  {
+    names_put(&__fx_names, __cur_ctx.fixtures[i].name, i);
+  }
+  names_init(&__group_names);
+  for (int i = 0; i < __cur_ctx.groupCount; i++)
+  {
+    names_put(&__group_names, __cur_ctx.groups[i].name, i);
+  }
+}
 
 static void copy_data_to_context(BBMXSinitargs* initargs)
 {
   __cur_ctx.debugMode = initargs->debugMode;
   __cur_ctx.fixtureCount = initargs->fixtureCount;
   __cur_ctx.fixtures = initargs->fixtures;
+  __cur_ctx.groups = initargs->groups;
+  __cur_ctx.groupCount = initargs->groupCount;
+  index_names();
   __cur_ctx.modelCount = initargs->modelCount;
   __cur_ctx.models = initargs->models;
-  __cur_ctx.port = initargs->port;
+  __cur_ctx.ports = initargs->ports;
+  __cur_ctx.portCount = initargs->portCount;
+  __cur_ctx.protocol = initargs->protocol;
+  __cur_ctx.keyframeInterval = initargs->keyframeInterval;
   __cur_ctx.timedFunctions = initargs->timedFunctions;
   __cur_ctx.timedFunctionCount = initargs->timedFunctionCount;
+  __cur_ctx.timedFunctionNext = 0;
+  if (__cur_ctx.timedFunctionCount > 0)
+  {
+    // Cues only ever come due in time order, so the loop just walks the array
+    qsort(__cur_ctx.timedFunctions, __cur_ctx.timedFunctionCount, sizeof(BBMXStimedfunc), compare_timed_functions);
+  }
   __cur_ctx.timedFlashes = initargs->timedFlashes;
   __cur_ctx.timedFlashCount = initargs->timedFlashCount;
+  __cur_ctx.layers = initargs->layers;
+  __cur_ctx.layerCount = initargs->layerCount;
   __cur_ctx.sndFile = initargs->sndFile;
+  __cur_ctx.sndStream = initargs->sndStream;
+  __cur_ctx.audioBands = initargs->audioBands;
+  __cur_ctx.audioLatency = initargs->audioLatency;
+  __cur_ctx.outputLatency = initargs->outputLatency;
   __cur_ctx.bpm = initargs->bpm;
   __cur_ctx.bpm_resolution = initargs->bpm_resolution;
+  __cur_ctx.beatAnalysis = initargs->beatAnalysis;
   if (__cur_ctx.bpm > 0)
   {
     __cur_ctx.beat_time = 60000 / __cur_ctx.bpm;
   }
 }
 
+// Only universes a fixture is patched into get a buffer
+static void alloc_universes()
+{
+  uint16_t count = 1;
+  for (int i = 0; i < __cur_ctx.fixtureCount; i++)
+  {
+    if (__cur_ctx.fixtures[i].universe > count)
+    {
+      count = __cur_ctx.fixtures[i].universe;
+    }
+  }
+
+  __cur_ctx.universes = calloc(count, sizeof(BBMXSuniverse*));
+  __cur_ctx.universeCount = count;
+  __cur_ctx.output = __cur_ctx.universes;
+
+  for (int i = 0; i < __cur_ctx.fixtureCount; i++)
+  {
+    uint8_t u = __cur_ctx.fixtures[i].universe;
+    if (u >= 1 && __cur_ctx.universes[u - 1] == NULL)
+    {
+      __cur_ctx.universes[u - 1] = calloc(1, sizeof(BBMXSuniverse));
+    }
+  }
+
+  __cur_ctx.patched = malloc(count);
+  __cur_ctx.patchedCount = 0;
+  for (int u = 0; u < count; u++)
+  {
+    if (__cur_ctx.universes[u] != NULL)
+    {
+      __cur_ctx.patched[__cur_ctx.patchedCount++] = u + 1;
+    }
+  }
+
+  if (gDebugMode) printf("[DEBUG]: Allocated %d of %d universes\n", __cur_ctx.patchedCount, count);
+}
+
+static int port_maps(const BBMXSport* port, uint8_t universe)
+{
+  for (int i = 0; i < port->universeCount; i++)
+  {
+    if (port->universes[i] == universe) return 1;
+  }
+  return 0;
+}
+
+// Replaces the universes each port asked for with the patched ones it
+// outputs. The first port without a mapping takes every universe no
+// other port maps, a universe mapped to several ports goes out on all.
+static void assign_ports()
+{
+  int catchAll = -1;
+  for (int p = 0; p < __cur_ctx.portCount; p++)
+  {
+    if (__cur_ctx.ports[p].universeCount == 0)
+    {
+      catchAll = p;
+      break;
+    }
+  }
+
+  uint8_t** assigned = malloc(sizeof(uint8_t*) * __cur_ctx.portCount);
+  uint16_t* assignedCount = calloc(__cur_ctx.portCount, sizeof(uint16_t));
+  for (int p = 0; p < __cur_ctx.portCount; p++)
+  {
+    assigned[p] = malloc(__cur_ctx.patchedCount + 1);
+  }
+
+  for (int i = 0; i < __cur_ctx.patchedCount; i++)
+  {
+    uint8_t u = __cur_ctx.patched[i];
+    int mapped = 0;
+    for (int p = 0; p < __cur_ctx.portCount; p++)
+    {
+      if (port_maps(&__cur_ctx.ports[p], u))
+      {
+        assigned[p][assignedCount[p]++] = u;
+        mapped = 1;
+      }
+    }
+
+    if (mapped) continue;
+
+    if (catchAll < 0)
+    {
+      printf("bbmxs Warning: Universe %d isn't mapped to any port\n", u);
+      continue;
+    }
+    assigned[catchAll][assignedCount[catchAll]++] = u;
+  }
+
+  for (int p = 0; p < __cur_ctx.portCount; p++)
+  {
+    free(__cur_ctx.ports[p].universes);
+    __cur_ctx.ports[p].universes = assigned[p];
+    __cur_ctx.ports[p].universeCount = assignedCount[p];
+  }
+
+  free(assigned);
+  free(assignedCount);
+}
+
 BBMXScontext* bbmxs_init(BBMXSinitargs* initargs)
 {
   copy_data_to_context(initargs);
+  alloc_universes();
+
+  if (__cur_ctx.portCount == 0)
+  {
+    printf("bbmxs Error: No port set! Use bbmx_port in BBMX_setup.\n");
+    return NULL;
+  }
+
+  assign_ports();
 
-  if (!serial_open(__cur_ctx.port))
+  if (!envelope_init(&__cur_ctx))
+  {
+    printf("bbmxs Error: Failed to set up envelopes\n");
+    return NULL;
+  }
+
+  if (!effect_init(&__cur_ctx))
+  {
+    printf("bbmxs Error: Failed to set up effects\n");
+    return NULL;
+  }
+
+  if (!motion_init(&__cur_ctx))
+  {
+    printf("bbmxs Error: Failed to set up motion\n");
+    return NULL;
+  }
+
+  if (!output_start(&__cur_ctx))
   {
-    printf("bbmxs Error: Failed to open COM port: \"%s\"\n", __cur_ctx.port);
     return NULL;
   }
-  if (gDebugMode) printf("[DEBUG]: Opened COM port: \"%s\"\n", __cur_ctx.port);
 
   return &__cur_ctx;
 }
 
-void bbmxs_close()
+static void free_fixtures(BBMXSfixture* fixtures, uint16_t count)
 {
-  serial_close();
+  for (int i = 0; i < count; i++)
+  {
+    free(fixtures[i].name);
+  }
+  free(fixtures);
+}
+
+static void free_groups(BBMXSgroup* groups, uint16_t count)
+{
+  for (int i = 0; i < count; i++)
+  {
+    free(groups[i].name);
+    free(groups[i].fixtures);
+  }
+  free(groups);
+}
+
+static void free_models(BBMXSmodel* models, uint16_t count)
+{
+  for (int i = 0; i < count; i++)
+  {
+    free(models[i].name);
+  }
+  free(models);
+}
+
+static void free_timed(BBMXStimedfunc* functions, size_t functionCount, BBMXStimedflash* flashes, size_t flashCount)
+{
+  for (int i = 0; i < functionCount; i++)
+  {
+    free(functions[i].name);
+  }
+  free(functions);
+
+  for (int i = 0; i < flashCount; i++)
+  {
+    free(flashes[i].name);
+  }
+  free(flashes);
+}
+
+static void free_layers(BBMXSlayerscript* layers, uint8_t count)
+{
+  for (int i = 0; i < count; i++)
+  {
+    free(layers[i].script);
+  }
+  free(layers);
+}
+
+static void free_ports(BBMXSport* ports, uint8_t count)
+{
+  for (int p = 0; p < count; p++)
+  {
+    free(ports[p].name);
+    free(ports[p].universes);
+  }
+  free(ports);
+}
+
+void bbmxs_free_initargs(BBMXSinitargs* initargs)
+{
+  free_fixtures(initargs->fixtures, initargs->fixtureCount);
+  free_groups(initargs->groups, initargs->groupCount);
+  free_models(initargs->models, initargs->modelCount);
+  free_timed(initargs->timedFunctions, initargs->timedFunctionCount, initargs->timedFlashes, initargs->timedFlashCount);
+  free_layers(initargs->layers, initargs->layerCount);
+  free_ports(initargs->ports, initargs->portCount);
+  free(initargs->sndFile);
+}
+
+static int same_ports(const BBMXSinitargs* initargs)
+{
+  if (initargs->portCount != __cur_ctx.portCount) return 0;
+
+  for (int p = 0; p < initargs->portCount; p++)
+  {
+    if (strcmp(initargs->ports[p].name, __cur_ctx.ports[p].name) != 0) return 0;
+    if (initargs->ports[p].baud != __cur_ctx.ports[p].baud) return 0;
+  }
+  return 1;
+}
+
+// Fixtures the old script had keep their state, so the new BBMX_start
+// starts from what is on stage instead of a blackout
+static void carry_over(BBMXSfixture* fixtures, uint16_t fixtureCount, BBMXSgroup* groups, uint16_t groupCount)
+{
+  for (int i = 0; i < fixtureCount; i++)
+  {
+    BBMXSfixture* old = bbmxs_get_fx(fixtures[i].name);
+    if (old == NULL) continue;
+
+    fixtures[i].color = old->color;
+    fixtures[i].brightness = old->brightness;
+    fixtures[i].tilt = old->tilt;
+    fixtures[i].pan = old->pan;
+  }
+
+  for (int i = 0; i < groupCount; i++)
+  {
+    BBMXSgroup* old = bbmxs_get_group(groups[i].name);
+    if (old == NULL) continue;
+
+    groups[i].color = old->color;
+    groups[i].brightness = old->brightness;
+    groups[i].tilt = old->tilt;
+    groups[i].pan = old->pan;
+  }
+}
+
+// Blanks every universe and writes the carried over fixtures back, a
+// removed or repatched fixture doesn't keep its old values
+static void rewrite_universes()
+{
+  for (int i = 0; i < __cur_ctx.patchedCount; i++)
+  {
+    for (int ch = 1; ch <= BBMXS_UNIVERSE_SIZE; ch++)
+    {
+      bbmxs_dmx_write(__cur_ctx.patched[i], ch, 0);
+    }
+  }
 
   for (int i = 0; i < __cur_ctx.fixtureCount; i++)
   {
     BBMXSfixture* fx = &__cur_ctx.fixtures[i];
-    free(fx->name);
+    bbmxs_fx_update_color(fx);
+    bbmxs_fx_write(fx, fx->model->opts.ch_cfg.ch_brgt, fx->brightness);
+    bbmxs_fx_set_tilt(fx, fx->tilt);
+    bbmxs_fx_set_pan(fx, fx->pan);
   }
-  free(__cur_ctx.fixtures);
+}
 
-  for (int i = 0; i < __cur_ctx.modelCount; i++)
+int bbmxs_reload(BBMXSinitargs* initargs)
+{
+  // The output threads only know the universes they were started with
+  for (int i = 0; i < initargs->fixtureCount; i++)
   {
-    BBMXSmodel* fx = &__cur_ctx.models[i];
-    free(fx->name);
+    const BBMXSfixture* fx = &initargs->fixtures[i];
+    if (fx->universe < 1 || fx->universe > __cur_ctx.universeCount || __cur_ctx.universes[fx->universe - 1] == NULL)
+    {
+      printf("bbmxs Error: \"%s\" is in universe %d, which isn't patched yet. Restart to add a universe.\n", fx->name, fx->universe);
+      bbmxs_free_initargs(initargs);
+      return 0;
+    }
   }
-  free(__cur_ctx.models);
-  free(__cur_ctx.port);
 
-  for (int i = 0; i < __cur_ctx.timedFunctionCount; i++)
+  if (!same_ports(initargs))
   {
-    free(__cur_ctx.timedFunctions[i].name);
+    printf("bbmxs Warning: The ports changed, restart to apply that\n");
   }
-
-  if (__cur_ctx.timedFunctions != NULL)
+  if ((initargs->sndFile == NULL) != (__cur_ctx.sndFile == NULL)
+    || (initargs->sndFile != NULL && strcmp(initargs->sndFile, __cur_ctx.sndFile) != 0))
   {
-    free(__cur_ctx.timedFunctions);
+    printf("bbmxs Warning: The sound changed, restart to apply that\n");
   }
 
-  for (int i = 0; i < __cur_ctx.timedFlashCount; i++)
+  carry_over(initargs->fixtures, initargs->fixtureCount, initargs->groups, initargs->groupCount);
+
+  envelope_close();
+  effect_close();
+  motion_close();
+  names_free(&__fx_names);
+  names_free(&__group_names);
+  free_fixtures(__cur_ctx.fixtures, __cur_ctx.fixtureCount);
+  free_groups(__cur_ctx.groups, __cur_ctx.groupCount);
+  free_timed(__cur_ctx.timedFunctions, __cur_ctx.timedFunctionCount, __cur_ctx.timedFlashes, __cur_ctx.timedFlashCount);
+
+  __cur_ctx.fixtures = initargs->fixtures;
+  __cur_ctx.fixtureCount = initargs->fixtureCount;
+  __cur_ctx.groups = initargs->groups;
+  __cur_ctx.groupCount = initargs->groupCount;
+  index_names();
+  __cur_ctx.timedFunctions = initargs->timedFunctions;
+  __cur_ctx.timedFunctionCount = initargs->timedFunctionCount;
+  __cur_ctx.timedFunctionNext = 0;
+  if (__cur_ctx.timedFunctionCount > 0)
   {
-    free(__cur_ctx.timedFlashes[i].name);
+    qsort(__cur_ctx.timedFunctions, __cur_ctx.timedFunctionCount, sizeof(BBMXStimedfunc), compare_timed_functions);
   }
+  __cur_ctx.timedFlashes = initargs->timedFlashes;
+  __cur_ctx.timedFlashCount = initargs->timedFlashCount;
+  free_layers(__cur_ctx.layers, __cur_ctx.layerCount);
+  __cur_ctx.layers = initargs->layers;
+  __cur_ctx.layerCount = initargs->layerCount;
+  __cur_ctx.audioLatency = initargs->audioLatency;
+  __cur_ctx.outputLatency = initargs->outputLatency;
+  __cur_ctx.bpm = initargs->bpm;
+  __cur_ctx.bpm_resolution = initargs->bpm_resolution;
+  __cur_ctx.beat_time = __cur_ctx.bpm > 0 ? 60000 / __cur_ctx.bpm : 0;
+
+  // Ports, sound and models stay the ones from the start
+  free_ports(initargs->ports, initargs->portCount);
+  free_models(initargs->models, initargs->modelCount);
+  free(initargs->sndFile);
+
+  rewrite_universes();
 
-  if (__cur_ctx.timedFlashes != NULL)
+  if (!envelope_init(&__cur_ctx) || !effect_init(&__cur_ctx) || !motion_init(&__cur_ctx))
   {
-    free(__cur_ctx.timedFlashes);
+    printf("bbmxs Error: Failed to set up envelopes, effects or motion\n");
+    return -1;
   }
 
-  if (__cur_ctx.sndFile != NULL)
+  return 1;
+}
+
+void bbmxs_close()
+{
+  output_stop();
+  layer_destroy_all();
+  envelope_close();
+  effect_close();
+  motion_close();
+
+  names_free(&__fx_names);
+  names_free(&__group_names);
+  free_groups(__cur_ctx.groups, __cur_ctx.groupCount);
+  free_fixtures(__cur_ctx.fixtures, __cur_ctx.fixtureCount);
+  free_models(__cur_ctx.models, __cur_ctx.modelCount);
+  free_timed(__cur_ctx.timedFunctions, __cur_ctx.timedFunctionCount, __cur_ctx.timedFlashes, __cur_ctx.timedFlashCount);
+  free_layers(__cur_ctx.layers, __cur_ctx.layerCount);
+  free(__cur_ctx.sndFile);
+
+  free_ports(__cur_ctx.ports, __cur_ctx.portCount);
+  __cur_ctx.ports = NULL;
+  __cur_ctx.portCount = 0;
+
+  if (__cur_ctx.universes != NULL)
   {
-    free(__cur_ctx.sndFile);
+    for (int u = 0; u < __cur_ctx.universeCount; u++)
+    {
+      free(__cur_ctx.universes[u]);
+    }
+    free(__cur_ctx.universes);
+    free(__cur_ctx.patched);
+    __cur_ctx.universes = NULL;
+    __cur_ctx.output = NULL;
+    __cur_ctx.universeCount = 0;
+    __cur_ctx.patched = NULL;
+    __cur_ctx.patchedCount = 0;
   }
 }
 
@@ -113,11 +497,16 @@ static int load_model(char* fileName, json_object* obj, int idx)
 
   json_object* ch_modes_obj = json_object_object_get(obj, "channel_modes");
   int len = json_object_array_length(ch_modes_obj);
+  if (len > 8)
+  {
+    printf("bbmxs Warning: Only the first 8 channel modes are used in: \"%s\"\n", fileName);
+    len = 8;
+  }
   opts.channelModesLen = len;
 
   for (int i = 0; i < len; i++)
   {
-    opts.channelModes[i] = json_object_get_uint64(ch_modes_obj);
+    opts.channelModes[i] = json_object_get_uint64(json_object_array_get_idx(ch_modes_obj, i));
   }
 
   json_object* channels_obj = json_object_object_get(obj, "channels");
@@ -128,11 +517,15 @@ static int load_model(char* fileName, json_object* obj, int idx)
   ch_cfg.ch_white = json_object_get_uint64(json_object_object_get(channels_obj, "white"));
   ch_cfg.ch_tilt = json_object_get_uint64(json_object_object_get(channels_obj, "tilt"));
   ch_cfg.ch_pan = json_object_get_uint64(json_object_object_get(channels_obj, "pan"));
+  ch_cfg.ch_tilt_fine = json_object_get_uint64(json_object_object_get(channels_obj, "tilt_fine"));
+  ch_cfg.ch_pan_fine = json_object_get_uint64(json_object_object_get(channels_obj, "pan_fine"));
   ch_cfg.ch_mtr_spd = json_object_get_uint64(json_object_object_get(channels_obj, "motor_speed"));
   ch_cfg.ch_brgt = json_object_get_uint64(json_object_object_get(channels_obj, "brightness"));
 
   opts.max_tilt = json_object_get_double(json_object_object_get(obj, "max_tilt"));
   opts.max_pan = json_object_get_double(json_object_object_get(obj, "max_pan"));
+  opts.max_speed = json_object_get_double(json_object_object_get(obj, "max_speed"));
+  if (opts.max_speed <= 0) opts.max_speed = BBMXS_DEFAULT_MAX_SPEED;
 
   json_object* supported_obj = json_object_object_get(obj, "supported");
 
@@ -148,6 +541,48 @@ static int load_model(char* fileName, json_object* obj, int idx)
   return 1;
 }
 
+static void load_model_file(const char* dir, const char* name, int* count)
+{
+  if (name[0] == '.' || strcmp(utils_get_file_ext(name), "json") != 0) return;
+  if (*count >= gMaxModels)
+  {
+    printf("bbmxs Warning: Too many models, skipping: \"%s\" (use -n to raise the limit)\n", name);
+    return;
+  }
+
+  char fileName[512];
+  snprintf(fileName, sizeof(fileName), "%s%s", dir, name);
+
+  json_object* obj = json_object_from_file(fileName);
+  if (obj == NULL)
+  {
+    printf("bbmxs Error: Failed to parse json file: \"%s\"\n", fileName);
+    return;
+  }
+
+  if (load_model(fileName, obj, *count))
+  {
+    (*count)++;
+  }
+  else
+  {
+    printf("bbmxs Error: Failed to load model: \"%s\"\n", fileName);
+  }
+
+  json_object_put(obj);
+}
+
+// The first model loaded wins when two share a name
+static void index_models()
+{
+  names_init(&__model_names);
+  for (int i = 0; i < __models_len; i++)
+  {
+    names_put(&__model_names, __models[i].name, i);
+  }
+}
+
+#ifdef BBMX_WIN32
 int bbmxs_load_models()
 {
   HANDLE handle;
@@ -164,115 +599,210 @@ int bbmxs_load_models()
   __models = malloc(sizeof(BBMXSmodel) * gMaxModels);
 
   int i = 0;
-  while (FindNextFile(handle, &findData))
+  do
   {
-    if (findData.cFileName[0] == '.' || strcmp(utils_get_file_ext(findData.cFileName), "json") != 0) continue;
-    char fileName[MAX_PATH] = "models\\";
-    strcat(fileName, findData.cFileName);
+    load_model_file("models\\", findData.cFileName, &i);
+  } while (FindNextFile(handle, &findData));
+  FindClose(handle);
 
-    json_object* obj = json_object_from_file(fileName);
-    if (obj == NULL)
-    {
-      printf("bbmxs Error: Failed to parse json file: \"%s\"\n", fileName);
-      continue;
-    }
+  __models_len = i;
+  index_models();
 
-    if (!load_model(fileName, obj, i))
-    {
-      printf("bbmxs Error: Failed to load model: \"%s\"\n", fileName);
-    }
+  return 1;
+}
+#else
+int bbmxs_load_models()
+{
+  DIR* dir = opendir("models");
+  if (dir == NULL)
+  {
+    printf("bbmxs Error: Unable to search directory 'models' (%s)\n", strerror(errno));
+    return 0;
+  }
 
-    json_object_put(obj);
+  __models = malloc(sizeof(BBMXSmodel) * gMaxModels);
 
-    i++;
+  int i = 0;
+  struct dirent* entry;
+  while ((entry = readdir(dir)) != NULL)
+  {
+    load_model_file("models/", entry->d_name, &i);
   }
+  closedir(dir);
 
-  __models_len = i + 1;
+  __models_len = i;
+  index_models();
 
   return 1;
 }
+#endif
 
 BBMXSmodel* bbmxs_get_model(const char* name)
 {
-  for (int i = 0; i < __models_len; i++)
+  int i = names_get(&__model_names, name);
+  return i >= 0 ? &__models[i] : NULL;
+}
+
+// Number of DMX channels a fixture of this model occupies
+uint16_t bbmxs_model_footprint(const BBMXSmodel* model, uint8_t channelMode)
+{
+  if (channelMode > 0) return channelMode;
+  if (model == NULL) return 1;
+  if (model->opts.channelModesLen > 0) return model->opts.channelModes[0];
+
+  const BBMXSchannelconfig* cfg = &model->opts.ch_cfg;
+  DMXChannel channels[] = { cfg->ch_red, cfg->ch_green, cfg->ch_blue, cfg->ch_white, cfg->ch_tilt, cfg->ch_pan, cfg->ch_tilt_fine, cfg->ch_pan_fine, cfg->ch_mtr_spd, cfg->ch_brgt };
+
+  uint16_t footprint = 1;
+  for (int i = 0; i < 10; i++)
   {
-    BBMXSmodel* model = &__models[i];
-    if (strcmp(model->name, name) == 0)
-    {
-      return model;
-    }
+    if (channels[i] > footprint) footprint = channels[i];
   }
 
-  return NULL;
+  return footprint;
 }
 
 BBMXSfixture* bbmxs_get_fx(const char* name)
 {
-  for (int i = 0; i < __cur_ctx.fixtureCount; i++)
+  int i = names_get(&__fx_names, name);
+  return i >= 0 ? &__cur_ctx.fixtures[i] : NULL;
+}
+
+void bbmxs_fx_update_color(BBMXSfixture* fx)
+{
+  bbmxs_fx_write(fx, fx->model->opts.ch_cfg.ch_red, fx->color.r);
+  bbmxs_fx_write(fx, fx->model->opts.ch_cfg.ch_green, fx->color.g);
+  bbmxs_fx_write(fx, fx->model->opts.ch_cfg.ch_blue, fx->color.b);
+  bbmxs_fx_write(fx, fx->model->opts.ch_cfg.ch_white, fx->color.w);
+}
+
+void bbmxs_fx_write(BBMXSfixture* fx, DMXChannel channel, uint8_t value)
+{
+  // channel 0 means the model doesn't have that channel
+  if (channel == 0) return;
+
+  bbmxs_dmx_write(fx->universe, fx->address + channel - 1, value);
+}
+
+uint16_t bbmxs_angle_to_dmx(float angle, float max, BBMXSbool fine)
+{
+  float f = max > 0 ? angle / max : 0;
+  f = f < 0 ? 0 : f > 1 ? 1 : f;
+  return fine ? (uint16_t)(f * 65535 + 0.5f) : (uint16_t)(f * 255);
+}
+
+// Writes `angle` out of 0-max as 8 bit, or 16 bit when there's a fine channel
+static void write_angle(BBMXSfixture* fx, DMXChannel coarse, DMXChannel fine, float angle, float max)
+{
+  uint16_t value = bbmxs_angle_to_dmx(angle, max, fine != 0);
+  if (fine == 0)
   {
-    BBMXSfixture* fx = &__cur_ctx.fixtures[i];
-    if (strcmp(fx->name, name) == 0)
-    {
-      return fx;
-    }
+    bbmxs_fx_write(fx, coarse, value);
+    return;
   }
 
-  return NULL;
+  bbmxs_fx_write(fx, coarse, value >> 8);
+  bbmxs_fx_write(fx, fine, value & 0xFF);
 }
 
-void bbmxs_fx_update_color(BBMXSfixture* fx)
+void bbmxs_fx_set_tilt(BBMXSfixture* fx, float angle)
 {
-  char buf[9];
-  buf[0] = 4; // number of writes in this command
-  buf[1] = fx->model->opts.ch_cfg.ch_red;
-  buf[2] = fx->color.r;
-  buf[3] = fx->model->opts.ch_cfg.ch_green;
-  buf[4] = fx->color.g;
-  buf[5] = fx->model->opts.ch_cfg.ch_blue;
-  buf[6] = fx->color.b;
-  buf[7] = fx->model->opts.ch_cfg.ch_white;
-  buf[8] = fx->color.w;
+  const BBMXSmodelopts* opts = &fx->model->opts;
+  fx->tilt = angle;
+  write_angle(fx, opts->ch_cfg.ch_tilt, opts->ch_cfg.ch_tilt_fine, angle, opts->max_tilt);
+}
 
-  bbmxs_send_command(BBMXS_CMD_DMX_WRITE, buf, sizeof(buf));
+void bbmxs_fx_set_pan(BBMXSfixture* fx, float angle)
+{
+  const BBMXSmodelopts* opts = &fx->model->opts;
+  fx->pan = angle;
+  write_angle(fx, opts->ch_cfg.ch_pan, opts->ch_cfg.ch_pan_fine, angle, opts->max_pan);
 }
 
-void __read()
+BBMXSgroup* bbmxs_get_group(const char* name)
 {
-  uint8_t buf[64];
-  ZeroMemory(buf, sizeof(buf));
-  serial_read(buf, sizeof(buf));
-  buf[63] = 0;
+  int i = names_get(&__group_names, name);
+  return i >= 0 ? &__cur_ctx.groups[i] : NULL;
+}
 
-  printf("Read: \"%s\"\n", buf);
+void bbmxs_grp_update_color(BBMXSgroup* grp)
+{
+  for (int i = 0; i < grp->fixtureCount; i++)
+  {
+    BBMXSfixture* fx = grp->fixtures[i];
+    fx->color = grp->color;
+    bbmxs_fx_update_color(fx);
+  }
 }
 
-int bbmxs_send_command(BBMXScmd cmd, void* data, size_t size)
+void bbmxs_grp_set_brightness(BBMXSgroup* grp, uint8_t brightness)
 {
-  switch (cmd)
+  grp->brightness = brightness;
+  for (int i = 0; i < grp->fixtureCount; i++)
   {
-    case BBMXS_CMD_DMX_WRITE:
-    {
-      uint8_t* _data = (uint8_t*)data;
-      uint8_t buf[64];
-      buf[0] = 1;
-      buf[1] = size + 1;
-      buf[2] = BBMXS_CMD_DMX_WRITE;
-      memcpy(&buf[3], _data, size);
-      serial_write(buf, size + 3);
-    }
+    BBMXSfixture* fx = grp->fixtures[i];
+    fx->brightness = brightness;
+    bbmxs_fx_write(fx, fx->model->opts.ch_cfg.ch_brgt, brightness);
   }
+}
 
-  //__read();
-  uint8_t receivedCmd = -1;
-  serial_read(&receivedCmd, sizeof(receivedCmd));
+void bbmxs_grp_set_tilt(BBMXSgroup* grp, float angle, float speed)
+{
+  grp->tilt = angle;
+  for (int i = 0; i < grp->fixtureCount; i++)
+  {
+    motion_move_speed(grp->fixtures[i], MOTION_TILT, angle, speed);
+  }
+}
 
-  if (receivedCmd != cmd)
+void bbmxs_grp_set_pan(BBMXSgroup* grp, float angle, float speed)
+{
+  grp->pan = angle;
+  for (int i = 0; i < grp->fixtureCount; i++)
   {
-    printf("bbmxs Warning: Received command is not the sent command!\n");
-    return 1;
+    motion_move_speed(grp->fixtures[i], MOTION_PAN, angle, speed);
   }
+}
 
-  return 1;
+void bbmxs_dmx_write(uint8_t universe, uint16_t channel, uint8_t value)
+{
+  if (universe < 1 || universe > __cur_ctx.universeCount) return;
+  if (channel < 1 || channel > BBMXS_UNIVERSE_SIZE) return;
+
+  BBMXSuniverse* uv = __cur_ctx.universes[universe - 1];
+  if (uv == NULL) return;
+  uint16_t slot = channel - 1;
+
+  if (uv->slots[slot] == value) return;
+  uv->slots[slot] = value;
+  uv->changed = 1;
+}
+
+int bbmxs_flush()
+{
+  int changed = 0;
+  for (int u = 0; u < __cur_ctx.universeCount; u++)
+  {
+    BBMXSuniverse* uv = __cur_ctx.universes[u];
+    if (uv == NULL || !uv->changed) continue;
+
+    uv->changed = 0;
+    changed = 1;
+  }
+
+  // The layers change on their own threads, so they are merged every tick
+  if (layer_merge(&__cur_ctx))
+  {
+    changed = 1;
+  }
+
+  // The output threads do the I/O, so this never blocks
+  if (changed)
+  {
+    output_submit(&__cur_ctx);
+  }
+
+  return output_ok();
 }
 
 BBMXScontext* bbmxs_get_cur_ctx()
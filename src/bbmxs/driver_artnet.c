@@ -0,0 +1,133 @@
+#include "bbmxs/driver.h"
+#include "bbmxs/udp.h"
+#include "globals.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define ARTNET_PORT 6454
+#define ARTNET_OP_DMX 0x5000
+#define ARTNET_VERSION 14
+#define ARTNET_HEADER_SIZE 18
+#define ARTNET_PACKET_SIZE (ARTNET_HEADER_SIZE + BBMXS_UNIVERSE_SIZE)
+
+typedef struct
+{
+  BBMXSudp* udp;
+  BBMXSudpaddr addr;
+  uint16_t universeCount;
+  const uint8_t* universes; // universe number per frame block
+  uint8_t* sent;
+  uint8_t* packets; // one prebuilt ArtDmx packet per universe
+  uint8_t* sequence;
+  BBMXSudppacket* batch;
+} ArtnetState;
+
+static void build_header(uint8_t* p, uint16_t universe)
+{
+  // bbmx universe 1 is Art-Net port-address 0
+  uint16_t portAddress = universe - 1;
+
+  memcpy(p, "Art-Net\0", 8);
+  p[8] = ARTNET_OP_DMX & 0xFF; // OpCode is little endian
+  p[9] = ARTNET_OP_DMX >> 8;
+  p[10] = 0;
+  p[11] = ARTNET_VERSION;
+  p[12] = 0; // sequence
+  p[13] = 0; // physical
+  p[14] = portAddress & 0xFF; // SubUni
+  p[15] = (portAddress >> 8) & 0x7F; // Net
+  p[16] = BBMXS_UNIVERSE_SIZE >> 8;
+  p[17] = BBMXS_UNIVERSE_SIZE & 0xFF;
+}
+
+static void artnet_close(void* data)
+{
+  ArtnetState* state = data;
+
+  udp_close(state->udp);
+  free(state->sent);
+  free(state->packets);
+  free(state->sequence);
+  free(state->batch);
+  free(state);
+}
+
+static void* artnet_open(const BBMXSport* port, const char* target, const BBMXScontext* ctx)
+{
+  // Without a host ArtDmx goes out as a limited broadcast
+  const char* host = target[0] != 0 ? target : "255.255.255.255";
+
+  ArtnetState* state = calloc(1, sizeof(ArtnetState));
+  state->universeCount = port->universeCount;
+  state->universes = port->universes;
+  state->sent = calloc((size_t)port->universeCount * BBMXS_UNIVERSE_SIZE, 1);
+  state->packets = calloc((size_t)port->universeCount * ARTNET_PACKET_SIZE, 1);
+  state->sequence = calloc(port->universeCount, 1);
+  state->batch = calloc(port->universeCount, sizeof(BBMXSudppacket));
+
+  state->udp = udp_open();
+  if (state->udp == NULL)
+  {
+    printf("bbmxs Error: Failed to open Art-Net socket\n");
+    artnet_close(state);
+    return NULL;
+  }
+
+  if (!udp_resolve(host, ARTNET_PORT, &state->addr))
+  {
+    printf("bbmxs Error: Can't resolve Art-Net host: \"%s\"\n", host);
+    artnet_close(state);
+    return NULL;
+  }
+
+  for (int u = 0; u < state->universeCount; u++)
+  {
+    build_header(&state->packets[(size_t)u * ARTNET_PACKET_SIZE], state->universes[u]);
+  }
+
+  if (gDebugMode) printf("[DEBUG]: Sending Art-Net to \"%s\" (%d universes)\n", host, state->universeCount);
+
+  return state;
+}
+
+static int artnet_send(void* data, const uint8_t* frame, uint16_t universeCount, int keyframe, BBMXSoutputstats* stats)
+{
+  ArtnetState* state = data;
+
+  int count = 0;
+  for (int u = 0; u < universeCount && u < state->universeCount; u++)
+  {
+    const uint8_t* slots = &frame[(size_t)u * BBMXS_UNIVERSE_SIZE];
+    uint8_t* sent = &state->sent[(size_t)u * BBMXS_UNIVERSE_SIZE];
+    if (!keyframe && memcmp(slots, sent, BBMXS_UNIVERSE_SIZE) == 0) continue;
+
+    // 0 means "no sequencing" in Art-Net, so count 1-255
+    state->sequence[u] = state->sequence[u] == 0xFF ? 1 : state->sequence[u] + 1;
+
+    uint8_t* packet = &state->packets[(size_t)u * ARTNET_PACKET_SIZE];
+    packet[12] = state->sequence[u];
+    memcpy(&packet[ARTNET_HEADER_SIZE], slots, BBMXS_UNIVERSE_SIZE);
+    memcpy(sent, slots, BBMXS_UNIVERSE_SIZE);
+
+    state->batch[count].data = packet;
+    state->batch[count].len = ARTNET_PACKET_SIZE;
+    state->batch[count].addr = &state->addr;
+    count++;
+  }
+
+  if (count == 0) return 1;
+
+  int sent = udp_send_batch(state->udp, state->batch, count);
+  stats->bytesSent += (unsigned long long)sent * ARTNET_PACKET_SIZE;
+
+  return sent == count;
+}
+
+const BBMXSdriver bbmxs_artnet_driver = {
+  "artnet",
+  artnet_open,
+  artnet_close,
+  artnet_send,
+  NULL
+};
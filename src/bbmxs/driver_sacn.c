@@ -0,0 +1,191 @@
+#include "bbmxs/driver.h"
+#include "bbmxs/thread.h"
+#include "bbmxs/udp.h"
+#include "globals.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+// ANSI E1.31 (sACN) data packet with a full 512 slot universe
+#define SACN_PORT 5568
+#define SACN_PACKET_SIZE 638
+#define SACN_DATA_OFFSET 126
+#define SACN_SEQUENCE_OFFSET 111
+#define SACN_PRIORITY 100
+
+typedef struct
+{
+  BBMXSudp* udp;
+  BBMXSudpaddr* addrs; // per universe, multicast unless a host was given
+  uint16_t universeCount;
+  const uint8_t* universes; // universe number per frame block
+  uint8_t* sent;
+  uint8_t* packets; // one prebuilt data packet per universe
+  uint8_t* sequence;
+  BBMXSudppacket* batch;
+} SacnState;
+
+static void put16(uint8_t* p, uint16_t v)
+{
+  p[0] = v >> 8;
+  p[1] = v & 0xFF;
+}
+
+static void put32(uint8_t* p, uint32_t v)
+{
+  p[0] = v >> 24;
+  p[1] = (v >> 16) & 0xFF;
+  p[2] = (v >> 8) & 0xFF;
+  p[3] = v & 0xFF;
+}
+
+static void build_packet(uint8_t* p, const uint8_t* cid, uint16_t universe)
+{
+  memset(p, 0, SACN_PACKET_SIZE);
+
+  // Root layer
+  put16(&p[0], 0x0010);
+  put16(&p[2], 0x0000);
+  memcpy(&p[4], "ASC-E1.17\0\0\0", 12);
+  put16(&p[16], 0x7000 | (SACN_PACKET_SIZE - 16));
+  put32(&p[18], 0x00000004);
+  memcpy(&p[22], cid, 16);
+
+  // Framing layer
+  put16(&p[38], 0x7000 | (SACN_PACKET_SIZE - 38));
+  put32(&p[40], 0x00000002);
+  strcpy((char*)&p[44], "bbmx");
+  p[108] = SACN_PRIORITY;
+  put16(&p[109], 0); // no synchronization
+  p[SACN_SEQUENCE_OFFSET] = 0;
+  p[112] = 0; // options
+  put16(&p[113], universe);
+
+  // DMP layer
+  put16(&p[115], 0x7000 | (SACN_PACKET_SIZE - 115));
+  p[117] = 0x02;
+  p[118] = 0xA1;
+  put16(&p[119], 0x0000);
+  put16(&p[121], 0x0001);
+  put16(&p[123], 1 + BBMXS_UNIVERSE_SIZE);
+  p[125] = 0; // DMX start code
+}
+
+static void sacn_close(void* data)
+{
+  SacnState* state = data;
+
+  udp_close(state->udp);
+  free(state->addrs);
+  free(state->sent);
+  free(state->packets);
+  free(state->sequence);
+  free(state->batch);
+  free(state);
+}
+
+// splitmix64
+static uint64_t next_random(uint64_t* state)
+{
+  uint64_t z = (*state += 0x9E3779B97F4A7C15ULL);
+  z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+  z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+  return z ^ (z >> 31);
+}
+
+static void* sacn_open(const BBMXSport* port, const char* target, const BBMXScontext* ctx)
+{
+  SacnState* state = calloc(1, sizeof(SacnState));
+  state->universeCount = port->universeCount;
+  state->universes = port->universes;
+  state->addrs = calloc(port->universeCount, sizeof(BBMXSudpaddr));
+  state->sent = calloc((size_t)port->universeCount * BBMXS_UNIVERSE_SIZE, 1);
+  state->packets = calloc((size_t)port->universeCount * SACN_PACKET_SIZE, 1);
+  state->sequence = calloc(port->universeCount, 1);
+  state->batch = calloc(port->universeCount, sizeof(BBMXSudppacket));
+
+  state->udp = udp_open();
+  if (state->udp == NULL)
+  {
+    printf("bbmxs Error: Failed to open sACN socket\n");
+    sacn_close(state);
+    return NULL;
+  }
+
+  for (int u = 0; u < state->universeCount; u++)
+  {
+    uint16_t universe = state->universes[u];
+    if (target[0] != 0)
+    {
+      if (!udp_resolve(target, SACN_PORT, &state->addrs[u]))
+      {
+        printf("bbmxs Error: Can't resolve sACN host: \"%s\"\n", target);
+        sacn_close(state);
+        return NULL;
+      }
+    }
+    else
+    {
+      // 239.255.<universe hi>.<universe lo>
+      udp_addr_ipv4(0xEFFF0000 | universe, SACN_PORT, &state->addrs[u]);
+    }
+  }
+
+  // The CID only has to be unique per source, random is good enough.
+  // A local generator, srand would reseed math.random of the script.
+  uint8_t cid[16];
+  uint64_t seed = ((uint64_t)time(NULL) << 32) ^ thread_ticks_ms() ^ (uint64_t)(size_t)state;
+  for (int i = 0; i < 16; i += 8)
+  {
+    uint64_t bits = next_random(&seed);
+    memcpy(&cid[i], &bits, 8);
+  }
+
+  for (int u = 0; u < state->universeCount; u++)
+  {
+    build_packet(&state->packets[(size_t)u * SACN_PACKET_SIZE], cid, state->universes[u]);
+  }
+
+  if (gDebugMode) printf("[DEBUG]: Sending sACN to \"%s\" (%d universes)\n", target[0] != 0 ? target : "multicast", state->universeCount);
+
+  return state;
+}
+
+static int sacn_send(void* data, const uint8_t* frame, uint16_t universeCount, int keyframe, BBMXSoutputstats* stats)
+{
+  SacnState* state = data;
+
+  int count = 0;
+  for (int u = 0; u < universeCount && u < state->universeCount; u++)
+  {
+    const uint8_t* slots = &frame[(size_t)u * BBMXS_UNIVERSE_SIZE];
+    uint8_t* sent = &state->sent[(size_t)u * BBMXS_UNIVERSE_SIZE];
+    if (!keyframe && memcmp(slots, sent, BBMXS_UNIVERSE_SIZE) == 0) continue;
+
+    uint8_t* packet = &state->packets[(size_t)u * SACN_PACKET_SIZE];
+    packet[SACN_SEQUENCE_OFFSET] = state->sequence[u]++;
+    memcpy(&packet[SACN_DATA_OFFSET], slots, BBMXS_UNIVERSE_SIZE);
+    memcpy(sent, slots, BBMXS_UNIVERSE_SIZE);
+
+    state->batch[count].data = packet;
+    state->batch[count].len = SACN_PACKET_SIZE;
+    state->batch[count].addr = &state->addrs[u];
+    count++;
+  }
+
+  if (count == 0) return 1;
+
+  int sent = udp_send_batch(state->udp, state->batch, count);
+  stats->bytesSent += (unsigned long long)sent * SACN_PACKET_SIZE;
+
+  return sent == count;
+}
+
+const BBMXSdriver bbmxs_sacn_driver = {
+  "sacn",
+  sacn_open,
+  sacn_close,
+  sacn_send,
+  NULL
+};
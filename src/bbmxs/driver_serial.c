@@ -0,0 +1,379 @@
+#include "bbmxs/driver.h"
+#include "bbmxs/serial.h"
+#include "bbmxs/transport.h"
+#include "bbmxs/proto.h"
+#include "globals.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+typedef struct
+{
+  BBMXSserial* serial;
+  BBMXStransport* transport; // v2 only
+  uint8_t protocol;
+  uint16_t universeCount;
+  const uint8_t* universes; // universe number per frame block
+  size_t frameSize;
+  uint8_t* sent; // what the controller has once everything in flight is acked
+  uint8_t* acked; // what the controller confirmed
+} SerialState;
+
+static int send_command(SerialState* state, BBMXScmd cmd, void* data, size_t size)
+{
+  if (state->protocol == BBMXS_PROTOCOL_V2)
+  {
+    return transport_send(state->transport, cmd, data, size);
+  }
+
+  if (size > BBMXS_PACKET_SIZE - 3)
+  {
+    printf("bbmxs Warning: Command 0x%02X is too large for protocol v1 (%zu bytes)\n", cmd, size);
+    return 0;
+  }
+
+  switch (cmd)
+  {
+    case BBMXS_CMD_DMX_WRITE:
+    {
+      uint8_t* _data = (uint8_t*)data;
+      uint8_t buf[BBMXS_PACKET_SIZE];
+      buf[0] = 1;
+      buf[1] = size + 1;
+      buf[2] = BBMXS_CMD_DMX_WRITE;
+      memcpy(&buf[3], _data, size);
+      if (serial_write(state->serial, buf, size + 3) < 0) return 0;
+      break;
+    }
+    default:
+    {
+      printf("bbmxs Warning: Command 0x%02X isn't supported by protocol v1\n", cmd);
+      return 0;
+    }
+  }
+
+  uint8_t receivedCmd = -1;
+  serial_read(state->serial, &receivedCmd, sizeof(receivedCmd), 1000);
+
+  // No echo or a wrong one, the values weren't taken and are sent again
+  if (receivedCmd != cmd)
+  {
+    printf("bbmxs Warning: Received command is not the sent command!\n");
+    return 0;
+  }
+
+  return 1;
+}
+
+static int send_frame(SerialState* state, uint8_t universe, const uint8_t* slots)
+{
+  uint8_t buf[1 + BBMXS_UNIVERSE_SIZE];
+  buf[0] = universe;
+  memcpy(&buf[1], slots, BBMXS_UNIVERSE_SIZE);
+
+  return send_command(state, BBMXS_CMD_DMX_FRAME, buf, sizeof(buf));
+}
+
+// [count, (channel, value) * count] has to fit behind the 3 byte header
+#define MAX_WRITES ((BBMXS_PACKET_SIZE - 3 - 1) / 2)
+
+static int send_writes(SerialState* state, uint8_t* buf, const uint16_t* channels, int writes, const uint8_t* slots, uint8_t* sent)
+{
+  buf[0] = writes;
+  if (!send_command(state, BBMXS_CMD_DMX_WRITE, buf, 1 + writes * 2)) return 0;
+
+  for (int i = 0; i < writes; i++)
+  {
+    sent[channels[i]] = slots[channels[i]];
+  }
+
+  return 1;
+}
+
+static int send_universe_v1(SerialState* state, const uint8_t* slots, uint8_t* sent)
+{
+  uint8_t buf[BBMXS_PACKET_SIZE];
+  uint16_t channels[MAX_WRITES];
+  int writes = 0;
+
+  // the v1 wire format only carries 8-bit channel numbers
+  for (uint16_t slot = 0; slot < 0xFF; slot++)
+  {
+    if (slots[slot] == sent[slot]) continue;
+
+    buf[1 + writes * 2] = slot + 1;
+    buf[2 + writes * 2] = slots[slot];
+    channels[writes] = slot;
+    writes++;
+
+    if (writes == MAX_WRITES)
+    {
+      if (!send_writes(state, buf, channels, writes, slots, sent)) return 0;
+      writes = 0;
+    }
+  }
+
+  if (writes > 0)
+  {
+    return send_writes(state, buf, channels, writes, slots, sent);
+  }
+
+  return 1;
+}
+
+// Splitting a run costs a 3 byte run header, so short unchanged gaps
+// are cheaper to send along than to skip
+#define RUN_GAP 3
+#define RUN_MAX 0xFF
+#define MAX_RUNS BBMXS_UNIVERSE_SIZE
+
+typedef struct
+{
+  uint16_t start;
+  uint16_t count;
+} Run;
+
+static void apply_runs(uint8_t* dst, const uint8_t* payload, size_t size)
+{
+  size_t i = 1;
+  while (i + 3 <= size)
+  {
+    uint16_t start = (payload[i] << 8) | payload[i + 1];
+    uint8_t count = payload[i + 2];
+    i += 3;
+    if (start < 1 || start - 1 + count > BBMXS_UNIVERSE_SIZE || i + count > size) return;
+
+    memcpy(&dst[start - 1], &payload[i], count);
+    i += count;
+  }
+}
+
+static int block_of(const SerialState* state, uint8_t universe)
+{
+  for (int i = 0; i < state->universeCount; i++)
+  {
+    if (state->universes[i] == universe) return i;
+  }
+  return -1;
+}
+
+// Keeps the acked copy in sync with what the controller confirmed,
+// FRAME and DELTA are the only DMX commands v2 sends
+static void on_ack(void* user, uint8_t cmd, const uint8_t* payload, size_t size)
+{
+  SerialState* state = user;
+  if (size < 1) return;
+
+  int block = block_of(state, payload[0]);
+  if (block < 0) return;
+  uint8_t* dst = &state->acked[(size_t)block * BBMXS_UNIVERSE_SIZE];
+
+  switch (cmd)
+  {
+    case BBMXS_CMD_DMX_FRAME:
+    {
+      if (size == 1 + BBMXS_UNIVERSE_SIZE) memcpy(dst, &payload[1], BBMXS_UNIVERSE_SIZE);
+      break;
+    }
+    case BBMXS_CMD_DMX_DELTA:
+    {
+      apply_runs(dst, payload, size);
+      break;
+    }
+  }
+}
+
+static int find_runs(const uint8_t* slots, const uint8_t* sent, Run* runs)
+{
+  int count = 0;
+  int slot = 0;
+  while (slot < BBMXS_UNIVERSE_SIZE)
+  {
+    if (slots[slot] == sent[slot])
+    {
+      slot++;
+      continue;
+    }
+
+    int start = slot;
+    int end = slot;
+    for (int i = slot + 1; i < BBMXS_UNIVERSE_SIZE && i - start < RUN_MAX; i++)
+    {
+      if (slots[i] != sent[i]) end = i;
+      else if (i - end > RUN_GAP) break;
+    }
+
+    runs[count].start = start;
+    runs[count].count = end - start + 1;
+    count++;
+    slot = end + 1;
+  }
+
+  return count;
+}
+
+static int send_keyframe(SerialState* state, uint8_t universe, const uint8_t* slots, uint8_t* sent, BBMXSoutputstats* stats)
+{
+  if (!send_frame(state, universe, slots)) return 0;
+
+  memcpy(sent, slots, BBMXS_UNIVERSE_SIZE);
+  stats->bytesSent += 1 + BBMXS_UNIVERSE_SIZE;
+  return 1;
+}
+
+// Only the runs that differ from what the controller will have go out,
+// packed into as few DELTA commands as possible
+static int send_universe_v2(SerialState* state, uint8_t universe, const uint8_t* slots, uint8_t* sent, BBMXSoutputstats* stats)
+{
+  Run runs[MAX_RUNS];
+  int runCount = find_runs(slots, sent, runs);
+  if (runCount == 0) return 1;
+
+  size_t cost = 0;
+  for (int r = 0; r < runCount; r++)
+  {
+    cost += 3 + runs[r].count;
+  }
+
+  if (1 + cost >= 1 + BBMXS_UNIVERSE_SIZE)
+  {
+    return send_keyframe(state, universe, slots, sent, stats);
+  }
+
+  uint8_t buf[PROTO_MAX_PAYLOAD];
+  size_t len = 1;
+  int first = 0;
+  buf[0] = universe;
+
+  for (int r = 0; r <= runCount; r++)
+  {
+    if (r == runCount || len + 3 + runs[r].count > sizeof(buf))
+    {
+      if (!send_command(state, BBMXS_CMD_DMX_DELTA, buf, len)) return 0;
+      stats->bytesSent += len;
+
+      for (int i = first; i < r; i++)
+      {
+        memcpy(&sent[runs[i].start], &slots[runs[i].start], runs[i].count);
+      }
+
+      if (r == runCount) break;
+      len = 1;
+      first = r;
+    }
+
+    uint16_t channel = runs[r].start + 1;
+    buf[len++] = channel >> 8;
+    buf[len++] = channel & 0xFF;
+    buf[len++] = runs[r].count;
+    memcpy(&buf[len], &slots[runs[r].start], runs[r].count);
+    len += runs[r].count;
+  }
+
+  return 1;
+}
+
+static void* serial_driver_open(const BBMXSport* port, const char* target, const BBMXScontext* ctx)
+{
+  BBMXSserial* serial = serial_open(target, port->baud);
+  if (serial == NULL)
+  {
+    printf("bbmxs Error: Failed to open COM port: \"%s\"\n", target);
+    return NULL;
+  }
+  if (gDebugMode) printf("[DEBUG]: Opened COM port: \"%s\" at %d baud\n", target, port->baud);
+
+  SerialState* state = calloc(1, sizeof(SerialState));
+  state->serial = serial;
+  state->protocol = ctx->protocol;
+  state->universeCount = port->universeCount;
+  state->universes = port->universes;
+  state->frameSize = (size_t)port->universeCount * BBMXS_UNIVERSE_SIZE;
+  state->sent = calloc(state->frameSize, 1);
+  state->acked = calloc(state->frameSize, 1);
+
+  if (state->protocol == BBMXS_PROTOCOL_V2)
+  {
+    state->transport = transport_open(serial, TRANSPORT_DEFAULT_WINDOW, TRANSPORT_DEFAULT_TIMEOUT, on_ack, state);
+  }
+
+  if (state->protocol == BBMXS_PROTOCOL_V2 && state->transport == NULL)
+  {
+    printf("bbmxs Error: Failed to set up transport\n");
+    bbmxs_serial_driver.close(state);
+    return NULL;
+  }
+
+  return state;
+}
+
+static void serial_driver_close(void* data)
+{
+  SerialState* state = data;
+
+  if (state->transport != NULL)
+  {
+    if (gDebugMode)
+    {
+      BBMXStransportstats stats = transport_stats(state->transport);
+      printf("[DEBUG]: Transport: %lu sent | %lu acked | %lu retransmitted | %lu CRC errors | %lu failures\n",
+        stats.packetsSent, stats.packetsAcked, stats.retransmits, stats.crcErrors, stats.failures);
+    }
+    transport_close(state->transport);
+  }
+  serial_close(state->serial);
+
+  free(state->sent);
+  free(state->acked);
+  free(state);
+}
+
+static int serial_driver_send(void* data, const uint8_t* frame, uint16_t universeCount, int keyframe, BBMXSoutputstats* stats)
+{
+  SerialState* state = data;
+
+  for (int u = 0; u < universeCount && u < state->universeCount; u++)
+  {
+    size_t off = (size_t)u * BBMXS_UNIVERSE_SIZE;
+    uint8_t universe = state->universes[u];
+    if (state->protocol != BBMXS_PROTOCOL_V2)
+    {
+      // v1 has no universe field, the controller only drives universe 1
+      if (universe == 1 && !send_universe_v1(state, &frame[off], &state->sent[off])) return 0;
+      continue;
+    }
+
+    unsigned long long before = stats->bytesSent;
+    int ok = keyframe ? send_keyframe(state, universe, &frame[off], &state->sent[off], stats) : send_universe_v2(state, universe, &frame[off], &state->sent[off], stats);
+    stats->bytesSaved += (1 + BBMXS_UNIVERSE_SIZE) - (stats->bytesSent - before);
+
+    if (!ok)
+    {
+      // Packets were lost for good, so only trust what was acked.
+      // The output follows up with a keyframe after a failed send.
+      memcpy(state->sent, state->acked, state->frameSize);
+      return 0;
+    }
+  }
+
+  return 1;
+}
+
+static void serial_driver_flush(void* data)
+{
+  SerialState* state = data;
+
+  // Don't close the port while packets are still unacked
+  if (state->transport != NULL)
+  {
+    transport_drain(state->transport);
+  }
+}
+
+const BBMXSdriver bbmxs_serial_driver = {
+  "serial",
+  serial_driver_open,
+  serial_driver_close,
+  serial_driver_send,
+  serial_driver_flush
+};
@@ -0,0 +1,232 @@
+#include "bbmxs/effect.h"
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifndef M_PI
+#define M_PI 3.14159265358979323846
+#endif
+
+#define EFFECT_INITIAL_CAPACITY 16
+#define STROBE_WIDTH 0.2f
+
+typedef struct
+{
+  int used;
+  BBMXSeffectopts opts;
+  int* fixtures; // indices into ctx->fixtures
+  int count;
+  double phase; // cycles run at `rate`
+} Effect;
+
+static Effect* __effects = NULL;
+static int __capacity = 0;
+static int __count = 0;
+static BBMXScontext* __ctx = NULL;
+static const BBMXScolor __black = { 0, 0, 0, 0 };
+
+static float frac(double x)
+{
+  return (float)(x - floor(x));
+}
+
+static BBMXScolor scale(BBMXScolor c, float f)
+{
+  BBMXScolor r;
+  r.r = c.r * f;
+  r.g = c.g * f;
+  r.b = c.b * f;
+  r.w = c.w * f;
+  return r;
+}
+
+static BBMXScolor blend(BBMXScolor a, BBMXScolor b, float f)
+{
+  BBMXScolor r;
+  r.r = a.r + (b.r - a.r) * f;
+  r.g = a.g + (b.g - a.g) * f;
+  r.b = a.b + (b.b - a.b) * f;
+  r.w = a.w + (b.w - a.w) * f;
+  return r;
+}
+
+// Fully saturated hue, h in 0-1
+static BBMXScolor hue(float h)
+{
+  float rgb[3] = { fabsf(h * 6 - 3) - 1, 2 - fabsf(h * 6 - 2), 2 - fabsf(h * 6 - 4) };
+  for (int i = 0; i < 3; i++)
+  {
+    rgb[i] = rgb[i] < 0 ? 0 : rgb[i] > 1 ? 1 : rgb[i];
+  }
+
+  BBMXScolor c;
+  c.r = rgb[0] * 255;
+  c.g = rgb[1] * 255;
+  c.b = rgb[2] * 255;
+  c.w = 0;
+  return c;
+}
+
+int effect_init(BBMXScontext* ctx)
+{
+  __ctx = ctx;
+  __capacity = EFFECT_INITIAL_CAPACITY;
+  __count = 0;
+  __effects = calloc(__capacity, sizeof(Effect));
+  return __effects != NULL;
+}
+
+void effect_close()
+{
+  effect_stop_all();
+  free(__effects);
+  __effects = NULL;
+  __capacity = 0;
+  __ctx = NULL;
+}
+
+void effect_defaults(BBMXSeffectopts* opts, BBMXSeffectkind kind)
+{
+  memset(opts, 0, sizeof(BBMXSeffectopts));
+  opts->kind = kind;
+  opts->rate = 1;
+  opts->spread = kind == EFFECT_STROBE || kind == EFFECT_FAN ? 0 : 1;
+  opts->palette[0].r = 255;
+  opts->palette[0].g = 255;
+  opts->palette[0].b = 255;
+  opts->paletteCount = 1;
+  opts->size = 90;
+}
+
+int effect_start(BBMXSfixture** fixtures, int count, const BBMXSeffectopts* opts)
+{
+  if (__ctx == NULL || count <= 0) return 0;
+
+  int slot = 0;
+  while (slot < __capacity && __effects[slot].used) slot++;
+  if (slot == __capacity)
+  {
+    Effect* effects = realloc(__effects, sizeof(Effect) * __capacity * 2);
+    if (effects == NULL) return 0;
+    memset(&effects[__capacity], 0, sizeof(Effect) * __capacity);
+    __effects = effects;
+    __capacity *= 2;
+  }
+
+  Effect* e = &__effects[slot];
+  e->fixtures = malloc(sizeof(int) * count);
+  if (e->fixtures == NULL) return 0;
+  for (int i = 0; i < count; i++)
+  {
+    e->fixtures[i] = fixtures[i] - __ctx->fixtures;
+  }
+  e->count = count;
+  e->opts = *opts;
+  e->phase = 0;
+  e->used = 1;
+  __count++;
+
+  return slot + 1;
+}
+
+BBMXSeffectopts* effect_opts(int handle)
+{
+  if (handle < 1 || handle > __capacity || !__effects[handle - 1].used) return NULL;
+  return &__effects[handle - 1].opts;
+}
+
+void effect_stop(int handle)
+{
+  if (effect_opts(handle) == NULL) return;
+
+  Effect* e = &__effects[handle - 1];
+  free(e->fixtures);
+  memset(e, 0, sizeof(Effect));
+  __count--;
+}
+
+void effect_stop_all()
+{
+  for (int i = 0; i < __capacity; i++)
+  {
+    effect_stop(i + 1);
+  }
+}
+
+static void update_effect(Effect* e, float delta, double beat)
+{
+  const BBMXSeffectopts* o = &e->opts;
+
+  double phase;
+  if (o->beats > 0 && beat >= 0)
+  {
+    phase = beat / o->beats;
+  }
+  else
+  {
+    e->phase += delta * o->rate / 1000.0;
+    phase = e->phase;
+  }
+  phase += o->offset;
+
+  int n = e->count;
+  int colors = o->paletteCount > 0 ? o->paletteCount : 1;
+  float width = o->width > 0 ? o->width : o->kind == EFFECT_STROBE ? STROBE_WIDTH : 1.0f / n;
+
+  for (int i = 0; i < n; i++)
+  {
+    BBMXSfixture* fx = &__ctx->fixtures[e->fixtures[i]];
+    double p = phase - (double)o->spread * i / n;
+    float f = frac(p);
+    int lap = (int)floor(p);
+    BBMXScolor c = o->palette[((lap % colors) + colors) % colors];
+
+    switch (o->kind)
+    {
+      case EFFECT_CHASE:
+      case EFFECT_STROBE:
+        fx->color = f < width ? c : __black;
+        break;
+      case EFFECT_RAINBOW:
+        if (o->paletteCount < 2)
+        {
+          fx->color = hue(f);
+        }
+        else
+        {
+          float pos = f * colors;
+          int a = (int)pos;
+          fx->color = blend(o->palette[a % colors], o->palette[(a + 1) % colors], pos - a);
+        }
+        break;
+      case EFFECT_SINE:
+        fx->color = scale(o->palette[0], 0.5f - 0.5f * cosf(2.0f * (float)M_PI * f));
+        break;
+      case EFFECT_FAN:
+      {
+        float pos = n > 1 ? (float)i / (n - 1) - 0.5f : 0;
+        float angle = o->center + o->size * pos * cosf(2.0f * (float)M_PI * f);
+        if (o->tilt) bbmxs_fx_set_tilt(fx, angle);
+        else bbmxs_fx_set_pan(fx, angle);
+        continue;
+      }
+    }
+
+    bbmxs_fx_update_color(fx);
+  }
+}
+
+void effect_update(float delta, double beat)
+{
+  if (__ctx == NULL || __count == 0) return;
+
+  for (int i = 0; i < __capacity; i++)
+  {
+    if (__effects[i].used) update_effect(&__effects[i], delta, beat);
+  }
+}
+
+int effect_count()
+{
+  return __count;
+}
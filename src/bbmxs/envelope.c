@@ -0,0 +1,265 @@
+#include "bbmxs/envelope.h"
+#include "globals.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define ENVELOPE_INITIAL_CAPACITY 64
+#define ENVELOPE_CHANNELS 4 // r, g, b, w
+#define INSTANT_RATE 1e9f // "per ms" rate of a 0 ms attack or decay
+
+// Structure of arrays so the evaluation loop only touches what it needs
+// and the compiler can vectorize it. Finished envelopes are swapped with
+// the last one, the arrays only grow.
+typedef struct
+{
+  int count;
+  int capacity;
+  int* fixture; // index into ctx->fixtures
+  float* t; // ms since the start of the current cycle
+  float* attackBase; // 1 without attack, so level starts at full
+  float* attackRate; // 1 / attack
+  float* decayStart; // attack + hold
+  float* decayRate; // 1 / decay
+  float* cycle; // attack + hold + decay
+  int* cycles; // remaining, 0 = forever
+  float* level;
+  float* peak[ENVELOPE_CHANNELS];
+} Pool;
+
+static Pool __pool;
+static BBMXScontext* __ctx = NULL;
+
+// Per fixture HTP result of the current pass, seeded with the fixture color
+static float* __mix[ENVELOPE_CHANNELS];
+static uint8_t* __active;
+static uint8_t* __was_active;
+static int __any_was_active = 0;
+
+static void grow(int capacity)
+{
+  __pool.fixture = realloc(__pool.fixture, sizeof(int) * capacity);
+  __pool.t = realloc(__pool.t, sizeof(float) * capacity);
+  __pool.attackBase = realloc(__pool.attackBase, sizeof(float) * capacity);
+  __pool.attackRate = realloc(__pool.attackRate, sizeof(float) * capacity);
+  __pool.decayStart = realloc(__pool.decayStart, sizeof(float) * capacity);
+  __pool.decayRate = realloc(__pool.decayRate, sizeof(float) * capacity);
+  __pool.cycle = realloc(__pool.cycle, sizeof(float) * capacity);
+  __pool.cycles = realloc(__pool.cycles, sizeof(int) * capacity);
+  __pool.level = realloc(__pool.level, sizeof(float) * capacity);
+  for (int c = 0; c < ENVELOPE_CHANNELS; c++)
+  {
+    __pool.peak[c] = realloc(__pool.peak[c], sizeof(float) * capacity);
+  }
+  __pool.capacity = capacity;
+}
+
+static void move(int dst, int src)
+{
+  __pool.fixture[dst] = __pool.fixture[src];
+  __pool.t[dst] = __pool.t[src];
+  __pool.attackBase[dst] = __pool.attackBase[src];
+  __pool.attackRate[dst] = __pool.attackRate[src];
+  __pool.decayStart[dst] = __pool.decayStart[src];
+  __pool.decayRate[dst] = __pool.decayRate[src];
+  __pool.cycle[dst] = __pool.cycle[src];
+  __pool.cycles[dst] = __pool.cycles[src];
+  __pool.level[dst] = __pool.level[src];
+  for (int c = 0; c < ENVELOPE_CHANNELS; c++)
+  {
+    __pool.peak[c][dst] = __pool.peak[c][src];
+  }
+}
+
+int envelope_init(BBMXScontext* ctx)
+{
+  __ctx = ctx;
+  memset(&__pool, 0, sizeof(__pool));
+  grow(ENVELOPE_INITIAL_CAPACITY);
+
+  int fixtures = ctx->fixtureCount > 0 ? ctx->fixtureCount : 1;
+  for (int c = 0; c < ENVELOPE_CHANNELS; c++)
+  {
+    __mix[c] = calloc(fixtures, sizeof(float));
+  }
+  __active = calloc(fixtures, 1);
+  __was_active = calloc(fixtures, 1);
+
+  return __pool.fixture != NULL && __active != NULL && __was_active != NULL;
+}
+
+void envelope_close()
+{
+  free(__pool.fixture);
+  free(__pool.t);
+  free(__pool.attackBase);
+  free(__pool.attackRate);
+  free(__pool.decayStart);
+  free(__pool.decayRate);
+  free(__pool.cycle);
+  free(__pool.cycles);
+  free(__pool.level);
+  for (int c = 0; c < ENVELOPE_CHANNELS; c++)
+  {
+    free(__pool.peak[c]);
+    free(__mix[c]);
+    __mix[c] = NULL;
+  }
+  memset(&__pool, 0, sizeof(__pool));
+
+  free(__active);
+  free(__was_active);
+  __active = NULL;
+  __was_active = NULL;
+  __any_was_active = 0;
+  __ctx = NULL;
+}
+
+void envelope_start(BBMXSfixture* fx, BBMXScolor peak, float attack, float hold, float decay, int cycles)
+{
+  if (fx == NULL || __ctx == NULL) return;
+  if (attack < 0) attack = 0;
+  if (hold < 0) hold = 0;
+  if (decay < 0) decay = 0;
+
+  if (__pool.count == __pool.capacity)
+  {
+    grow(__pool.capacity * 2);
+  }
+
+  int i = __pool.count++;
+  __pool.fixture[i] = fx - __ctx->fixtures;
+  __pool.t[i] = 0;
+  __pool.attackBase[i] = attack > 0 ? 0.0f : 1.0f;
+  __pool.attackRate[i] = attack > 0 ? 1.0f / attack : 0.0f;
+  __pool.decayStart[i] = attack + hold;
+  __pool.decayRate[i] = decay > 0 ? 1.0f / decay : INSTANT_RATE;
+  __pool.cycle[i] = attack + hold + decay;
+  __pool.cycles[i] = cycles;
+  __pool.level[i] = 0;
+  __pool.peak[0][i] = peak.r;
+  __pool.peak[1][i] = peak.g;
+  __pool.peak[2][i] = peak.b;
+  __pool.peak[3][i] = peak.w;
+}
+
+void envelope_flash(BBMXSfixture* fx, BBMXScolor color, float speed)
+{
+  float max = color.r;
+  if (color.g > max) max = color.g;
+  if (color.b > max) max = color.b;
+  if (color.w > max) max = color.w;
+
+  float decay = speed > 0 ? max / speed : 0;
+  envelope_start(fx, color, 0, 0, decay, 1);
+}
+
+void envelope_stop(BBMXSfixture* fx)
+{
+  if (fx == NULL || __ctx == NULL) return;
+
+  int idx = fx - __ctx->fixtures;
+  for (int i = 0; i < __pool.count; i++)
+  {
+    if (__pool.fixture[i] != idx) continue;
+    move(i, --__pool.count);
+    i--;
+  }
+}
+
+static void write_fixture(BBMXSfixture* fx, const float* color)
+{
+  const BBMXSchannelconfig* cfg = &fx->model->opts.ch_cfg;
+  bbmxs_fx_write(fx, cfg->ch_red, color[0]);
+  bbmxs_fx_write(fx, cfg->ch_green, color[1]);
+  bbmxs_fx_write(fx, cfg->ch_blue, color[2]);
+  bbmxs_fx_write(fx, cfg->ch_white, color[3]);
+}
+
+void envelope_update(float delta)
+{
+  if (__ctx == NULL) return;
+  if (__pool.count == 0 && !__any_was_active) return;
+
+  const int n = __pool.count;
+  float* t = __pool.t;
+  float* level = __pool.level;
+  const float* attackBase = __pool.attackBase;
+  const float* attackRate = __pool.attackRate;
+  const float* decayStart = __pool.decayStart;
+  const float* decayRate = __pool.decayRate;
+
+  // Branch free: the level is the lower of the rising and the falling
+  // edge, clamped to 0-1. Values are sampled before advancing the time so
+  // a flash starts at full brightness.
+  for (int i = 0; i < n; i++)
+  {
+    float up = attackBase[i] + t[i] * attackRate[i];
+    float down = 1.0f - (t[i] - decayStart[i]) * decayRate[i];
+    float l = up < down ? up : down;
+    l = l < 0.0f ? 0.0f : l;
+    level[i] = l > 1.0f ? 1.0f : l;
+    t[i] += delta;
+  }
+
+  // HTP mix per fixture, starting from the fixture's own color
+  for (int i = 0; i < n; i++)
+  {
+    int f = __pool.fixture[i];
+    if (!__active[f])
+    {
+      BBMXSfixture* fx = &__ctx->fixtures[f];
+      __mix[0][f] = fx->color.r;
+      __mix[1][f] = fx->color.g;
+      __mix[2][f] = fx->color.b;
+      __mix[3][f] = fx->color.w;
+      __active[f] = 1;
+    }
+
+    for (int c = 0; c < ENVELOPE_CHANNELS; c++)
+    {
+      float v = __pool.peak[c][i] * level[i];
+      if (v > __mix[c][f]) __mix[c][f] = v;
+    }
+  }
+
+  __any_was_active = n > 0;
+  for (int f = 0; f < __ctx->fixtureCount; f++)
+  {
+    if (__active[f])
+    {
+      float color[ENVELOPE_CHANNELS] = { __mix[0][f], __mix[1][f], __mix[2][f], __mix[3][f] };
+      write_fixture(&__ctx->fixtures[f], color);
+    }
+    else if (__was_active[f])
+    {
+      // The last envelope just ended, back to the fixture's own color
+      bbmxs_fx_update_color(&__ctx->fixtures[f]);
+    }
+
+    __was_active[f] = __active[f];
+    __active[f] = 0;
+  }
+
+  // Next cycle or done
+  for (int i = 0; i < __pool.count; i++)
+  {
+    if (t[i] < __pool.cycle[i]) continue;
+
+    if (__pool.cycles[i] != 1)
+    {
+      if (__pool.cycles[i] > 1) __pool.cycles[i]--;
+      t[i] -= __pool.cycle[i];
+      if (t[i] >= __pool.cycle[i]) t[i] = 0;
+      continue;
+    }
+
+    move(i, --__pool.count);
+    i--;
+  }
+}
+
+int envelope_count()
+{
+  return __pool.count;
+}
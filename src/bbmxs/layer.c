@@ -0,0 +1,235 @@
+#include "bbmxs/layer.h"
+#include "bbmxs/thread.h"
+#include <stdlib.h>
+#include <string.h>
+
+#define FRAME_FRESH 0x4
+#define FRAME_INDEX 0x3
+#define UNPATCHED 0xFFFF
+
+// One patched universe of a layer frame
+typedef struct
+{
+  uint8_t slots[BBMXS_UNIVERSE_SIZE];
+  uint8_t set[BBMXS_UNIVERSE_SIZE / 8]; // channels the layer holds
+} LayerUniverse;
+
+struct BBMXSlayer
+{
+  uint8_t mode;
+  LayerUniverse* frames[3]; // patchedCount universes each
+  volatile long pending;
+  int back; // script thread
+  int front; // tick thread
+};
+
+static BBMXSlayer** __layers = NULL;
+static int __layer_count = 0;
+static BBMXScontext* __ctx = NULL;
+static uint16_t* __patched_index = NULL; // universe - 1 to the index in ctx->patched
+static BBMXSuniverse** __merged = NULL;
+
+static int setup(BBMXScontext* ctx)
+{
+  __ctx = ctx;
+  __patched_index = malloc(sizeof(uint16_t) * ctx->universeCount);
+  __merged = calloc(ctx->universeCount, sizeof(BBMXSuniverse*));
+  if (__patched_index == NULL || __merged == NULL) return 0;
+
+  for (int u = 0; u < ctx->universeCount; u++)
+  {
+    __patched_index[u] = UNPATCHED;
+  }
+  for (int i = 0; i < ctx->patchedCount; i++)
+  {
+    uint8_t u = ctx->patched[i];
+    __patched_index[u - 1] = i;
+    __merged[u - 1] = calloc(1, sizeof(BBMXSuniverse));
+    if (__merged[u - 1] == NULL) return 0;
+  }
+
+  ctx->output = __merged;
+  return 1;
+}
+
+BBMXSlayer* layer_create(BBMXScontext* ctx, uint8_t mode)
+{
+  if (__layer_count == 0 && !setup(ctx))
+  {
+    layer_destroy_all();
+    return NULL;
+  }
+
+  BBMXSlayer** layers = realloc(__layers, sizeof(BBMXSlayer*) * (__layer_count + 1));
+  BBMXSlayer* layer = calloc(1, sizeof(BBMXSlayer));
+  if (layers != NULL) __layers = layers;
+  if (layers == NULL || layer == NULL)
+  {
+    free(layer);
+    return NULL;
+  }
+
+  layer->mode = mode;
+  for (int f = 0; f < 3; f++)
+  {
+    layer->frames[f] = calloc(ctx->patchedCount > 0 ? ctx->patchedCount : 1, sizeof(LayerUniverse));
+    if (layer->frames[f] == NULL)
+    {
+      for (int i = 0; i < f; i++) free(layer->frames[i]);
+      free(layer);
+      return NULL;
+    }
+  }
+  layer->back = 0;
+  layer->pending = 1;
+  layer->front = 2;
+
+  __layers[__layer_count++] = layer;
+  return layer;
+}
+
+void layer_destroy_all()
+{
+  for (int l = 0; l < __layer_count; l++)
+  {
+    for (int f = 0; f < 3; f++)
+    {
+      free(__layers[l]->frames[f]);
+    }
+    free(__layers[l]);
+  }
+  free(__layers);
+  __layers = NULL;
+  __layer_count = 0;
+
+  if (__ctx == NULL) return;
+
+  for (int u = 0; u < __ctx->universeCount && __merged != NULL; u++)
+  {
+    free(__merged[u]);
+  }
+  free(__merged);
+  free(__patched_index);
+  __merged = NULL;
+  __patched_index = NULL;
+  __ctx->output = __ctx->universes;
+  __ctx = NULL;
+}
+
+static LayerUniverse* universe_of(BBMXSlayer* layer, const BBMXSfixture* fx)
+{
+  if (fx->universe < 1 || fx->universe > __ctx->universeCount) return NULL;
+
+  uint16_t i = __patched_index[fx->universe - 1];
+  return i != UNPATCHED ? &layer->frames[layer->back][i] : NULL;
+}
+
+void layer_fx_write(BBMXSlayer* layer, const BBMXSfixture* fx, DMXChannel channel, uint8_t value)
+{
+  // channel 0 means the model doesn't have that channel
+  if (channel == 0) return;
+
+  uint16_t slot = fx->address + channel - 2;
+  LayerUniverse* uv = universe_of(layer, fx);
+  if (uv == NULL || slot >= BBMXS_UNIVERSE_SIZE) return;
+
+  uv->slots[slot] = value;
+  uv->set[slot >> 3] |= 1 << (slot & 7);
+}
+
+static void write_angle(BBMXSlayer* layer, const BBMXSfixture* fx, DMXChannel coarse, DMXChannel fine, float angle, float max)
+{
+  uint16_t value = bbmxs_angle_to_dmx(angle, max, fine != 0);
+  if (fine == 0)
+  {
+    layer_fx_write(layer, fx, coarse, value);
+    return;
+  }
+
+  layer_fx_write(layer, fx, coarse, value >> 8);
+  layer_fx_write(layer, fx, fine, value & 0xFF);
+}
+
+void layer_fx_tilt(BBMXSlayer* layer, const BBMXSfixture* fx, float angle)
+{
+  const BBMXSmodelopts* opts = &fx->model->opts;
+  write_angle(layer, fx, opts->ch_cfg.ch_tilt, opts->ch_cfg.ch_tilt_fine, angle, opts->max_tilt);
+}
+
+void layer_fx_pan(BBMXSlayer* layer, const BBMXSfixture* fx, float angle)
+{
+  const BBMXSmodelopts* opts = &fx->model->opts;
+  write_angle(layer, fx, opts->ch_cfg.ch_pan, opts->ch_cfg.ch_pan_fine, angle, opts->max_pan);
+}
+
+void layer_fx_release(BBMXSlayer* layer, const BBMXSfixture* fx)
+{
+  LayerUniverse* uv = universe_of(layer, fx);
+  if (uv == NULL) return;
+
+  uint16_t footprint = bbmxs_model_footprint(fx->model, fx->channel_mode);
+  for (uint16_t slot = fx->address - 1; slot < fx->address - 1 + footprint && slot < BBMXS_UNIVERSE_SIZE; slot++)
+  {
+    uv->set[slot >> 3] &= ~(1 << (slot & 7));
+  }
+}
+
+void layer_clear(BBMXSlayer* layer)
+{
+  memset(layer->frames[layer->back], 0, sizeof(LayerUniverse) * __ctx->patchedCount);
+}
+
+void layer_publish(BBMXSlayer* layer)
+{
+  LayerUniverse* done = layer->frames[layer->back];
+  layer->back = thread_atomic_xchg(&layer->pending, layer->back | FRAME_FRESH) & FRAME_INDEX;
+
+  // The script only writes what changes, so the next frame starts from this one
+  memcpy(layer->frames[layer->back], done, sizeof(LayerUniverse) * __ctx->patchedCount);
+}
+
+int layer_merge(BBMXScontext* ctx)
+{
+  if (__layer_count == 0) return 0;
+
+  for (int l = 0; l < __layer_count; l++)
+  {
+    BBMXSlayer* layer = __layers[l];
+    if (thread_atomic_load(&layer->pending) & FRAME_FRESH)
+    {
+      layer->front = thread_atomic_xchg(&layer->pending, layer->front) & FRAME_INDEX;
+    }
+  }
+
+  int changed = 0;
+  for (int i = 0; i < ctx->patchedCount; i++)
+  {
+    uint8_t u = ctx->patched[i];
+    const uint8_t* base = ctx->universes[u - 1]->slots;
+    uint8_t* out = __merged[u - 1]->slots;
+
+    for (int slot = 0; slot < BBMXS_UNIVERSE_SIZE; slot++)
+    {
+      uint8_t value = base[slot];
+      uint8_t bit = 1 << (slot & 7);
+      for (int l = 0; l < __layer_count; l++)
+      {
+        const LayerUniverse* uv = &__layers[l]->frames[__layers[l]->front][i];
+        if (!(uv->set[slot >> 3] & bit)) continue;
+
+        if (__layers[l]->mode == BBMXS_LAYER_LTP || uv->slots[slot] > value)
+        {
+          value = uv->slots[slot];
+        }
+      }
+
+      if (out[slot] != value)
+      {
+        out[slot] = value;
+        changed = 1;
+      }
+    }
+  }
+
+  return changed;
+}
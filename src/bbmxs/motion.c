@@ -0,0 +1,251 @@
+#include "bbmxs/motion.h"
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define MOTION_AXES 2
+
+typedef struct
+{
+  BBMXSbool active;
+  BBMXSbool loop;
+  BBMXScurve curve;
+  float t; // ms since the start
+  float duration;
+  float speed; // average degrees per second
+  // from and to for linear and eased moves, the path for splines.
+  // points[0] is where the axis was when the move started.
+  float points[MOTION_MAX_POINTS + 1];
+  int count;
+} Move;
+
+static Move* __moves = NULL; // fixtureCount * MOTION_AXES
+static int __count = 0;
+static BBMXScontext* __ctx = NULL;
+
+static Move* get_move(BBMXSfixture* fx, BBMXSaxis axis)
+{
+  return &__moves[(fx - __ctx->fixtures) * MOTION_AXES + axis];
+}
+
+static float angle_of(BBMXSfixture* fx, BBMXSaxis axis)
+{
+  return axis == MOTION_PAN ? fx->pan : fx->tilt;
+}
+
+static void set_angle(BBMXSfixture* fx, BBMXSaxis axis, float angle)
+{
+  if (axis == MOTION_PAN) bbmxs_fx_set_pan(fx, angle);
+  else bbmxs_fx_set_tilt(fx, angle);
+}
+
+// Motor speed to keep up with the faster of both axes, 0 is the fastest
+static void write_motor_speed(BBMXSfixture* fx)
+{
+  DMXChannel ch = fx->model->opts.ch_cfg.ch_mtr_spd;
+  if (ch == 0) return;
+
+  Move* moves = get_move(fx, MOTION_PAN);
+  float speed = 0;
+  for (int a = 0; a < MOTION_AXES; a++)
+  {
+    if (moves[a].active && moves[a].speed > speed) speed = moves[a].speed;
+  }
+
+  float f = speed > 0 ? speed / fx->model->opts.max_speed : 1;
+  f = f > 1 ? 1 : f;
+  bbmxs_fx_write(fx, ch, (1 - f) * 255);
+}
+
+static void start(BBMXSfixture* fx, BBMXSaxis axis, Move* m)
+{
+  if (!get_move(fx, axis)->active) __count++;
+  *get_move(fx, axis) = *m;
+  write_motor_speed(fx);
+}
+
+int motion_init(BBMXScontext* ctx)
+{
+  __ctx = ctx;
+  __count = 0;
+  int fixtures = ctx->fixtureCount > 0 ? ctx->fixtureCount : 1;
+  __moves = calloc(fixtures * MOTION_AXES, sizeof(Move));
+  return __moves != NULL;
+}
+
+void motion_close()
+{
+  free(__moves);
+  __moves = NULL;
+  __count = 0;
+  __ctx = NULL;
+}
+
+// Ends the move of the axis and sets it to `angle` right away
+static void jump(BBMXSfixture* fx, BBMXSaxis axis, float angle)
+{
+  Move* m = get_move(fx, axis);
+  if (m->active)
+  {
+    m->active = 0;
+    __count--;
+  }
+
+  set_angle(fx, axis, angle);
+  write_motor_speed(fx);
+}
+
+void motion_move(BBMXSfixture* fx, BBMXSaxis axis, float target, float duration, BBMXScurve curve)
+{
+  if (fx == NULL || __ctx == NULL) return;
+
+  float from = angle_of(fx, axis);
+  if (duration <= 0 || target == from)
+  {
+    jump(fx, axis, target);
+    return;
+  }
+
+  Move m;
+  memset(&m, 0, sizeof(Move));
+  m.active = 1;
+  m.curve = curve == MOTION_SPLINE ? MOTION_EASE : curve;
+  m.duration = duration;
+  m.points[0] = from;
+  m.points[1] = target;
+  m.count = 2;
+  m.speed = fabsf(target - from) * 1000 / duration;
+
+  start(fx, axis, &m);
+}
+
+void motion_move_speed(BBMXSfixture* fx, BBMXSaxis axis, float target, float speed)
+{
+  if (fx == NULL || __ctx == NULL) return;
+
+  if (speed <= 0 || speed >= 1)
+  {
+    jump(fx, axis, target);
+    return;
+  }
+
+  float distance = fabsf(target - angle_of(fx, axis));
+  motion_move(fx, axis, target, distance * 1000 / (speed * fx->model->opts.max_speed), MOTION_LINEAR);
+}
+
+void motion_path(BBMXSfixture* fx, BBMXSaxis axis, const float* points, int count, float duration, BBMXSbool loop)
+{
+  if (fx == NULL || __ctx == NULL || count < 1) return;
+  if (count > MOTION_MAX_POINTS) count = MOTION_MAX_POINTS;
+
+  if (duration <= 0)
+  {
+    jump(fx, axis, points[count - 1]);
+    return;
+  }
+
+  Move m;
+  memset(&m, 0, sizeof(Move));
+  m.active = 1;
+  m.loop = loop;
+  m.curve = MOTION_SPLINE;
+  m.duration = duration;
+  m.points[0] = angle_of(fx, axis);
+  memcpy(&m.points[1], points, sizeof(float) * count);
+  m.count = count + 1;
+
+  float length = 0;
+  for (int i = 1; i < m.count; i++)
+  {
+    length += fabsf(m.points[i] - m.points[i - 1]);
+  }
+  if (loop) length += fabsf(m.points[0] - m.points[m.count - 1]);
+  m.speed = length * 1000 / duration;
+
+  start(fx, axis, &m);
+}
+
+void motion_stop(BBMXSfixture* fx)
+{
+  if (fx == NULL || __ctx == NULL) return;
+
+  for (int a = 0; a < MOTION_AXES; a++)
+  {
+    Move* m = get_move(fx, a);
+    if (!m->active) continue;
+    m->active = 0;
+    __count--;
+  }
+}
+
+static float catmull_rom(float p0, float p1, float p2, float p3, float u)
+{
+  float u2 = u * u;
+  float u3 = u2 * u;
+  return 0.5f * (2 * p1 + (p2 - p0) * u + (2 * p0 - 5 * p1 + 4 * p2 - p3) * u2 + (3 * p1 - p0 - 3 * p2 + p3) * u3);
+}
+
+// Position of the move at u (0-1 of the duration)
+static float evaluate(const Move* m, float u)
+{
+  if (m->curve != MOTION_SPLINE)
+  {
+    if (m->curve == MOTION_EASE) u = u * u * (3 - 2 * u);
+    return m->points[0] + (m->points[1] - m->points[0]) * u;
+  }
+
+  // A loop has one more segment, back to the start. The ends of an open
+  // path repeat their point so the curve doesn't overshoot there.
+  int n = m->count;
+  int segments = m->loop ? n : n - 1;
+  float pos = u * segments;
+  int s = (int)pos;
+  if (s >= segments) s = segments - 1;
+
+  int i[4] = { s - 1, s, s + 1, s + 2 };
+  for (int k = 0; k < 4; k++)
+  {
+    if (m->loop) i[k] = (i[k] + n) % n;
+    else i[k] = i[k] < 0 ? 0 : i[k] >= n ? n - 1 : i[k];
+  }
+
+  return catmull_rom(m->points[i[0]], m->points[i[1]], m->points[i[2]], m->points[i[3]], pos - s);
+}
+
+void motion_update(float delta)
+{
+  if (__ctx == NULL || __count == 0) return;
+
+  for (int f = 0; f < __ctx->fixtureCount; f++)
+  {
+    BBMXSfixture* fx = &__ctx->fixtures[f];
+    for (int a = 0; a < MOTION_AXES; a++)
+    {
+      Move* m = &__moves[f * MOTION_AXES + a];
+      if (!m->active) continue;
+
+      m->t += delta;
+      if (m->t < m->duration)
+      {
+        set_angle(fx, a, evaluate(m, m->t / m->duration));
+        continue;
+      }
+
+      if (m->loop)
+      {
+        m->t = fmodf(m->t, m->duration);
+        set_angle(fx, a, evaluate(m, m->t / m->duration));
+        continue;
+      }
+
+      set_angle(fx, a, evaluate(m, 1));
+      m->active = 0;
+      __count--;
+    }
+  }
+}
+
+int motion_count()
+{
+  return __count;
+}
@@ -0,0 +1,90 @@
+#include "bbmxs/names.h"
+#include <stdlib.h>
+#include <string.h>
+
+#define NAMES_INITIAL_CAPACITY 64
+
+// FNV-1a
+static uint32_t hash(const char* key)
+{
+  uint32_t h = 2166136261u;
+  for (; *key; key++)
+  {
+    h ^= (uint8_t)*key;
+    h *= 16777619u;
+  }
+  return h;
+}
+
+static int find(const BBMXSnames* names, const char* key, uint32_t h)
+{
+  int mask = names->capacity - 1;
+  for (int i = h & mask; ; i = (i + 1) & mask)
+  {
+    if (names->keys[i] == NULL) return i;
+    if (names->hashes[i] == h && strcmp(names->keys[i], key) == 0) return i;
+  }
+}
+
+static void grow(BBMXSnames* names)
+{
+  BBMXSnames old = *names;
+
+  names->capacity = old.capacity > 0 ? old.capacity * 2 : NAMES_INITIAL_CAPACITY;
+  names->keys = calloc(names->capacity, sizeof(const char*));
+  names->hashes = malloc(sizeof(uint32_t) * names->capacity);
+  names->values = malloc(sizeof(int) * names->capacity);
+
+  for (int i = 0; i < old.capacity; i++)
+  {
+    if (old.keys[i] == NULL) continue;
+
+    int slot = find(names, old.keys[i], old.hashes[i]);
+    names->keys[slot] = old.keys[i];
+    names->hashes[slot] = old.hashes[i];
+    names->values[slot] = old.values[i];
+  }
+
+  free(old.keys);
+  free(old.hashes);
+  free(old.values);
+}
+
+void names_init(BBMXSnames* names)
+{
+  memset(names, 0, sizeof(BBMXSnames));
+}
+
+void names_free(BBMXSnames* names)
+{
+  free(names->keys);
+  free(names->hashes);
+  free(names->values);
+  memset(names, 0, sizeof(BBMXSnames));
+}
+
+int names_put(BBMXSnames* names, const char* key, int value)
+{
+  if ((names->count + 1) * 2 > names->capacity)
+  {
+    grow(names);
+  }
+
+  uint32_t h = hash(key);
+  int slot = find(names, key, h);
+  if (names->keys[slot] != NULL) return 0;
+
+  names->keys[slot] = key;
+  names->hashes[slot] = h;
+  names->values[slot] = value;
+  names->count++;
+  return 1;
+}
+
+int names_get(const BBMXSnames* names, const char* key)
+{
+  if (names->count == 0) return -1;
+
+  int slot = find(names, key, hash(key));
+  return names->keys[slot] != NULL ? names->values[slot] : -1;
+}
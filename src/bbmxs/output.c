@@ -0,0 +1,325 @@
+#include "bbmxs/output.h"
+#include "bbmxs/driver.h"
+#include "bbmxs/thread.h"
+#include "globals.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Frames are handed from the tick loop to each output thread through a
+// triple buffer: the tick loop fills back and swaps it with pending,
+// the output thread swaps pending with front when the fresh bit is set.
+// Neither side ever waits for the other and the newest frame always wins.
+#define FRAME_FRESH 0x4
+#define FRAME_INDEX 0x3
+#define RETRY_INTERVAL 100
+
+// Every port runs on its own thread, so a slow or stalled controller
+// only holds back its own universes.
+typedef struct
+{
+  const BBMXSport* port;
+  uint8_t* frames[3];
+  volatile long pending;
+  int back;
+  int front;
+
+  const BBMXSdriver* driver;
+  void* driverState;
+  int keyframeInterval;
+  unsigned long lastKeyframe;
+  int forceKeyframe;
+  unsigned long retryAt; // a failed send is only repeated from then on
+
+  BBMXSoutputstats stats;
+  unsigned long long savedAtSecond;
+  unsigned long secondStart;
+
+  BBMXSthread worker;
+  BBMXSevent wake;
+  volatile long running;
+  volatile long failed;
+} Output;
+
+static Output* __outputs = NULL;
+static int __output_count = 0;
+static BBMXSoutputstats __total;
+
+const BBMXSdriver* driver_for_port(const char* port, const char** target)
+{
+  if (strncmp(port, "artnet:", 7) == 0)
+  {
+    *target = port + 7;
+    return &bbmxs_artnet_driver;
+  }
+
+  if (strncmp(port, "sacn:", 5) == 0)
+  {
+    *target = port + 5;
+    return &bbmxs_sacn_driver;
+  }
+
+  *target = port;
+  return &bbmxs_serial_driver;
+}
+
+static void send_frame(Output* out, const uint8_t* frame, int keyframe)
+{
+  out->stats.frames++;
+  if (keyframe) out->stats.keyframes++;
+
+  if (!out->driver->send(out->driverState, frame, out->port->universeCount, keyframe, &out->stats))
+  {
+    // Bring the receiver back in sync with the next frame, but a port that
+    // keeps failing only gets the old one again every so often
+    int retry = out->keyframeInterval > 0 && out->keyframeInterval < RETRY_INTERVAL ? out->keyframeInterval : RETRY_INTERVAL;
+    out->forceKeyframe = 1;
+    out->retryAt = thread_ticks_ms() + retry;
+
+    if (!thread_atomic_xchg(&out->failed, 1) && gDebugMode)
+    {
+      printf("[DEBUG]: Output (%s): Failed to send frame\n", out->port->name);
+    }
+  }
+}
+
+static void update_rate(Output* out)
+{
+  unsigned long now = thread_ticks_ms();
+  if (now - out->secondStart < 1000) return;
+
+  unsigned long long saved = out->stats.bytesSaved - out->savedAtSecond;
+  out->stats.bytesSavedPerSec = saved * 1000 / (now - out->secondStart);
+  out->savedAtSecond = out->stats.bytesSaved;
+  out->secondStart = now;
+
+  if (gDebugMode && saved > 0)
+  {
+    printf("[DEBUG]: Output (%s): %lu bytes/s saved by delta frames\n", out->port->name, out->stats.bytesSavedPerSec);
+  }
+}
+
+// ms until a keyframe is due without a new frame, -1 = never
+static int keyframe_timeout(Output* out)
+{
+  long timeout;
+  if (out->forceKeyframe) timeout = (long)(out->retryAt - thread_ticks_ms());
+  else if (out->keyframeInterval > 0) timeout = out->keyframeInterval - (long)(thread_ticks_ms() - out->lastKeyframe);
+  else return -1;
+
+  return timeout > 0 ? (int)timeout : 0;
+}
+
+static int keyframe_due(Output* out, int fresh)
+{
+  // A new frame goes out whole right away when the last one failed
+  if (out->forceKeyframe && fresh) return 1;
+  return keyframe_timeout(out) == 0;
+}
+
+static int output_thread(void* arg)
+{
+  Output* out = arg;
+
+  while (1)
+  {
+    int running = thread_atomic_load(&out->running);
+    int fresh = thread_atomic_load(&out->pending) & FRAME_FRESH;
+
+    // Only the last frame is drained on the way out, a due keyframe is dropped
+    if (!running && !fresh) break;
+
+    int keyframe = keyframe_due(out, fresh);
+
+    if (fresh || keyframe)
+    {
+      if (fresh)
+      {
+        out->front = thread_atomic_xchg(&out->pending, out->front) & FRAME_INDEX;
+      }
+
+      if (keyframe)
+      {
+        out->forceKeyframe = 0;
+        out->lastKeyframe = thread_ticks_ms();
+      }
+
+      // Without a new frame the keyframe repeats the last one
+      send_frame(out, out->frames[out->front], keyframe);
+      update_rate(out);
+      continue;
+    }
+
+    thread_event_wait(out->wake, keyframe_timeout(out));
+  }
+
+  if (out->driver->flush != NULL)
+  {
+    out->driver->flush(out->driverState);
+  }
+
+  return 0;
+}
+
+static int start_port(Output* out, const BBMXSport* port, const BBMXScontext* ctx)
+{
+  memset(out, 0, sizeof(Output));
+  out->port = port;
+
+  const char* target;
+  out->driver = driver_for_port(port->name, &target);
+  out->driverState = out->driver->open(port, target, ctx);
+  if (out->driverState == NULL)
+  {
+    out->driver = NULL;
+    return 0;
+  }
+
+  for (int i = 0; i < 3; i++)
+  {
+    out->frames[i] = calloc((size_t)port->universeCount * BBMXS_UNIVERSE_SIZE, 1);
+  }
+
+  out->pending = 1;
+  out->back = 0;
+  out->front = 2;
+  out->running = 1;
+  out->forceKeyframe = 1;
+  out->retryAt = thread_ticks_ms();
+  out->keyframeInterval = ctx->keyframeInterval;
+  out->secondStart = thread_ticks_ms();
+
+  out->wake = thread_event_create();
+  out->worker = out->wake != NULL ? thread_create(output_thread, out) : NULL;
+  if (out->worker == NULL)
+  {
+    printf("bbmxs Error: Failed to start output thread for \"%s\"\n", port->name);
+    out->running = 0;
+    return 0;
+  }
+
+  return 1;
+}
+
+static void stop_port(Output* out)
+{
+  if (out->worker != NULL)
+  {
+    // The thread sends whatever is still pending before it exits
+    thread_atomic_store(&out->running, 0);
+    thread_event_signal(out->wake);
+    thread_join(out->worker);
+    out->worker = NULL;
+  }
+
+  thread_event_destroy(out->wake);
+  out->wake = NULL;
+
+  if (out->driver != NULL)
+  {
+    if (gDebugMode)
+    {
+      printf("[DEBUG]: Output (%s, %s): %lu frames | %lu keyframes | %llu bytes sent | %llu bytes saved\n",
+        out->port->name, out->driver->name, out->stats.frames, out->stats.keyframes, out->stats.bytesSent, out->stats.bytesSaved);
+    }
+
+    out->driver->close(out->driverState);
+    out->driver = NULL;
+    out->driverState = NULL;
+  }
+
+  __total.frames += out->stats.frames;
+  __total.keyframes += out->stats.keyframes;
+  __total.bytesSent += out->stats.bytesSent;
+  __total.bytesSaved += out->stats.bytesSaved;
+  __total.bytesSavedPerSec += out->stats.bytesSavedPerSec;
+
+  for (int i = 0; i < 3; i++)
+  {
+    free(out->frames[i]);
+    out->frames[i] = NULL;
+  }
+}
+
+int output_start(BBMXScontext* ctx)
+{
+  __outputs = calloc(ctx->portCount, sizeof(Output));
+  __output_count = 0;
+  memset(&__total, 0, sizeof(__total));
+
+  for (int p = 0; p < ctx->portCount; p++)
+  {
+    const BBMXSport* port = &ctx->ports[p];
+    if (port->universeCount == 0)
+    {
+      if (gDebugMode) printf("[DEBUG]: Port \"%s\" has no patched universes, skipping\n", port->name);
+      continue;
+    }
+
+    Output* out = &__outputs[__output_count];
+    if (!start_port(out, port, ctx))
+    {
+      stop_port(out);
+      output_stop();
+      return 0;
+    }
+    __output_count++;
+
+    if (gDebugMode) printf("[DEBUG]: Output (%s): %d universes\n", port->name, port->universeCount);
+  }
+
+  return 1;
+}
+
+void output_stop()
+{
+  // Signal all of them first, so every port drains in parallel
+  for (int i = 0; i < __output_count; i++)
+  {
+    thread_atomic_store(&__outputs[i].running, 0);
+    thread_event_signal(__outputs[i].wake);
+  }
+
+  for (int i = 0; i < __output_count; i++)
+  {
+    stop_port(&__outputs[i]);
+  }
+
+  free(__outputs);
+  __outputs = NULL;
+  __output_count = 0;
+}
+
+void output_submit(const BBMXScontext* ctx)
+{
+  for (int o = 0; o < __output_count; o++)
+  {
+    Output* out = &__outputs[o];
+
+    uint8_t* frame = out->frames[out->back];
+    for (int i = 0; i < out->port->universeCount; i++)
+    {
+      const BBMXSuniverse* uv = ctx->output[out->port->universes[i] - 1];
+      memcpy(&frame[(size_t)i * BBMXS_UNIVERSE_SIZE], uv->slots, BBMXS_UNIVERSE_SIZE);
+    }
+
+    out->back = thread_atomic_xchg(&out->pending, out->back | FRAME_FRESH) & FRAME_INDEX;
+    thread_event_signal(out->wake);
+  }
+}
+
+int output_ok()
+{
+  int ok = 1;
+  for (int i = 0; i < __output_count; i++)
+  {
+    if (thread_atomic_xchg(&__outputs[i].failed, 0)) ok = 0;
+  }
+  return ok;
+}
+
+// Sum over all ports, only meaningful once output_stop was called
+BBMXSoutputstats output_stats()
+{
+  return __total;
+}
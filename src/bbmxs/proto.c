@@ -0,0 +1,128 @@
+#include "bbmxs/proto.h"
+#include <string.h>
+
+uint16_t proto_crc16(const uint8_t* data, size_t len)
+{
+  uint16_t crc = 0xFFFF;
+  for (size_t i = 0; i < len; i++)
+  {
+    crc ^= (uint16_t)data[i] << 8;
+    for (int b = 0; b < 8; b++)
+    {
+      crc = (crc & 0x8000) ? (crc << 1) ^ 0x1021 : crc << 1;
+    }
+  }
+  return crc;
+}
+
+size_t proto_cobs_encode(const uint8_t* data, size_t len, uint8_t* out)
+{
+  size_t code_idx = 0;
+  size_t o = 1;
+  uint8_t code = 1;
+
+  for (size_t i = 0; i < len; i++)
+  {
+    if (data[i] != 0)
+    {
+      out[o++] = data[i];
+      code++;
+    }
+
+    if (data[i] == 0 || code == 0xFF)
+    {
+      out[code_idx] = code;
+      code_idx = o++;
+      code = 1;
+    }
+  }
+  out[code_idx] = code;
+
+  return o;
+}
+
+// Returns 0 for malformed input
+size_t proto_cobs_decode(const uint8_t* data, size_t len, uint8_t* out)
+{
+  size_t o = 0;
+  size_t i = 0;
+
+  while (i < len)
+  {
+    uint8_t code = data[i++];
+    if (code == 0 || i + code - 1 > len) return 0;
+
+    for (uint8_t c = 1; c < code; c++)
+    {
+      out[o++] = data[i++];
+    }
+
+    if (code != 0xFF && i < len) out[o++] = 0;
+  }
+
+  return o;
+}
+
+size_t proto_encode(uint8_t seq, uint8_t cmd, const void* data, size_t size, uint8_t* out)
+{
+  if (size > PROTO_MAX_PAYLOAD) return 0;
+
+  uint8_t raw[PROTO_MAX_RAW];
+  raw[0] = seq;
+  raw[1] = cmd;
+  if (size > 0) memcpy(&raw[PROTO_HEADER_SIZE], data, size);
+
+  uint16_t crc = proto_crc16(raw, PROTO_HEADER_SIZE + size);
+  raw[PROTO_HEADER_SIZE + size] = crc >> 8;
+  raw[PROTO_HEADER_SIZE + size + 1] = crc & 0xFF;
+
+  size_t len = proto_cobs_encode(raw, PROTO_HEADER_SIZE + size + PROTO_TRAILER_SIZE, out);
+  out[len++] = PROTO_DELIMITER;
+
+  return len;
+}
+
+void proto_parser_reset(BBMXSprotoparser* p)
+{
+  p->len = 0;
+  p->overflow = 0;
+}
+
+// Returns 1 when `out` holds a complete packet, -1 on a corrupt packet
+// and 0 while more bytes are needed.
+int proto_parse_byte(BBMXSprotoparser* p, uint8_t byte, BBMXSpacket* out)
+{
+  if (byte != PROTO_DELIMITER)
+  {
+    if (p->len < sizeof(p->buf))
+    {
+      p->buf[p->len++] = byte;
+    }
+    else
+    {
+      p->overflow = 1;
+    }
+    return 0;
+  }
+
+  // Back to back delimiters are allowed and mean nothing
+  if (p->len == 0) return 0;
+
+  uint8_t raw[PROTO_MAX_PACKET];
+  size_t len = p->overflow ? 0 : proto_cobs_decode(p->buf, p->len, raw);
+  proto_parser_reset(p);
+
+  if (len < PROTO_HEADER_SIZE + PROTO_TRAILER_SIZE) return -1;
+
+  size_t size = len - PROTO_HEADER_SIZE - PROTO_TRAILER_SIZE;
+  if (size > PROTO_MAX_PAYLOAD) return -1;
+
+  uint16_t crc = ((uint16_t)raw[len - 2] << 8) | raw[len - 1];
+  if (proto_crc16(raw, len - PROTO_TRAILER_SIZE) != crc) return -1;
+
+  out->seq = raw[0];
+  out->cmd = raw[1];
+  out->len = size;
+  memcpy(out->payload, &raw[PROTO_HEADER_SIZE], size);
+  return 1;
+}
@@ -1,69 +1,89 @@
 #include "bbmxs/serial.h"
+#include "config.h"
+
+#ifdef BBMX_WIN32
 #define WIN32_LEAN_AND_MEAN
 #include <Windows.h>
+#include <stdlib.h>
+
+struct BBMXSserial
+{
+  HANDLE handle;
+  int readTimeout;
+};
+
+static int set_read_timeout(BBMXSserial* serial, int timeoutMs)
+{
+  if (timeoutMs == serial->readTimeout) return 1;
+
+  // MAXDWORD/MAXDWORD makes ReadFile return as soon as one byte is there
+  COMMTIMEOUTS timeouts = { 0 };
+  timeouts.ReadIntervalTimeout = MAXDWORD;
+  timeouts.ReadTotalTimeoutMultiplier = timeoutMs > 0 ? MAXDWORD : 0;
+  timeouts.ReadTotalTimeoutConstant = timeoutMs;
+  timeouts.WriteTotalTimeoutConstant = 1000;
+  timeouts.WriteTotalTimeoutMultiplier = 0;
+
+  if (!SetCommTimeouts(serial->handle, &timeouts)) return 0;
 
-static HANDLE __handle = NULL;
+  serial->readTimeout = timeoutMs;
+  return 1;
+}
 
-int serial_open(const char* port)
+BBMXSserial* serial_open(const char* port, int baud)
 {
   char portName[32] = "\\\\.\\";
   strcat(portName, port);
 
-  __handle = CreateFile(portName, GENERIC_WRITE | GENERIC_READ, 0, NULL, OPEN_EXISTING, FILE_FLAG_NO_BUFFERING, NULL);
-  if (__handle == INVALID_HANDLE_VALUE)
+  HANDLE handle = CreateFile(portName, GENERIC_WRITE | GENERIC_READ, 0, NULL, OPEN_EXISTING, FILE_FLAG_NO_BUFFERING, NULL);
+  if (handle == INVALID_HANDLE_VALUE)
   {
-    __handle = NULL;
-    return 0;
+    return NULL;
   }
 
-  if (!FlushFileBuffers(__handle))
+  BBMXSserial* serial = malloc(sizeof(BBMXSserial));
+  serial->handle = handle;
+  serial->readTimeout = -1;
+
+  if (!FlushFileBuffers(serial->handle))
   {
-      serial_close();
-      __handle = NULL;
-      return 0;
+      serial_close(serial);
+      return NULL;
   }
 
-  COMMTIMEOUTS timeouts = { 0 };
-  timeouts.ReadIntervalTimeout = 1;
-  timeouts.ReadTotalTimeoutConstant = 1000;
-  timeouts.ReadTotalTimeoutMultiplier = 0;
-  timeouts.WriteTotalTimeoutConstant = 1000;
-  timeouts.WriteTotalTimeoutMultiplier = 0;
-
-  if (!SetCommTimeouts(__handle, &timeouts))
+  if (!set_read_timeout(serial, 1000))
   {
-      serial_close();
-      __handle = NULL;
-      return 0;
+      serial_close(serial);
+      return NULL;
   }
 
   DCB state = { 0 };
   state.DCBlength = sizeof(DCB);
-  state.BaudRate = CBR_115200;
+  state.BaudRate = baud;
   state.ByteSize = 8;
   state.Parity = NOPARITY;
   state.StopBits = ONESTOPBIT;
 
-  if (!SetCommState(__handle, &state))
+  if (!SetCommState(serial->handle, &state))
   {
-    serial_close();
-    __handle = NULL;
-    return 0;
+    serial_close(serial);
+    return NULL;
   }
 
-  return 1;
+  return serial;
 }
 
-void serial_close()
+void serial_close(BBMXSserial* serial)
 {
-  if (__handle == NULL) return;
-  CloseHandle(__handle);
+  if (serial == NULL) return;
+  CloseHandle(serial->handle);
+  free(serial);
 }
 
-int serial_write(char* buf, size_t len)
+int serial_write(BBMXSserial* serial, const uint8_t* buf, size_t len)
 {
   int written;
-  if (!WriteFile(__handle, buf, len, &written, NULL))
+  if (!WriteFile(serial->handle, buf, len, &written, NULL))
   {
     return -1;
   }
@@ -71,13 +91,17 @@ int serial_write(char* buf, size_t len)
   return written;
 }
 
-int serial_read(char* buf, size_t len)
+int serial_read(BBMXSserial* serial, uint8_t* buf, size_t len, int timeoutMs)
 {
+  if (!set_read_timeout(serial, timeoutMs)) return -1;
+
   int read;
-  if (!ReadFile(__handle, buf, len, &read, NULL))
+  if (!ReadFile(serial->handle, buf, len, &read, NULL))
   {
     return -1;
   }
 
   return read;
 }
+
+#endif // BBMX_WIN32
@@ -0,0 +1,128 @@
+#include "bbmxs/serial.h"
+#include "config.h"
+
+#ifdef BBMX_LINUX
+// <asm/termbits.h> has termios2 (arbitrary baud rates via BOTHER) but
+// clashes with <termios.h>, so only the ioctl interface is used here.
+#include <asm/termbits.h>
+#include <asm/ioctls.h>
+#include <linux/serial.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+int ioctl(int fd, unsigned long request, ...);
+
+#define WRITE_TIMEOUT 1000 // ms
+
+struct BBMXSserial
+{
+  int fd;
+};
+
+static void set_low_latency(int fd)
+{
+  // Makes USB-serial bridges (FTDI etc.) push bytes out right away instead
+  // of waiting for their latency timer. Not every driver supports it.
+  struct serial_struct ser;
+  if (ioctl(fd, TIOCGSERIAL, &ser) != 0) return;
+
+  ser.flags |= ASYNC_LOW_LATENCY;
+  ioctl(fd, TIOCSSERIAL, &ser);
+}
+
+BBMXSserial* serial_open(const char* port, int baud)
+{
+  int fd = open(port, O_RDWR | O_NOCTTY | O_NONBLOCK | O_CLOEXEC);
+  if (fd < 0) return NULL;
+
+  BBMXSserial* serial = malloc(sizeof(BBMXSserial));
+  serial->fd = fd;
+
+  // Don't let anything else open the port while we're using it
+  ioctl(fd, TIOCEXCL);
+
+  struct termios2 tio;
+  if (ioctl(fd, TCGETS2, &tio) != 0)
+  {
+    serial_close(serial);
+    return NULL;
+  }
+
+  // Raw 8N1, no flow control, reads never block (poll does the waiting)
+  tio.c_iflag &= ~(IGNBRK | BRKINT | PARMRK | ISTRIP | INLCR | IGNCR | ICRNL | IXON | IXOFF | IXANY);
+  tio.c_oflag &= ~OPOST;
+  tio.c_lflag &= ~(ECHO | ECHONL | ICANON | ISIG | IEXTEN);
+  tio.c_cflag &= ~(CSIZE | PARENB | CSTOPB | CRTSCTS | CBAUD);
+  tio.c_cflag |= CS8 | CREAD | CLOCAL | BOTHER;
+  tio.c_ispeed = baud;
+  tio.c_ospeed = baud;
+  tio.c_cc[VMIN] = 0;
+  tio.c_cc[VTIME] = 0;
+
+  if (ioctl(fd, TCSETS2, &tio) != 0)
+  {
+    serial_close(serial);
+    return NULL;
+  }
+
+  set_low_latency(fd);
+  ioctl(fd, TCFLSH, TCIOFLUSH);
+
+  return serial;
+}
+
+void serial_close(BBMXSserial* serial)
+{
+  if (serial == NULL) return;
+  close(serial->fd);
+  free(serial);
+}
+
+int serial_write(BBMXSserial* serial, const uint8_t* buf, size_t len)
+{
+  size_t written = 0;
+  while (written < len)
+  {
+    ssize_t n = write(serial->fd, buf + written, len - written);
+    if (n > 0)
+    {
+      written += n;
+      continue;
+    }
+
+    if (n < 0 && errno != EAGAIN && errno != EINTR) return -1;
+
+    // The tx buffer is full, wait until the driver drained some of it
+    struct pollfd pfd = { serial->fd, POLLOUT, 0 };
+    int ready = poll(&pfd, 1, WRITE_TIMEOUT);
+    if (ready < 0 && errno != EINTR) return -1;
+    // Half a packet is worse than none, the caller resyncs with a keyframe
+    if (ready == 0) return -1;
+  }
+
+  return written;
+}
+
+int serial_read(BBMXSserial* serial, uint8_t* buf, size_t len, int timeoutMs)
+{
+  ssize_t n = read(serial->fd, buf, len);
+  if (n > 0) return n;
+  if (n < 0 && errno != EAGAIN && errno != EINTR) return -1;
+  if (timeoutMs == 0) return 0;
+
+  struct pollfd pfd = { serial->fd, POLLIN, 0 };
+  int ready = poll(&pfd, 1, timeoutMs);
+  if (ready < 0) return errno == EINTR ? 0 : -1;
+  if (ready == 0) return 0;
+
+  n = read(serial->fd, buf, len);
+  if (n < 0) return (errno == EAGAIN || errno == EINTR) ? 0 : -1;
+
+  return n;
+}
+
+#endif // BBMX_LINUX
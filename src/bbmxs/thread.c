@@ -0,0 +1,111 @@
+#include "bbmxs/thread.h"
+#include "config.h"
+
+#ifdef BBMX_WIN32
+#include <stdlib.h>
+#define WIN32_LEAN_AND_MEAN
+#include <Windows.h>
+
+typedef struct
+{
+  BBMXSthreadfunc func;
+  void* arg;
+} ThreadStart;
+
+static DWORD WINAPI thread_trampoline(LPVOID param)
+{
+  ThreadStart start = *(ThreadStart*)param;
+  free(param);
+
+  return start.func(start.arg);
+}
+
+BBMXSthread thread_create(BBMXSthreadfunc func, void* arg)
+{
+  ThreadStart* start = malloc(sizeof(ThreadStart));
+  start->func = func;
+  start->arg = arg;
+
+  HANDLE handle = CreateThread(NULL, 0, thread_trampoline, start, 0, NULL);
+  if (handle == NULL)
+  {
+    free(start);
+    return NULL;
+  }
+
+  return handle;
+}
+
+void thread_join(BBMXSthread thread)
+{
+  if (thread == NULL) return;
+  WaitForSingleObject(thread, INFINITE);
+  CloseHandle(thread);
+}
+
+BBMXSevent thread_event_create()
+{
+  return CreateEvent(NULL, FALSE, FALSE, NULL);
+}
+
+void thread_event_destroy(BBMXSevent ev)
+{
+  if (ev == NULL) return;
+  CloseHandle(ev);
+}
+
+void thread_event_signal(BBMXSevent ev)
+{
+  SetEvent(ev);
+}
+
+int thread_event_wait(BBMXSevent ev, int timeoutMs)
+{
+  return WaitForSingleObject(ev, timeoutMs < 0 ? INFINITE : timeoutMs) == WAIT_OBJECT_0;
+}
+
+BBMXSmutex thread_mutex_create()
+{
+  CRITICAL_SECTION* cs = malloc(sizeof(CRITICAL_SECTION));
+  InitializeCriticalSection(cs);
+  return cs;
+}
+
+void thread_mutex_destroy(BBMXSmutex mutex)
+{
+  if (mutex == NULL) return;
+  DeleteCriticalSection(mutex);
+  free(mutex);
+}
+
+void thread_mutex_lock(BBMXSmutex mutex)
+{
+  EnterCriticalSection(mutex);
+}
+
+void thread_mutex_unlock(BBMXSmutex mutex)
+{
+  LeaveCriticalSection(mutex);
+}
+
+long thread_atomic_xchg(volatile long* ptr, long value)
+{
+  return InterlockedExchange(ptr, value);
+}
+
+long thread_atomic_load(volatile long* ptr)
+{
+  return InterlockedCompareExchange(ptr, 0, 0);
+}
+
+void thread_atomic_store(volatile long* ptr, long value)
+{
+  InterlockedExchange(ptr, value);
+}
+
+unsigned long thread_ticks_ms()
+{
+  return GetTickCount();
+}
+
+#endif // BBMX_WIN32
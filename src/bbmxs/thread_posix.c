@@ -0,0 +1,172 @@
+#include "bbmxs/thread.h"
+#include "config.h"
+
+#ifndef BBMX_WIN32
+#include <pthread.h>
+#include <stdlib.h>
+#include <time.h>
+
+typedef struct
+{
+  pthread_t handle;
+  BBMXSthreadfunc func;
+  void* arg;
+} Thread;
+
+typedef struct
+{
+  pthread_mutex_t mutex;
+  pthread_cond_t cond;
+  int signaled;
+} Event;
+
+static void* thread_trampoline(void* param)
+{
+  Thread* thread = param;
+  thread->func(thread->arg);
+  return NULL;
+}
+
+BBMXSthread thread_create(BBMXSthreadfunc func, void* arg)
+{
+  Thread* thread = malloc(sizeof(Thread));
+  thread->func = func;
+  thread->arg = arg;
+
+  if (pthread_create(&thread->handle, NULL, thread_trampoline, thread) != 0)
+  {
+    free(thread);
+    return NULL;
+  }
+
+  return thread;
+}
+
+void thread_join(BBMXSthread thread)
+{
+  if (thread == NULL) return;
+
+  Thread* t = thread;
+  pthread_join(t->handle, NULL);
+  free(t);
+}
+
+BBMXSevent thread_event_create()
+{
+  Event* ev = malloc(sizeof(Event));
+
+  pthread_condattr_t attr;
+  pthread_condattr_init(&attr);
+  pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+
+  pthread_mutex_init(&ev->mutex, NULL);
+  pthread_cond_init(&ev->cond, &attr);
+  pthread_condattr_destroy(&attr);
+  ev->signaled = 0;
+
+  return ev;
+}
+
+void thread_event_destroy(BBMXSevent ev)
+{
+  if (ev == NULL) return;
+
+  Event* e = ev;
+  pthread_cond_destroy(&e->cond);
+  pthread_mutex_destroy(&e->mutex);
+  free(e);
+}
+
+void thread_event_signal(BBMXSevent ev)
+{
+  Event* e = ev;
+  pthread_mutex_lock(&e->mutex);
+  e->signaled = 1;
+  pthread_cond_signal(&e->cond);
+  pthread_mutex_unlock(&e->mutex);
+}
+
+int thread_event_wait(BBMXSevent ev, int timeoutMs)
+{
+  Event* e = ev;
+
+  struct timespec deadline;
+  clock_gettime(CLOCK_MONOTONIC, &deadline);
+  if (timeoutMs > 0)
+  {
+    deadline.tv_sec += timeoutMs / 1000;
+    deadline.tv_nsec += (long)(timeoutMs % 1000) * 1000000;
+    if (deadline.tv_nsec >= 1000000000)
+    {
+      deadline.tv_sec++;
+      deadline.tv_nsec -= 1000000000;
+    }
+  }
+
+  pthread_mutex_lock(&e->mutex);
+  while (!e->signaled)
+  {
+    if (timeoutMs < 0)
+    {
+      pthread_cond_wait(&e->cond, &e->mutex);
+    }
+    else if (pthread_cond_timedwait(&e->cond, &e->mutex, &deadline) != 0)
+    {
+      break;
+    }
+  }
+
+  int signaled = e->signaled;
+  e->signaled = 0;
+  pthread_mutex_unlock(&e->mutex);
+
+  return signaled;
+}
+
+BBMXSmutex thread_mutex_create()
+{
+  pthread_mutex_t* mutex = malloc(sizeof(pthread_mutex_t));
+  pthread_mutex_init(mutex, NULL);
+  return mutex;
+}
+
+void thread_mutex_destroy(BBMXSmutex mutex)
+{
+  if (mutex == NULL) return;
+  pthread_mutex_destroy(mutex);
+  free(mutex);
+}
+
+void thread_mutex_lock(BBMXSmutex mutex)
+{
+  pthread_mutex_lock(mutex);
+}
+
+void thread_mutex_unlock(BBMXSmutex mutex)
+{
+  pthread_mutex_unlock(mutex);
+}
+
+long thread_atomic_xchg(volatile long* ptr, long value)
+{
+  return __atomic_exchange_n(ptr, value, __ATOMIC_SEQ_CST);
+}
+
+long thread_atomic_load(volatile long* ptr)
+{
+  return __atomic_load_n(ptr, __ATOMIC_SEQ_CST);
+}
+
+void thread_atomic_store(volatile long* ptr, long value)
+{
+  __atomic_store_n(ptr, value, __ATOMIC_SEQ_CST);
+}
+
+unsigned long thread_ticks_ms()
+{
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return (unsigned long)now.tv_sec * 1000 + now.tv_nsec / 1000000;
+}
+
+#endif // BBMX_WIN32
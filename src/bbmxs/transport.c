@@ -0,0 +1,194 @@
+#include "bbmxs/transport.h"
+#include "bbmxs/proto.h"
+#include "bbmxs/thread.h"
+#include "globals.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+typedef struct
+{
+  uint8_t data[PROTO_MAX_PACKET];
+  size_t len;
+  uint8_t cmd;
+  size_t size;
+  uint8_t payload[PROTO_MAX_PAYLOAD];
+} InFlight;
+
+struct BBMXStransport
+{
+  BBMXSserial* serial;
+  InFlight* slots; // indexed by seq % window, so the window has to divide 256
+  int window;
+  int timeout;
+  uint8_t base; // oldest unacked seq
+  uint8_t next;
+  int inflight;
+  int retries;
+  int needSync;
+  unsigned long lastProgress;
+  BBMXSprotoparser parser;
+  BBMXStransportstats stats;
+  BBMXStransportack onAck;
+  void* user;
+};
+
+static int poll_acks(BBMXStransport* t, int timeoutMs)
+{
+  uint8_t buf[64];
+  int read = serial_read(t->serial, buf, sizeof(buf), timeoutMs);
+  if (read < 0) return 0;
+
+  BBMXSpacket packet;
+  for (int i = 0; i < read; i++)
+  {
+    int result = proto_parse_byte(&t->parser, buf[i], &packet);
+    if (result < 0)
+    {
+      t->stats.crcErrors++;
+      continue;
+    }
+    if (result == 0 || packet.cmd != PROTO_CMD_ACK) continue;
+
+    // Cumulative: everything up to and including packet.seq arrived
+    int acked = (uint8_t)(packet.seq - t->base) + 1;
+    if (acked > t->inflight) continue; // stale or duplicate ack
+
+    if (t->onAck != NULL)
+    {
+      for (int a = 0; a < acked; a++)
+      {
+        InFlight* slot = &t->slots[(uint8_t)(t->base + a) % t->window];
+        t->onAck(t->user, slot->cmd, slot->payload, slot->size);
+      }
+    }
+
+    t->inflight -= acked;
+    t->base = packet.seq + 1;
+    t->stats.packetsAcked += acked;
+    t->retries = 0;
+    t->lastProgress = thread_ticks_ms();
+  }
+
+  return 1;
+}
+
+static int retransmit(BBMXStransport* t)
+{
+  if (++t->retries > TRANSPORT_MAX_RETRIES)
+  {
+    // Give up on everything in flight and resync with the next packet
+    if (gDebugMode) printf("[DEBUG]: Transport: No ack after %d retries, dropping %d packets\n", TRANSPORT_MAX_RETRIES, t->inflight);
+    t->stats.failures++;
+    t->inflight = 0;
+    t->base = t->next;
+    t->retries = 0;
+    t->needSync = 1;
+    return 0;
+  }
+
+  for (int i = 0; i < t->inflight; i++)
+  {
+    InFlight* slot = &t->slots[(uint8_t)(t->base + i) % t->window];
+    if (serial_write(t->serial, slot->data, slot->len) < 0) return 0;
+  }
+  t->stats.retransmits += t->inflight;
+  t->lastProgress = thread_ticks_ms();
+
+  return 1;
+}
+
+// Waits until there is room for another packet (or nothing in flight)
+static int service(BBMXStransport* t, int maxInFlight)
+{
+  while (t->inflight > maxInFlight)
+  {
+    unsigned long elapsed = thread_ticks_ms() - t->lastProgress;
+    if (elapsed >= (unsigned long)t->timeout)
+    {
+      if (!retransmit(t)) return 0;
+      continue;
+    }
+
+    if (!poll_acks(t, t->timeout - elapsed)) return 0;
+  }
+
+  return 1;
+}
+
+static int queue(BBMXStransport* t, uint8_t cmd, const void* data, size_t size)
+{
+  if (!service(t, t->window - 1)) return 0;
+
+  InFlight* slot = &t->slots[t->next % t->window];
+  slot->len = proto_encode(t->next, cmd, data, size, slot->data);
+  if (slot->len == 0) return 0;
+
+  slot->cmd = cmd;
+  slot->size = size;
+  if (size > 0) memcpy(slot->payload, data, size);
+
+  if (serial_write(t->serial, slot->data, slot->len) < 0) return 0;
+
+  if (t->inflight == 0) t->lastProgress = thread_ticks_ms();
+  t->inflight++;
+  t->next++;
+  t->stats.packetsSent++;
+
+  // Pick up acks that are already there without waiting
+  return poll_acks(t, 0);
+}
+
+BBMXStransport* transport_open(BBMXSserial* serial, int window, int timeoutMs, BBMXStransportack onAck, void* user)
+{
+  int w = 1;
+  while (w * 2 <= window && w * 2 <= 64) w *= 2;
+
+  BBMXStransport* t = calloc(1, sizeof(BBMXStransport));
+  if (t == NULL) return NULL;
+
+  t->slots = malloc(sizeof(InFlight) * w);
+  if (t->slots == NULL)
+  {
+    free(t);
+    return NULL;
+  }
+
+  t->serial = serial;
+  t->window = w;
+  t->timeout = timeoutMs;
+  t->onAck = onAck;
+  t->user = user;
+  t->needSync = 1;
+  proto_parser_reset(&t->parser);
+
+  return t;
+}
+
+void transport_close(BBMXStransport* transport)
+{
+  if (transport == NULL) return;
+  free(transport->slots);
+  free(transport);
+}
+
+int transport_send(BBMXStransport* transport, uint8_t cmd, const void* data, size_t size)
+{
+  if (transport->needSync)
+  {
+    transport->needSync = 0;
+    if (!queue(transport, PROTO_CMD_SYNC, NULL, 0)) return 0;
+  }
+
+  return queue(transport, cmd, data, size);
+}
+
+int transport_drain(BBMXStransport* transport)
+{
+  return service(transport, 0);
+}
+
+BBMXStransportstats transport_stats(BBMXStransport* transport)
+{
+  return transport->stats;
+}
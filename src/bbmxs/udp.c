@@ -0,0 +1,146 @@
+#define _GNU_SOURCE // sendmmsg
+#include "bbmxs/udp.h"
+#include "config.h"
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef BBMX_WIN32
+#define WIN32_LEAN_AND_MEAN
+#include <winsock2.h>
+#include <ws2tcpip.h>
+typedef SOCKET Socket;
+#define INVALID_SOCK INVALID_SOCKET
+#define close_socket closesocket
+#else
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <netdb.h>
+#include <unistd.h>
+typedef int Socket;
+#define INVALID_SOCK -1
+#define close_socket close
+#endif
+
+#define MAX_BATCH 64
+
+struct BBMXSudp
+{
+  Socket sock;
+};
+
+BBMXSudp* udp_open()
+{
+#ifdef BBMX_WIN32
+  WSADATA wsa;
+  if (WSAStartup(MAKEWORD(2, 2), &wsa) != 0) return NULL;
+#endif
+
+  Socket sock = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
+  if (sock == INVALID_SOCK)
+  {
+#ifdef BBMX_WIN32
+    WSACleanup();
+#endif
+    return NULL;
+  }
+
+  // Art-Net is usually broadcast, sACN multicast. Loop multicast back so
+  // a listener on the same machine sees it too.
+  int yes = 1;
+  unsigned char ttl = 4;
+  unsigned char loop = 1;
+  setsockopt(sock, SOL_SOCKET, SO_BROADCAST, (const char*)&yes, sizeof(yes));
+  setsockopt(sock, IPPROTO_IP, IP_MULTICAST_TTL, (const char*)&ttl, sizeof(ttl));
+  setsockopt(sock, IPPROTO_IP, IP_MULTICAST_LOOP, (const char*)&loop, sizeof(loop));
+
+  BBMXSudp* udp = malloc(sizeof(BBMXSudp));
+  udp->sock = sock;
+  return udp;
+}
+
+void udp_close(BBMXSudp* udp)
+{
+  if (udp == NULL) return;
+  close_socket(udp->sock);
+  free(udp);
+
+#ifdef BBMX_WIN32
+  WSACleanup();
+#endif
+}
+
+int udp_resolve(const char* host, uint16_t port, BBMXSudpaddr* out)
+{
+  struct addrinfo hints;
+  memset(&hints, 0, sizeof(hints));
+  hints.ai_family = AF_INET;
+  hints.ai_socktype = SOCK_DGRAM;
+
+  struct addrinfo* result;
+  if (getaddrinfo(host, NULL, &hints, &result) != 0) return 0;
+
+  struct sockaddr_in addr;
+  memcpy(&addr, result->ai_addr, sizeof(addr));
+  addr.sin_port = htons(port);
+  freeaddrinfo(result);
+
+  memcpy(out->data, &addr, sizeof(addr));
+  return 1;
+}
+
+void udp_addr_ipv4(uint32_t ip, uint16_t port, BBMXSudpaddr* out)
+{
+  struct sockaddr_in addr;
+  memset(&addr, 0, sizeof(addr));
+  addr.sin_family = AF_INET;
+  addr.sin_addr.s_addr = htonl(ip);
+  addr.sin_port = htons(port);
+
+  memcpy(out->data, &addr, sizeof(addr));
+}
+
+#ifdef BBMX_LINUX
+int udp_send_batch(BBMXSudp* udp, const BBMXSudppacket* packets, int count)
+{
+  struct mmsghdr msgs[MAX_BATCH];
+  struct iovec iovs[MAX_BATCH];
+
+  int sent = 0;
+  while (sent < count)
+  {
+    int n = count - sent < MAX_BATCH ? count - sent : MAX_BATCH;
+    for (int i = 0; i < n; i++)
+    {
+      const BBMXSudppacket* p = &packets[sent + i];
+      iovs[i].iov_base = (void*)p->data;
+      iovs[i].iov_len = p->len;
+
+      memset(&msgs[i], 0, sizeof(msgs[i]));
+      msgs[i].msg_hdr.msg_name = (void*)p->addr->data;
+      msgs[i].msg_hdr.msg_namelen = sizeof(struct sockaddr_in);
+      msgs[i].msg_hdr.msg_iov = &iovs[i];
+      msgs[i].msg_hdr.msg_iovlen = 1;
+    }
+
+    int result = sendmmsg(udp->sock, msgs, n, 0);
+    if (result <= 0) break;
+    sent += result;
+  }
+
+  return sent;
+}
+#else
+int udp_send_batch(BBMXSudp* udp, const BBMXSudppacket* packets, int count)
+{
+  int sent = 0;
+  for (int i = 0; i < count; i++)
+  {
+    const BBMXSudppacket* p = &packets[i];
+    if (sendto(udp->sock, (const char*)p->data, p->len, 0, (const struct sockaddr*)p->addr->data, sizeof(struct sockaddr_in)) < 0) break;
+    sent++;
+  }
+
+  return sent;
+}
+#endif
@@ -0,0 +1,313 @@
+#include "cue.h"
+#include <lua/lauxlib.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define CUE_INITIAL_CAPACITY 64
+#define CUE_CLOCKS 2
+
+typedef struct
+{
+  lua_State* co;
+  int ref; // keeps the coroutine from being collected
+  uint32_t gen; // counts up when the slot is freed, handles and heap entries of earlier cues don't match then
+  int used;
+  int active; // resumed and not back yet, it can't be freed then
+  int stopped; // stopped while active, freed once it's back
+} Cue;
+
+typedef struct
+{
+  double at;
+  uint32_t seq; // equal times go in order, cues parked during an update wait for the next one
+  int slot;
+  uint32_t gen;
+} Entry;
+
+typedef struct
+{
+  Entry* entries;
+  int count;
+  int capacity;
+} Heap;
+
+static Cue* __cues = NULL;
+static int* __free = NULL; // stack of free slots
+static int __freeCount = 0;
+static int __capacity = 0;
+static int __count = 0;
+static int __running = -1;
+static Heap __heaps[CUE_CLOCKS];
+static uint32_t __seq = 0;
+static double __now = 0;
+static double __beat = -1;
+static char __wait_key; // a waiting cue yields its address first
+
+static int before(const Entry* a, const Entry* b)
+{
+  if (a->at != b->at) return a->at < b->at;
+  return (int32_t)(a->seq - b->seq) < 0;
+}
+
+static int heap_push(Heap* h, Entry e)
+{
+  if (h->count == h->capacity)
+  {
+    int capacity = h->capacity > 0 ? h->capacity * 2 : CUE_INITIAL_CAPACITY;
+    Entry* entries = realloc(h->entries, sizeof(Entry) * capacity);
+    if (entries == NULL) return 0;
+    h->entries = entries;
+    h->capacity = capacity;
+  }
+
+  int i = h->count++;
+  while (i > 0)
+  {
+    int parent = (i - 1) / 2;
+    if (!before(&e, &h->entries[parent])) break;
+    h->entries[i] = h->entries[parent];
+    i = parent;
+  }
+  h->entries[i] = e;
+  return 1;
+}
+
+static Entry heap_pop(Heap* h)
+{
+  Entry top = h->entries[0];
+  Entry last = h->entries[--h->count];
+  if (h->count == 0) return top;
+
+  int i = 0;
+  for (;;)
+  {
+    int child = i * 2 + 1;
+    if (child >= h->count) break;
+    if (child + 1 < h->count && before(&h->entries[child + 1], &h->entries[child])) child++;
+    if (!before(&h->entries[child], &last)) break;
+    h->entries[i] = h->entries[child];
+    i = child;
+  }
+  h->entries[i] = last;
+  return top;
+}
+
+static int alloc_slot()
+{
+  if (__freeCount == 0)
+  {
+    int capacity = __capacity > 0 ? __capacity * 2 : CUE_INITIAL_CAPACITY;
+    Cue* cues = realloc(__cues, sizeof(Cue) * capacity);
+    if (cues == NULL) return -1;
+    __cues = cues;
+    int* slots = realloc(__free, sizeof(int) * capacity);
+    if (slots == NULL) return -1;
+    __free = slots;
+
+    memset(&__cues[__capacity], 0, sizeof(Cue) * (capacity - __capacity));
+    for (int i = capacity - 1; i >= __capacity; i--)
+    {
+      __free[__freeCount++] = i;
+    }
+    __capacity = capacity;
+  }
+
+  return __free[--__freeCount];
+}
+
+static void free_slot(lua_State* L, int slot)
+{
+  Cue* c = &__cues[slot];
+  luaL_unref(L, LUA_REGISTRYINDEX, c->ref);
+  c->co = NULL;
+  c->used = 0;
+  c->stopped = 0;
+  c->gen++;
+  __free[__freeCount++] = slot;
+  __count--;
+}
+
+// Runs the cue until it waits or ends, 0 on an error which is left on top of L
+static int resume(lua_State* L, int slot, int nargs)
+{
+  lua_State* co = __cues[slot].co;
+  int running = __running;
+  __running = slot;
+  __cues[slot].active = 1;
+
+  int nres;
+#if LUA_VERSION_NUM >= 504
+  int status = lua_resume(co, L, nargs, &nres);
+#else
+  int status = lua_resume(co, L, nargs);
+  nres = lua_gettop(co);
+#endif
+
+  // A cue started from this one may have moved the array
+  Cue* c = &__cues[slot];
+  c->active = 0;
+  __running = running;
+
+  if (status != LUA_OK && status != LUA_YIELD)
+  {
+    lua_xmove(co, L, 1);
+    free_slot(L, slot);
+    return 0;
+  }
+
+  if (status == LUA_OK || c->stopped)
+  {
+    free_slot(L, slot);
+    return 1;
+  }
+
+  // A plain coroutine.yield() waits for the next update
+  BBMXcueclock clock = CUE_TIME;
+  double at = __now;
+  if (nres == 3 && lua_touserdata(co, -3) == &__wait_key)
+  {
+    clock = (BBMXcueclock)lua_tointeger(co, -2);
+    at = lua_tonumber(co, -1);
+  }
+  lua_pop(co, nres);
+
+  Entry e = { at, __seq++, slot, c->gen };
+  if (!heap_push(&__heaps[clock], e))
+  {
+    free_slot(L, slot);
+    lua_pushstring(L, "Out of memory for cues");
+    return 0;
+  }
+  return 1;
+}
+
+lua_Integer cue_start(lua_State* L, int nargs)
+{
+  int slot = alloc_slot();
+  if (slot < 0)
+  {
+    lua_pushstring(L, "Out of memory for cues");
+    return 0;
+  }
+
+  Cue* c = &__cues[slot];
+  c->co = lua_newthread(L);
+  c->ref = luaL_ref(L, LUA_REGISTRYINDEX);
+  c->used = 1;
+  __count++;
+  lua_xmove(L, c->co, nargs + 1);
+
+  lua_Integer handle = ((lua_Integer)c->gen << 32) | (slot + 1);
+  if (!resume(L, slot, nargs)) return 0;
+  return handle;
+}
+
+void cue_stop(lua_State* L, lua_Integer handle)
+{
+  int slot = (int)(handle & 0xFFFFFFFF) - 1;
+  uint32_t gen = (uint32_t)(handle >> 32);
+  if (slot < 0 || slot >= __capacity) return;
+
+  Cue* c = &__cues[slot];
+  if (!c->used || c->gen != gen) return;
+
+  // Its heap entry is skipped once it comes up
+  if (c->active) c->stopped = 1;
+  else free_slot(L, slot);
+}
+
+int cue_wait(lua_State* L, BBMXcueclock clock, double at)
+{
+  if (!cue_running(L) || !lua_isyieldable(L))
+  {
+    return luaL_error(L, "Waiting only works in a cue, start one with bbmx_cue");
+  }
+
+  // Something already due waits for the next update, but not in front of the others
+  double now = clock == CUE_TIME ? __now : __beat;
+  lua_pushlightuserdata(L, &__wait_key);
+  lua_pushinteger(L, clock);
+  lua_pushnumber(L, at > now ? at : now);
+  return lua_yield(L, 3);
+}
+
+int cue_running(lua_State* L)
+{
+  return __running >= 0 && __cues[__running].co == L;
+}
+
+double cue_now()
+{
+  return __now;
+}
+
+double cue_beat()
+{
+  return __beat;
+}
+
+int cue_update(lua_State* L, double now, double beat)
+{
+  // `time` was reset, the parked cues keep how long they still have to wait
+  if (now < __now)
+  {
+    Heap* h = &__heaps[CUE_TIME];
+    for (int i = 0; i < h->count; i++)
+    {
+      h->entries[i].at -= __now - now;
+    }
+  }
+
+  __now = now;
+  __beat = beat;
+  uint32_t seq = __seq;
+
+  for (int k = 0; k < CUE_CLOCKS; k++)
+  {
+    Heap* h = &__heaps[k];
+    double clock = k == CUE_TIME ? now : beat;
+    while (h->count > 0 && h->entries[0].at <= clock && (int32_t)(h->entries[0].seq - seq) < 0)
+    {
+      Entry e = heap_pop(h);
+      if (!__cues[e.slot].used || __cues[e.slot].gen != e.gen) continue;
+
+      if (!resume(L, e.slot, 0))
+      {
+        printf("%s\n", lua_tostring(L, -1));
+        lua_pop(L, 1);
+        return 0;
+      }
+    }
+  }
+
+  return 1;
+}
+
+int cue_count()
+{
+  return __count;
+}
+
+void cue_close(lua_State* L)
+{
+  for (int i = 0; i < __capacity; i++)
+  {
+    if (__cues[i].used) luaL_unref(L, LUA_REGISTRYINDEX, __cues[i].ref);
+  }
+
+  free(__cues);
+  free(__free);
+  for (int k = 0; k < CUE_CLOCKS; k++)
+  {
+    free(__heaps[k].entries);
+    memset(&__heaps[k], 0, sizeof(Heap));
+  }
+  __cues = NULL;
+  __free = NULL;
+  __freeCount = 0;
+  __capacity = 0;
+  __count = 0;
+  __running = -1;
+}
@@ -0,0 +1,83 @@
+#include "fft.h"
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifndef M_PI
+#define M_PI 3.14159265358979323846
+#endif
+
+int fft_init(BBMXfft* fft, int size)
+{
+  memset(fft, 0, sizeof(BBMXfft));
+  if (size < 2 || (size & (size - 1)) != 0) return 0;
+
+  fft->size = size;
+  fft->cosTable = malloc(sizeof(float) * size / 2);
+  fft->sinTable = malloc(sizeof(float) * size / 2);
+  fft->window = malloc(sizeof(float) * size);
+  for (int i = 0; i < size / 2; i++)
+  {
+    fft->cosTable[i] = cosf(2.0f * (float)M_PI * i / size);
+    fft->sinTable[i] = sinf(2.0f * (float)M_PI * i / size);
+  }
+  for (int i = 0; i < size; i++)
+  {
+    fft->window[i] = 0.5f - 0.5f * cosf(2.0f * (float)M_PI * i / size);
+  }
+
+  return 1;
+}
+
+void fft_close(BBMXfft* fft)
+{
+  free(fft->cosTable);
+  free(fft->sinTable);
+  free(fft->window);
+  memset(fft, 0, sizeof(BBMXfft));
+}
+
+void fft_run(const BBMXfft* fft, const float* samples, float* re, float* im)
+{
+  int n = fft->size;
+  for (int i = 0; i < n; i++)
+  {
+    re[i] = samples[i] * fft->window[i];
+    im[i] = 0;
+  }
+
+  for (int i = 1, j = 0; i < n; i++)
+  {
+    int bit = n >> 1;
+    for (; j & bit; bit >>= 1) j ^= bit;
+    j ^= bit;
+
+    if (i < j)
+    {
+      float t = re[i]; re[i] = re[j]; re[j] = t;
+      t = im[i]; im[i] = im[j]; im[j] = t;
+    }
+  }
+
+  for (int len = 2; len <= n; len <<= 1)
+  {
+    int half = len / 2;
+    int step = n / len;
+    for (int i = 0; i < n; i += len)
+    {
+      for (int k = 0; k < half; k++)
+      {
+        float wr = fft->cosTable[k * step];
+        float wi = -fft->sinTable[k * step];
+        int a = i + k;
+        int b = a + half;
+        float tr = re[b] * wr - im[b] * wi;
+        float ti = re[b] * wi + im[b] * wr;
+        re[b] = re[a] - tr;
+        im[b] = im[a] - ti;
+        re[a] += tr;
+        im[a] += ti;
+      }
+    }
+  }
+}
@@ -0,0 +1,167 @@
+#include "meter.h"
+#include "audio.h"
+#include "fft.h"
+#include "bbmxs/thread.h"
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Same hand over as the output threads, see output.c
+#define RESULT_FRESH 0x4
+#define RESULT_INDEX 0x3
+
+#define LOWEST_BAND_HZ 40.0
+#define HIGHEST_BAND_HZ 16000.0
+#define FLOOR_DB 60.0f
+
+static BBMXmeter __results[3];
+static volatile long __pending = 1;
+static int __back = 0;
+static int __front = 2;
+
+static BBMXfft __fft;
+static int __band_count = 0;
+static int __band_start[METER_MAX_BANDS + 1]; // first bin of every band, the last entry ends the last band
+static BBMXSthread __worker = NULL;
+static BBMXSevent __wake = NULL;
+static volatile long __running = 0;
+
+static float to_level(float amplitude)
+{
+  float db = 20.0f * log10f(amplitude + 1e-9f);
+  float level = (db + FLOOR_DB) / FLOOR_DB;
+  if (level < 0) return 0;
+  if (level > 1) return 1;
+  return level;
+}
+
+static void split_bands(unsigned int sampleRate)
+{
+  int bins = METER_FFT_SIZE / 2;
+  double top = HIGHEST_BAND_HZ < sampleRate / 2.0 ? HIGHEST_BAND_HZ : sampleRate / 2.0;
+
+  for (int b = 0; b <= __band_count; b++)
+  {
+    double hz = LOWEST_BAND_HZ * pow(top / LOWEST_BAND_HZ, (double)b / __band_count);
+    int bin = (int)round(hz * METER_FFT_SIZE / sampleRate);
+
+    // The low bands are narrower than a bin, every band gets one of its own
+    if (b > 0 && bin <= __band_start[b - 1]) bin = __band_start[b - 1] + 1;
+    if (bin > bins) bin = bins;
+    __band_start[b] = bin;
+  }
+}
+
+static int meter_thread(void* arg)
+{
+  (void)arg;
+
+  float* samples = malloc(sizeof(float) * METER_FFT_SIZE);
+  float* re = malloc(sizeof(float) * METER_FFT_SIZE);
+  float* im = malloc(sizeof(float) * METER_FFT_SIZE);
+  unsigned int rate = audio_sample_rate();
+  unsigned long long last = 0;
+  float peak = 0;
+
+  while (thread_atomic_load(&__running))
+  {
+    thread_event_wait(__wake, METER_INTERVAL);
+
+    unsigned long long position = audio_tap(samples, METER_FFT_SIZE);
+    if (position <= last) continue; // not playing
+
+    // The peak only looks at the samples that are new since the last pass
+    unsigned long long fresh = position - last;
+    if (fresh > METER_FFT_SIZE) fresh = METER_FFT_SIZE;
+
+    double sum = 0;
+    float newPeak = 0;
+    for (int i = 0; i < METER_FFT_SIZE; i++)
+    {
+      sum += (double)samples[i] * samples[i];
+      if (i >= METER_FFT_SIZE - (int)fresh && fabsf(samples[i]) > newPeak) newPeak = fabsf(samples[i]);
+    }
+
+    peak *= expf(-(float)((position - last) * 1000.0 / rate) / METER_PEAK_RELEASE);
+    if (newPeak > peak) peak = newPeak;
+    last = position;
+
+    fft_run(&__fft, samples, re, im);
+
+    BBMXmeter* out = &__results[__back];
+    out->rms = (float)sqrt(sum / METER_FFT_SIZE);
+    out->peak = peak;
+    out->bandCount = __band_count;
+    out->position = position * 1000.0 / rate;
+    for (int b = 0; b < __band_count; b++)
+    {
+      float energy = 0;
+      for (int k = __band_start[b]; k < __band_start[b + 1]; k++)
+      {
+        energy += re[k] * re[k] + im[k] * im[k];
+      }
+      // A full scale sine peaks at size / 4 with the Hann window
+      out->bands[b] = to_level(sqrtf(energy) * 4.0f / METER_FFT_SIZE);
+    }
+
+    __back = thread_atomic_xchg(&__pending, __back | RESULT_FRESH) & RESULT_INDEX;
+  }
+
+  free(samples);
+  free(re);
+  free(im);
+  return 0;
+}
+
+int meter_start(int bands)
+{
+  if (bands < METER_MIN_BANDS || bands > METER_MAX_BANDS) return 0;
+
+  __band_count = bands;
+  fft_init(&__fft, METER_FFT_SIZE);
+  split_bands(audio_sample_rate());
+
+  memset(__results, 0, sizeof(__results));
+  for (int i = 0; i < 3; i++) __results[i].bandCount = bands;
+  __pending = 1;
+  __back = 0;
+  __front = 2;
+
+  __running = 1;
+  __wake = thread_event_create();
+  __worker = __wake != NULL ? thread_create(meter_thread, NULL) : NULL;
+  if (__worker == NULL)
+  {
+    printf("bbmx Error: Failed to start audio meter thread\n");
+    __running = 0;
+    meter_stop();
+    return 0;
+  }
+
+  return 1;
+}
+
+void meter_stop()
+{
+  if (__worker != NULL)
+  {
+    thread_atomic_store(&__running, 0);
+    thread_event_signal(__wake);
+    thread_join(__worker);
+    __worker = NULL;
+  }
+  thread_event_destroy(__wake);
+  __wake = NULL;
+
+  fft_close(&__fft);
+}
+
+const BBMXmeter* meter_get()
+{
+  if (thread_atomic_load(&__pending) & RESULT_FRESH)
+  {
+    __front = thread_atomic_xchg(&__pending, __front) & RESULT_INDEX;
+  }
+  return &__results[__front];
+}
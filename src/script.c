@@ -0,0 +1,230 @@
+#include "script.h"
+#include <lua/lauxlib.h>
+#include "globals.h"
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <time.h>
+
+#define SCRIPT_CACHE_MAGIC "bbmx-luac"
+#define SCRIPT_CACHE_VERSION 1 // bump when the preprocessing changes, invalidates all caches
+
+typedef struct
+{
+  char magic[sizeof(SCRIPT_CACHE_MAGIC)];
+  uint32_t version;
+  uint32_t luaVersion;
+  int64_t mtime;
+  uint64_t size;
+  uint64_t hash;
+  int64_t written; // when the cache was written
+} CacheHeader; // followed by the lua_dump of the script
+
+static char* cache_path(const char* path)
+{
+  size_t len = strlen(path);
+  char* cache = malloc(len + 2);
+  memcpy(cache, path, len);
+  memcpy(cache + len, "c", 2);
+  return cache;
+}
+
+// Chunk name for error messages, the file name without its directory
+static const char* chunk_name(const char* path)
+{
+  const char* name = path;
+  for (const char* p = path; *p; p++)
+  {
+    if (*p == '\\' || *p == '/') name = p + 1;
+  }
+  return name;
+}
+
+static char* read_file(const char* path, size_t* size)
+{
+  FILE* f = fopen(path, "rb");
+  if (f == NULL) return NULL;
+
+  fseek(f, 0L, SEEK_END);
+  *size = ftell(f);
+  fseek(f, 0L, SEEK_SET);
+
+  char* buf = malloc(*size + 1);
+  if (buf != NULL && fread(buf, 1, *size, f) != *size)
+  {
+    free(buf);
+    buf = NULL;
+  }
+  if (buf != NULL) buf[*size] = 0;
+
+  fclose(f);
+  return buf;
+}
+
+// FNV-1a, 64 bit
+static uint64_t hash(const char* buf, size_t size)
+{
+  uint64_t h = 0xcbf29ce484222325ULL;
+  for (size_t i = 0; i < size; i++)
+  {
+    h ^= (uint8_t)buf[i];
+    h *= 0x100000001b3ULL;
+  }
+  return h;
+}
+
+// Removes require("bbmx"), the API is built in
+static void preprocess(char* buf, size_t* size)
+{
+  static const char require[] = "require(\"bbmx\")";
+  const size_t len = sizeof(require) - 1;
+
+  size_t out = 0;
+  for (size_t i = 0; i < *size;)
+  {
+    if (*size - i >= len && memcmp(&buf[i], require, len) == 0)
+    {
+      i += len;
+      continue;
+    }
+    buf[out++] = buf[i++];
+  }
+  buf[out] = 0;
+  *size = out;
+}
+
+// Header and bytecode of the cache, NULL when there is none or it's from another version
+static char* read_cache(const char* cache, CacheHeader* header, size_t* codeSize)
+{
+  size_t size;
+  char* buf = read_file(cache, &size);
+  if (buf == NULL) return NULL;
+
+  memcpy(header, buf, size < sizeof(CacheHeader) ? size : sizeof(CacheHeader));
+  if (size < sizeof(CacheHeader) || memcmp(header->magic, SCRIPT_CACHE_MAGIC, sizeof(SCRIPT_CACHE_MAGIC)) != 0
+    || header->version != SCRIPT_CACHE_VERSION || header->luaVersion != LUA_VERSION_NUM)
+  {
+    free(buf);
+    return NULL;
+  }
+
+  *codeSize = size - sizeof(CacheHeader);
+  return buf;
+}
+
+static int write_code(lua_State* L, const void* p, size_t size, void* ud)
+{
+  return fwrite(p, 1, size, ud) == size ? 0 : 1;
+}
+
+// Dumps the function on top of the stack into the cache
+static void write_cache(lua_State* L, const char* cache, const CacheHeader* header)
+{
+  FILE* f = fopen(cache, "wb");
+  int ok = f != NULL && fwrite(header, sizeof(CacheHeader), 1, f) == 1 && lua_dump(L, write_code, f, 0) == 0;
+  if (f != NULL) ok = fclose(f) == 0 && ok;
+
+  if (!ok)
+  {
+    printf("bbmx Warning: Failed to write bytecode cache: \"%s\"\n", cache);
+    remove(cache);
+  }
+}
+
+int script_load(lua_State* L, const char* path)
+{
+  struct stat st;
+  if (stat(path, &st) != 0)
+  {
+    lua_pushfstring(L, "Can't open \"%s\"", path);
+    return LUA_ERRFILE;
+  }
+
+  const char* name = chunk_name(path);
+  char* cache = cache_path(path);
+
+  CacheHeader header;
+  size_t codeSize = 0;
+  char* cached = read_cache(cache, &header, &codeSize);
+
+  // Unchanged since it was compiled, so the script isn't even read. The
+  // mtime only has seconds, a script changed in the second the cache was
+  // written could have the same one, so that is left to the hash.
+  if (cached != NULL && header.mtime == (int64_t)st.st_mtime && header.size == (uint64_t)st.st_size
+    && header.mtime < header.written)
+  {
+    if (luaL_loadbufferx(L, cached + sizeof(CacheHeader), codeSize, name, "b") == LUA_OK)
+    {
+      if (gDebugMode) printf("[DEBUG]: Loaded bytecode from \"%s\"\n", cache);
+      free(cached);
+      free(cache);
+      return LUA_OK;
+    }
+    lua_pop(L, 1);
+  }
+
+  size_t size;
+  char* src = read_file(path, &size);
+  if (src == NULL)
+  {
+    free(cached);
+    free(cache);
+    lua_pushfstring(L, "Can't read \"%s\"", path);
+    return LUA_ERRFILE;
+  }
+
+  int status;
+  uint64_t h = hash(src, size);
+  if (cached != NULL && header.hash == h
+    && luaL_loadbufferx(L, cached + sizeof(CacheHeader), codeSize, name, "b") == LUA_OK)
+  {
+    // Only touched, e.g. by a checkout
+    if (gDebugMode) printf("[DEBUG]: Loaded bytecode from \"%s\"\n", cache);
+    status = LUA_OK;
+  }
+  else
+  {
+    if (cached != NULL && header.hash == h) lua_pop(L, 1);
+
+    preprocess(src, &size);
+    status = luaL_loadbuffer(L, src, size, name);
+    if (status == LUA_OK && gDebugMode) printf("[DEBUG]: Compiled \"%s\"\n", path);
+  }
+
+  if (status == LUA_OK)
+  {
+    memset(&header, 0, sizeof(CacheHeader));
+    memcpy(header.magic, SCRIPT_CACHE_MAGIC, sizeof(SCRIPT_CACHE_MAGIC));
+    header.version = SCRIPT_CACHE_VERSION;
+    header.luaVersion = LUA_VERSION_NUM;
+    header.mtime = st.st_mtime;
+    header.size = st.st_size;
+    header.hash = h;
+    header.written = time(NULL);
+    write_cache(L, cache, &header);
+  }
+
+  free(src);
+  free(cached);
+  free(cache);
+  return status;
+}
+
+int script_compile(const char* path)
+{
+  lua_State* L = luaL_newstate();
+
+  int status = script_load(L, path);
+  if (status != LUA_OK)
+  {
+    printf("bbmx Error: Failed to compile script: \"%s\"\n%s\n", path, lua_tostring(L, -1));
+    lua_close(L);
+    return 0;
+  }
+
+  printf("Compiled \"%s\"\n", path);
+  lua_close(L);
+  return 1;
+}
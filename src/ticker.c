@@ -0,0 +1,56 @@
+#include "ticker.h"
+#include <math.h>
+#include <string.h>
+
+int ticker_init(BBMXticker* ticker, double ups)
+{
+  memset(ticker, 0, sizeof(BBMXticker));
+  if (ups <= 0) return 0;
+
+  ticker->period = 1000.0 / ups;
+  ticker->timer = ticker_timer_create();
+  ticker->last = ticker_now_ms();
+  ticker->next = ticker->last + ticker->period;
+
+  return 1;
+}
+
+void ticker_close(BBMXticker* ticker)
+{
+  ticker_timer_destroy(ticker->timer);
+  ticker->timer = NULL;
+}
+
+double ticker_wait(BBMXticker* ticker)
+{
+  double now = ticker_now_ms();
+  if (now < ticker->next)
+  {
+    ticker_sleep_until(ticker->timer, ticker->next);
+    now = ticker_now_ms();
+
+    double jitter = now - ticker->next;
+    if (jitter > ticker->maxJitter) ticker->maxJitter = jitter;
+  }
+  else
+  {
+    ticker->late++;
+  }
+
+  // Stay on the grid: the next deadline is relative to the last one,
+  // not to when this tick actually started
+  double behind = now - ticker->next;
+  if (behind >= ticker->period * TICKER_MAX_CATCHUP)
+  {
+    unsigned long missed = (unsigned long)floor(behind / ticker->period);
+    ticker->dropped += missed;
+    ticker->next += missed * ticker->period;
+  }
+  ticker->next += ticker->period;
+  ticker->ticks++;
+
+  double delta = now - ticker->last;
+  ticker->last = now;
+
+  return delta;
+}
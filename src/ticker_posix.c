@@ -0,0 +1,42 @@
+#include "ticker.h"
+#include "config.h"
+
+#ifndef BBMX_WIN32
+#include <errno.h>
+#include <math.h>
+#include <time.h>
+
+double ticker_now_ms()
+{
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return now.tv_sec * 1000.0 + now.tv_nsec / 1000000.0;
+}
+
+// clock_nanosleep with an absolute deadline needs no timer object
+void* ticker_timer_create()
+{
+  return NULL;
+}
+
+void ticker_timer_destroy(void* timer)
+{
+}
+
+void ticker_sleep_until(void* timer, double deadline)
+{
+  struct timespec ts;
+  double sec = floor(deadline / 1000.0);
+  ts.tv_sec = (time_t)sec;
+  ts.tv_nsec = (long)((deadline - sec * 1000.0) * 1000000.0);
+  if (ts.tv_nsec >= 1000000000L)
+  {
+    ts.tv_sec++;
+    ts.tv_nsec -= 1000000000L;
+  }
+
+  // Signals (e.g. SIGINT) interrupt the sleep, the caller checks gShouldExit
+  clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL);
+}
+
+#endif // BBMX_WIN32
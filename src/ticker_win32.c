@@ -0,0 +1,62 @@
+#include "ticker.h"
+#include "config.h"
+
+#ifdef BBMX_WIN32
+#define WIN32_LEAN_AND_MEAN
+#include <Windows.h>
+
+#ifndef CREATE_WAITABLE_TIMER_HIGH_RESOLUTION
+#define CREATE_WAITABLE_TIMER_HIGH_RESOLUTION 0x00000002
+#endif
+
+double ticker_now_ms()
+{
+  static LARGE_INTEGER freq = { 0 };
+  if (freq.QuadPart == 0) QueryPerformanceFrequency(&freq);
+
+  LARGE_INTEGER now;
+  QueryPerformanceCounter(&now);
+  return (double)now.QuadPart * 1000.0 / (double)freq.QuadPart;
+}
+
+void* ticker_timer_create()
+{
+  // High resolution timers (Windows 10 1803+) wake up within ~0.5ms
+  // without raising the system wide timer resolution. Older versions
+  // fall back to a normal timer with the default scheduler granularity.
+  HANDLE timer = CreateWaitableTimerEx(NULL, NULL, CREATE_WAITABLE_TIMER_HIGH_RESOLUTION, TIMER_ALL_ACCESS);
+  if (timer != NULL) return timer;
+
+  return CreateWaitableTimerEx(NULL, NULL, 0, TIMER_ALL_ACCESS);
+}
+
+void ticker_timer_destroy(void* timer)
+{
+  if (timer == NULL) return;
+  CloseHandle(timer);
+}
+
+void ticker_sleep_until(void* timer, double deadline)
+{
+  double remaining = deadline - ticker_now_ms();
+  if (remaining <= 0) return;
+
+  if (timer == NULL)
+  {
+    Sleep((DWORD)remaining);
+    return;
+  }
+
+  // Relative due time in 100ns units
+  LARGE_INTEGER due;
+  due.QuadPart = -(LONGLONG)(remaining * 10000.0);
+  if (!SetWaitableTimer(timer, &due, 0, NULL, NULL, FALSE))
+  {
+    Sleep((DWORD)remaining);
+    return;
+  }
+
+  WaitForSingleObject(timer, INFINITE);
+}
+
+#endif // BBMX_WIN32
@@ -0,0 +1,79 @@
+#include "watch.h"
+#include "config.h"
+
+#ifdef BBMX_LINUX
+#include <sys/inotify.h>
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+struct BBMXwatch
+{
+  int fd;
+  char* name; // file name within the watched directory
+};
+
+BBMXwatch* watch_start(const char* path)
+{
+  const char* name = path;
+  for (const char* p = path; *p; p++)
+  {
+    if (*p == '/') name = p + 1;
+  }
+
+  size_t dirLen = name - path;
+  char* dir = malloc(dirLen + 2);
+  if (dirLen > 0) memcpy(dir, path, dirLen);
+  else dir[dirLen++] = '.';
+  dir[dirLen] = 0;
+
+  int fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+  if (fd < 0 || inotify_add_watch(fd, dir, IN_CLOSE_WRITE | IN_MOVED_TO) < 0)
+  {
+    printf("bbmx Warning: Can't watch \"%s\" for changes (errno %d)\n", dir, errno);
+    if (fd >= 0) close(fd);
+    free(dir);
+    return NULL;
+  }
+  free(dir);
+
+  BBMXwatch* watch = malloc(sizeof(BBMXwatch));
+  watch->fd = fd;
+  watch->name = malloc(strlen(name) + 1);
+  strcpy(watch->name, name);
+  return watch;
+}
+
+void watch_stop(BBMXwatch* watch)
+{
+  if (watch == NULL) return;
+
+  close(watch->fd);
+  free(watch->name);
+  free(watch);
+}
+
+int watch_changed(BBMXwatch* watch)
+{
+  if (watch == NULL) return 0;
+
+  // An editor saving fires a few events at once, they all count as one change
+  char buf[4096] __attribute__((aligned(__alignof__(struct inotify_event))));
+  int changed = 0;
+  ssize_t len;
+  while ((len = read(watch->fd, buf, sizeof(buf))) > 0)
+  {
+    for (char* p = buf; p < buf + len;)
+    {
+      const struct inotify_event* ev = (const struct inotify_event*)p;
+      if (ev->mask & IN_Q_OVERFLOW) changed = 1;
+      if (ev->len > 0 && strcmp(ev->name, watch->name) == 0) changed = 1;
+      p += sizeof(struct inotify_event) + ev->len;
+    }
+  }
+
+  return changed;
+}
+#endif // BBMX_LINUX
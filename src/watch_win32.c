@@ -0,0 +1,96 @@
+#include "watch.h"
+#include "config.h"
+
+#ifdef BBMX_WIN32
+#define WIN32_LEAN_AND_MEAN
+#include <Windows.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+struct BBMXwatch
+{
+  HANDLE handle;
+  char* path;
+  FILETIME written;
+  DWORD size;
+};
+
+static void stamp(const char* path, FILETIME* written, DWORD* size)
+{
+  WIN32_FILE_ATTRIBUTE_DATA data;
+  if (!GetFileAttributesExA(path, GetFileExInfoStandard, &data))
+  {
+    memset(written, 0, sizeof(FILETIME));
+    *size = 0;
+    return;
+  }
+
+  *written = data.ftLastWriteTime;
+  *size = data.nFileSizeLow;
+}
+
+BBMXwatch* watch_start(const char* path)
+{
+  const char* name = path;
+  for (const char* p = path; *p; p++)
+  {
+    if (*p == '\\' || *p == '/') name = p + 1;
+  }
+
+  size_t dirLen = name - path;
+  char* dir = malloc(dirLen + 2);
+  if (dirLen > 0) memcpy(dir, path, dirLen);
+  else dir[dirLen++] = '.';
+  dir[dirLen] = 0;
+
+  HANDLE handle = FindFirstChangeNotificationA(dir, FALSE, FILE_NOTIFY_CHANGE_LAST_WRITE | FILE_NOTIFY_CHANGE_FILE_NAME);
+  if (handle == INVALID_HANDLE_VALUE)
+  {
+    printf("bbmx Warning: Can't watch \"%s\" for changes (error %lu)\n", dir, GetLastError());
+    free(dir);
+    return NULL;
+  }
+  free(dir);
+
+  BBMXwatch* watch = malloc(sizeof(BBMXwatch));
+  watch->handle = handle;
+  watch->path = malloc(strlen(path) + 1);
+  strcpy(watch->path, path);
+  stamp(path, &watch->written, &watch->size);
+  return watch;
+}
+
+void watch_stop(BBMXwatch* watch)
+{
+  if (watch == NULL) return;
+
+  FindCloseChangeNotification(watch->handle);
+  free(watch->path);
+  free(watch);
+}
+
+int watch_changed(BBMXwatch* watch)
+{
+  if (watch == NULL) return 0;
+
+  int signaled = 0;
+  while (WaitForSingleObject(watch->handle, 0) == WAIT_OBJECT_0)
+  {
+    signaled = 1;
+    if (!FindNextChangeNotification(watch->handle)) break;
+  }
+  if (!signaled) return 0;
+
+  // The notification is for the whole directory (e.g. the bytecode cache
+  // being written), only a new time or size means the script changed
+  FILETIME written;
+  DWORD size;
+  stamp(watch->path, &written, &size);
+  if (CompareFileTime(&written, &watch->written) == 0 && size == watch->size) return 0;
+
+  watch->written = written;
+  watch->size = size;
+  return 1;
+}
+#endif // BBMX_WIN32
@@ -0,0 +1,165 @@
+#include "worker.h"
+#include <lua/lauxlib.h>
+#include <lua/lualib.h>
+#include "bbmx_lapi.h"
+#include "bbmxs/layer.h"
+#include "bbmxs/thread.h"
+#include "globals.h"
+#include "script.h"
+#include "ticker.h"
+#include <stdio.h>
+#include <stdlib.h>
+
+typedef struct
+{
+  const char* script;
+  lua_State* L;
+  BBMXSlayer* layer;
+  BBMXSthread thread;
+  double start; // ticker_now_ms when `time` was 0
+  volatile long running;
+  volatile long failed;
+} Worker;
+
+static Worker* __workers = NULL;
+static int __worker_count = 0;
+
+static int run_worker(void* arg)
+{
+  Worker* w = arg;
+
+  BBMXticker ticker;
+  ticker_init(&ticker, gUPS);
+
+  while (thread_atomic_load(&w->running))
+  {
+    double delta = ticker_wait(&ticker);
+    if (!thread_atomic_load(&w->running)) break;
+
+    lua_pushnumber(w->L, ticker_now_ms() - w->start);
+    lua_setglobal(w->L, "time");
+
+    lua_getglobal(w->L, "BBMX_loop");
+    lua_pushnumber(w->L, delta);
+    if (lua_pcall(w->L, 1, 0, 0) != LUA_OK)
+    {
+      printf("bbmx Error: Layer \"%s\": %s\n", w->script, lua_tostring(w->L, -1));
+      lua_pop(w->L, 1);
+      thread_atomic_store(&w->failed, 1);
+      break;
+    }
+
+    layer_publish(w->layer);
+  }
+
+  ticker_close(&ticker);
+  return 0;
+}
+
+// Loads the script and runs BBMX_start, still on the tick thread
+static int load_worker(Worker* w, BBMXScontext* ctx, const BBMXSlayerscript* def, double time)
+{
+  w->script = def->script;
+  w->layer = layer_create(ctx, def->mode);
+  if (w->layer == NULL)
+  {
+    printf("bbmx Error: Failed to create the layer of \"%s\"\n", def->script);
+    return 0;
+  }
+
+  w->L = luaL_newstate();
+  luaL_openlibs(w->L);
+  bbmx_lapi_load_layer(w->L, w->layer);
+
+  w->start = ticker_now_ms() - time;
+  lua_pushnumber(w->L, time);
+  lua_setglobal(w->L, "time");
+
+  if (script_load(w->L, def->script) != LUA_OK || lua_pcall(w->L, 0, 0, 0) != LUA_OK)
+  {
+    printf("bbmx Error: Failed to load layer script: \"%s\"\n%s\n", def->script, lua_tostring(w->L, -1));
+    return 0;
+  }
+
+  lua_getglobal(w->L, "BBMX_start");
+  if (lua_isfunction(w->L, -1))
+  {
+    if (lua_pcall(w->L, 0, 0, 0) != LUA_OK)
+    {
+      printf("bbmx Error: Layer \"%s\": %s\n", def->script, lua_tostring(w->L, -1));
+      return 0;
+    }
+  }
+  else
+  {
+    lua_pop(w->L, 1);
+  }
+  layer_publish(w->layer);
+
+  // Without BBMX_loop the layer just keeps what BBMX_start set
+  lua_getglobal(w->L, "BBMX_loop");
+  int loopFunc = lua_isfunction(w->L, -1);
+  lua_pop(w->L, 1);
+  if (!loopFunc) return 1;
+
+  w->running = 1;
+  w->thread = thread_create(run_worker, w);
+  if (w->thread == NULL)
+  {
+    printf("bbmx Error: Failed to start the thread of layer \"%s\"\n", def->script);
+    w->running = 0;
+    return 0;
+  }
+
+  return 1;
+}
+
+int worker_start(BBMXScontext* ctx, double time)
+{
+  if (ctx->layerCount == 0) return 1;
+
+  __workers = calloc(ctx->layerCount, sizeof(Worker));
+  if (__workers == NULL) return 0;
+
+  for (int i = 0; i < ctx->layerCount; i++)
+  {
+    __worker_count++;
+    if (!load_worker(&__workers[i], ctx, &ctx->layers[i], time))
+    {
+      worker_stop();
+      return 0;
+    }
+  }
+
+  if (gDebugMode) printf("[DEBUG]: Started %d layer scripts\n", __worker_count);
+  return 1;
+}
+
+void worker_stop()
+{
+  for (int i = 0; i < __worker_count; i++)
+  {
+    thread_atomic_store(&__workers[i].running, 0);
+  }
+
+  for (int i = 0; i < __worker_count; i++)
+  {
+    Worker* w = &__workers[i];
+    thread_join(w->thread);
+    if (w->L != NULL) lua_close(w->L);
+  }
+
+  layer_destroy_all();
+  free(__workers);
+  __workers = NULL;
+  __worker_count = 0;
+}
+
+int worker_ok()
+{
+  for (int i = 0; i < __worker_count; i++)
+  {
+    if (thread_atomic_load(&__workers[i].failed)) return 0;
+  }
+  return 1;
+}
@@ -0,0 +1,367 @@
+// bbmxemu - reference controller for the v2 serial protocol.
+// Only universe 1 is kept, writes to other universes are just printed.
+// Opens a pseudo terminal and behaves like a controller attached to it,
+// so bbmx can be run against it without hardware:
+//
+//   bbmxemu -l /tmp/bbmx0 -d 5 -v
+//   bbmx_port("/tmp/bbmx0") in the script
+//
+// -l <path>     symlink the pty to <path>
+// -d <percent>  drop this percentage of incoming packets (tests retransmits)
+// -v            print every DMX write
+//
+// With -n it listens for network output instead (bbmx_port("artnet:127.0.0.1")
+// or bbmx_port("sacn:127.0.0.1")) and prints what arrives per universe:
+// -n artnet|sacn
+#define _XOPEN_SOURCE 600
+#define _DEFAULT_SOURCE
+#include "bbmxs/bbmxs.h"
+#include "bbmxs/proto.h"
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <termios.h>
+#include <unistd.h>
+
+static volatile sig_atomic_t __stop = 0;
+static uint8_t __universe[BBMXS_UNIVERSE_SIZE];
+static int __verbose = 0;
+static int __drop_percent = 0;
+
+static int __synced = 0;
+static uint8_t __expected = 0;
+static uint8_t __last = 0;
+
+static unsigned long __received = 0;
+static unsigned long __dropped = 0;
+static unsigned long __out_of_order = 0;
+static unsigned long __crc_errors = 0;
+static unsigned long __acks = 0;
+
+static void on_signal(int sig)
+{
+  __stop = 1;
+}
+
+static void apply(const BBMXSpacket* packet)
+{
+  switch (packet->cmd)
+  {
+    case BBMXS_CMD_DMX_WRITE:
+    {
+      int count = packet->len > 0 ? packet->payload[0] : 0;
+      for (int i = 0; i < count && 2 + i * 2 < packet->len; i++)
+      {
+        uint8_t ch = packet->payload[1 + i * 2];
+        uint8_t value = packet->payload[2 + i * 2];
+        if (ch < 1) continue;
+
+        __universe[ch - 1] = value;
+        if (__verbose) printf("ch %3d = %3d\n", ch, value);
+      }
+      break;
+    }
+    case BBMXS_CMD_DMX_RANGE:
+    {
+      if (packet->len < 5) break;
+      uint8_t universe = packet->payload[0];
+      uint16_t start = (packet->payload[1] << 8) | packet->payload[2];
+      uint16_t count = (packet->payload[3] << 8) | packet->payload[4];
+      if (start < 1 || count > packet->len - 5 || start - 1 + count > BBMXS_UNIVERSE_SIZE) break;
+      if (universe != 1)
+      {
+        if (__verbose) printf("u %d: ignored\n", universe);
+        break;
+      }
+
+      memcpy(&__universe[start - 1], &packet->payload[5], count);
+      if (__verbose) printf("u 1: ch %3d-%3d written\n", start, start + count - 1);
+      break;
+    }
+    case BBMXS_CMD_DMX_FRAME:
+    {
+      if (packet->len != 1 + BBMXS_UNIVERSE_SIZE) break;
+      if (packet->payload[0] != 1)
+      {
+        if (__verbose) printf("u %d: ignored\n", packet->payload[0]);
+        break;
+      }
+
+      memcpy(__universe, &packet->payload[1], BBMXS_UNIVERSE_SIZE);
+      if (__verbose) printf("u 1: full frame\n");
+      break;
+    }
+    case BBMXS_CMD_DMX_DELTA:
+    {
+      if (packet->len < 1) break;
+      if (packet->payload[0] != 1)
+      {
+        if (__verbose) printf("u %d: ignored\n", packet->payload[0]);
+        break;
+      }
+
+      size_t i = 1;
+      while (i + 3 <= packet->len)
+      {
+        uint16_t start = (packet->payload[i] << 8) | packet->payload[i + 1];
+        uint8_t count = packet->payload[i + 2];
+        i += 3;
+        if (start < 1 || start - 1 + count > BBMXS_UNIVERSE_SIZE || i + count > packet->len) break;
+
+        memcpy(&__universe[start - 1], &packet->payload[i], count);
+        if (__verbose) printf("u 1: ch %3d-%3d changed\n", start, start + count - 1);
+        i += count;
+      }
+      break;
+    }
+    default:
+    {
+      if (__verbose) printf("Unknown command: 0x%02X\n", packet->cmd);
+      break;
+    }
+  }
+}
+
+// Returns 1 when the ack has to be (re)sent
+static int receive(const BBMXSpacket* packet)
+{
+  __received++;
+
+  if (__drop_percent > 0 && rand() % 100 < __drop_percent)
+  {
+    __dropped++;
+    return 0;
+  }
+
+  if (packet->cmd == PROTO_CMD_SYNC)
+  {
+    __synced = 1;
+    __last = packet->seq;
+    __expected = packet->seq + 1;
+    return 1;
+  }
+
+  if (!__synced) return 0;
+
+  if (packet->seq != __expected)
+  {
+    // Go-back-N: drop it and repeat the last cumulative ack
+    __out_of_order++;
+    return 1;
+  }
+
+  apply(packet);
+  __last = packet->seq;
+  __expected++;
+  return 1;
+}
+
+static void send_ack(int fd)
+{
+  uint8_t buf[PROTO_MAX_PACKET];
+  size_t len = proto_encode(__last, PROTO_CMD_ACK, NULL, 0, buf);
+  if (write(fd, buf, len) == (ssize_t)len) __acks++;
+}
+
+#define NET_MAX_UNIVERSES 64
+
+static int run_network(const char* mode)
+{
+  int artnet = strcmp(mode, "artnet") == 0;
+  if (!artnet && strcmp(mode, "sacn") != 0)
+  {
+    fprintf(stderr, "bbmxemu Error: Unknown network mode: \"%s\"\n", mode);
+    return 1;
+  }
+
+  int sock = socket(AF_INET, SOCK_DGRAM, 0);
+  int yes = 1;
+  setsockopt(sock, SOL_SOCKET, SO_REUSEADDR, &yes, sizeof(yes));
+
+  struct sockaddr_in addr;
+  memset(&addr, 0, sizeof(addr));
+  addr.sin_family = AF_INET;
+  addr.sin_addr.s_addr = htonl(INADDR_ANY);
+  addr.sin_port = htons(artnet ? 6454 : 5568);
+  if (bind(sock, (struct sockaddr*)&addr, sizeof(addr)) != 0)
+  {
+    perror("bbmxemu Error: Failed to bind");
+    return 1;
+  }
+
+  if (!artnet)
+  {
+    // Join the multicast groups of the first universes
+    for (int u = 1; u <= NET_MAX_UNIVERSES; u++)
+    {
+      struct ip_mreq mreq;
+      mreq.imr_multiaddr.s_addr = htonl(0xEFFF0000 | u);
+      mreq.imr_interface.s_addr = htonl(INADDR_ANY);
+      setsockopt(sock, IPPROTO_IP, IP_ADD_MEMBERSHIP, &mreq, sizeof(mreq));
+    }
+  }
+
+  printf("bbmxemu: Listening for %s on port %d\n", mode, ntohs(addr.sin_port));
+  fflush(stdout);
+
+  unsigned long packets[NET_MAX_UNIVERSES + 1] = { 0 };
+  unsigned long gaps[NET_MAX_UNIVERSES + 1] = { 0 };
+  int lastSeq[NET_MAX_UNIVERSES + 1];
+  for (int i = 0; i <= NET_MAX_UNIVERSES; i++) lastSeq[i] = -1;
+
+  while (!__stop)
+  {
+    struct pollfd pfd = { sock, POLLIN, 0 };
+    if (poll(&pfd, 1, 200) <= 0) continue;
+
+    uint8_t buf[1024];
+    ssize_t len = recv(sock, buf, sizeof(buf), 0);
+
+    int universe;
+    int seq;
+    const uint8_t* data;
+    if (artnet)
+    {
+      if (len < 18 || memcmp(buf, "Art-Net", 8) != 0) continue;
+      universe = (buf[14] | (buf[15] << 8)) + 1;
+      seq = buf[12];
+      data = &buf[18];
+    }
+    else
+    {
+      if (len < 126 || memcmp(&buf[4], "ASC-E1.17", 9) != 0) continue;
+      universe = (buf[113] << 8) | buf[114];
+      seq = buf[111];
+      data = &buf[126];
+    }
+    if (universe < 1 || universe > NET_MAX_UNIVERSES) continue;
+
+    int expected = artnet ? (lastSeq[universe] == 0xFF ? 1 : lastSeq[universe] + 1) : (lastSeq[universe] + 1) & 0xFF;
+    if (lastSeq[universe] >= 0 && seq != expected) gaps[universe]++;
+    lastSeq[universe] = seq;
+    packets[universe]++;
+
+    if (__verbose)
+    {
+      printf("u %d: seq %3d | ch 1-8: %d %d %d %d %d %d %d %d\n", universe, seq,
+        data[0], data[1], data[2], data[3], data[4], data[5], data[6], data[7]);
+      fflush(stdout);
+    }
+  }
+
+  printf("\n");
+  for (int u = 1; u <= NET_MAX_UNIVERSES; u++)
+  {
+    if (packets[u] == 0) continue;
+    printf("bbmxemu: universe %d: %lu packets | %lu sequence gaps\n", u, packets[u], gaps[u]);
+  }
+
+  close(sock);
+  return 0;
+}
+
+int main(int argc, char* argv[])
+{
+  const char* linkPath = NULL;
+  const char* netMode = NULL;
+
+  int opt;
+  while ((opt = getopt(argc, argv, "l:d:n:v")) != -1)
+  {
+    switch (opt)
+    {
+      case 'l': linkPath = optarg; break;
+      case 'd': __drop_percent = atoi(optarg); break;
+      case 'n': netMode = optarg; break;
+      case 'v': __verbose = 1; break;
+      default:
+        fprintf(stderr, "Usage: %s [-l link] [-d drop-percent] [-n artnet|sacn] [-v]\n", argv[0]);
+        return 1;
+    }
+  }
+
+  signal(SIGINT, on_signal);
+  signal(SIGTERM, on_signal);
+
+  if (netMode != NULL)
+  {
+    return run_network(netMode);
+  }
+
+  int master = posix_openpt(O_RDWR | O_NOCTTY);
+  if (master < 0 || grantpt(master) != 0 || unlockpt(master) != 0)
+  {
+    perror("bbmxemu Error: Failed to open pty");
+    return 1;
+  }
+
+  const char* slaveName = ptsname(master);
+
+  // Keep the slave side open so the master doesn't see a hangup
+  // every time bbmx closes the port
+  int slave = open(slaveName, O_RDWR | O_NOCTTY);
+  if (slave < 0)
+  {
+    perror("bbmxemu Error: Failed to open pty slave");
+    return 1;
+  }
+
+  struct termios tio;
+  tcgetattr(slave, &tio);
+  cfmakeraw(&tio);
+  tcsetattr(slave, TCSANOW, &tio);
+
+  if (linkPath != NULL)
+  {
+    unlink(linkPath);
+    if (symlink(slaveName, linkPath) != 0)
+    {
+      perror("bbmxemu Error: Failed to create link");
+      return 1;
+    }
+  }
+
+  printf("bbmxemu: Listening on %s\n", linkPath != NULL ? linkPath : slaveName);
+  fflush(stdout);
+
+  BBMXSprotoparser parser;
+  proto_parser_reset(&parser);
+
+  while (!__stop)
+  {
+    struct pollfd pfd = { master, POLLIN, 0 };
+    if (poll(&pfd, 1, 200) <= 0) continue;
+
+    uint8_t buf[1024];
+    ssize_t read_ = read(master, buf, sizeof(buf));
+    if (read_ <= 0) continue;
+
+    // Acks are cumulative, so one per read is enough
+    int ack = 0;
+    BBMXSpacket packet;
+    for (ssize_t i = 0; i < read_; i++)
+    {
+      int result = proto_parse_byte(&parser, buf[i], &packet);
+      if (result < 0) __crc_errors++;
+      if (result > 0) ack |= receive(&packet);
+    }
+
+    if (ack) send_ack(master);
+    if (__verbose) fflush(stdout);
+  }
+
+  printf("\nbbmxemu: %lu received | %lu dropped | %lu out of order | %lu CRC errors | %lu acks sent\n",
+    __received, __dropped, __out_of_order, __crc_errors, __acks);
+
+  if (linkPath != NULL) unlink(linkPath);
+  close(slave);
+  close(master);
+
+  return 0;
+}